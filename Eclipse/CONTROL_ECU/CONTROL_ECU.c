@@ -6,129 +6,415 @@
  */
 
 #include "uart.h"
+#include "frame.h"
 #include "interrupt.h"
 #include "buzzer.h"
-#include "external_eeprom.h"
+#include "record_store.h"
+#include "audit_log.h"
+#include "eeprom_cache.h"
+#include "twi.h"
 #include "dcmotor.h"
 #include "timer.h"
 #include "pir_sensor.h"
+#include "scheduler.h"
+#include "power.h"
+#include "profile.h"
+#include "trace.h"
 #include <util/delay.h>
 
 /* ---------------------- MACROS AND CONSTANTS ---------------------- */
 
-/* Convert milliseconds to timer ticks based on CPU frequency and prescaler */
-#define MILLISECONDS_TO_TICKS(ms)  (((F_CPU / 1024) * (ms)) / 1000)
-
-/* Password configuration */
+/* Password configuration, digits travel packed two per byte */
 #define PASSWORD_DIGITS 	5
+#define PASSWORD_PACKED_BYTES	((PASSWORD_DIGITS + 1) / 2)
 
 /* UART commands and responses */
 #define MC2_READY      		0xE0
 #define GET_STATUS     		0xE1
 #define SET_NEW_PASS   		0xE2
-#define NEXT_DIGIT     		0xE3
 #define CONFIRM_PASS   		0xE4
 #define PASS_MATCH     		0xE5
 #define PASS_NO_MATCH  		0xE6
 #define CHECK_PASS          0xE7
+#define GET_DIAG            0xE8
 #define RECIEVED            0xE9
 #define ATTEMPTS_ENDED      0xF0
 #define UNLOCK_DOOR         0xF1
 #define LOCK_DOOR           0xF2
+#define GET_AUDIT           0xF3
+#define AUDIT_DATA          0xF4
+#define GET_PROFILE         0xF5
+#define GET_TRACE           0xF6
+#define BAUD_CHANGE         0xEA
+#define BAUD_CONFIRM        0xEB
+#define BAUD_REJECTED       0xEC
+#define REQUEST_PENDING     0xED
+#define REQUEST_REJECTED    0xEE
 #define PASSWORD_SAVED      0x23
 
-/* EEPROM base address to store the password */
-#define PASSWORD_BASE_ADDRESS 0x0311
+/*
+ * GET_PROFILE and GET_TRACE are only answered in a diagnostics build
+ * (-DDIAG_COMMANDS=1), no session is needed for them and the trace shows
+ * what the panels were used for.
+ */
+#ifndef DIAG_COMMANDS
+#define DIAG_COMMANDS         0
+#endif
+
+/* Bus addresses, every HMI panel is built with its own PANEL_ADDRESS */
+#define CONTROL_ADDRESS       0x01
+#define FIRST_PANEL_ADDRESS   0x02
+#ifndef CONTROL_PANELS
+#define CONTROL_PANELS        2    /* Panels on the bus, inside and outside the door */
+#endif
+
+/* Replies kept per panel so a retransmitted request is answered again instead of executed twice */
+#define REPLY_CACHE_SIZE    4
+
+/* Wrong passwords in a row before a panel is locked out */
+#define MAX_ATTEMPTS        3
+
+/*
+ * Audit entries sent per GET_AUDIT, back to back in AUDIT_DATA frames before
+ * the GET_AUDIT reply, and how many fit in one frame.
+ */
+#define AUDIT_EXPORT_ENTRIES      16
+#define AUDIT_ENTRIES_PER_FRAME   (FRAME_MAX_PAYLOAD / AUDIT_ENTRY_SIZE)
+
+/* Door cycle and lockout durations in milliseconds */
+#define DOOR_MOTOR_TIME_MS        15000
+#define LOCKOUT_TIME_MS           60000UL
+
+/* Time the new baud rate is kept without a clean BAUD_CONFIRM from HMI */
+#define BAUD_CONFIRM_TIMEOUT_MS   100
+
+/* PIR sampling while the door is open, and the background EEPROM work period */
+#define PIR_POLL_MS               20
+#define STORAGE_SERVICE_MS        2
+
+/* Period the audit log is looked for again while the EEPROM did not give it, every try blocks */
+#define AUDIT_RETRY_MS            1000
+
+/* Bytes of the GET_STATUS and MC2_READY status: password state, door cycle state, audit log found */
+#define STATUS_BYTES              3
+
+/* Longest frame on the line, its address byte included */
+#define FRAME_LINE_BYTES          (1 + FRAME_OVERHEAD + FRAME_MAX_PAYLOAD)
+
+/* Scheduler events of the CONTROL tasks */
+#define LINK_RECEIVED             0x01    /* the UART buffered a byte */
+#define LINK_BAUD_TIMEOUT         0x02    /* no BAUD_CONFIRM in time */
+#define DOOR_TIMER                0x01    /* the motor ran for DOOR_MOTOR_TIME_MS */
+#define DOOR_PIR_SAMPLE           0x02
+#define LOCKOUT_TIMER             0x01
+#define STORAGE_SERVICE           0x01
+#define EXPORT_NEXT_FRAME         0x01
+
+/* GET_DIAG payload byte asking for another page than the link counters */
+#define DIAG_SCHEDULER            0x01
+#define DIAG_POWER                0x02
+
+/* EEPROM address where the password was kept before the record store, read once to carry it over */
+#define LEGACY_PASSWORD_ADDRESS 0x0311
+
+/* ---------------------- TYPES ---------------------- */
+
+/* Door cycle states, the cycle runs in the background while requests are served */
+typedef enum
+{
+	DOOR_IDLE,DOOR_UNLOCKING,DOOR_OPEN,DOOR_LOCKING
+}CONTROL_DoorStateType;
+
+/* State kept separately for every panel on the bus */
+typedef struct {
+	FRAME_Type reply_cache[REPLY_CACHE_SIZE];  /* last replies, looked up by sequence number */
+	uint8 reply_cache_next;
+	uint8 new_password[PASSWORD_DIGITS + 1];   /* kept until its confirmation arrives */
+	uint8 new_password_pending;
+	uint8 authorized;        /* set by a matching CHECK_PASS, consumed by the request right after it, SET_NEW_PASS passes it on to CONFIRM_PASS */
+	uint8 exporting;         /* the last request was an authorized GET_AUDIT, the next one needs no CHECK_PASS */
+	uint8 attempts;          /* wrong passwords in a row */
+	uint8 lockout_active;
+	uint32 lockout_start_time;
+}CONTROL_SessionType;
 
 /* ---------------------- GLOBAL VARIABLES ---------------------- */
 
-/* Pointer to EEPROM base address where password is stored */
-static volatile uint8 * ptr_to_pass = (uint8 *)PASSWORD_BASE_ADDRESS;
+/* Saved password */
+static uint8 current_password[PASSWORD_DIGITS + 1];
+
+/* Set once the record store was read, until then current_password is not known */
+static boolean storage_ready = FALSE;
+
+/* Set once current_password holds a saved password, it is all zeros before */
+static boolean password_saved = FALSE;
 
-/* Stores the last received command from HMI ECU */
-volatile uint8 received_key;
+/* Set once the end of the audit log was found, until then its events wait in RAM */
+static boolean audit_ready = FALSE;
+static uint32 audit_retry_time = 0;
 
-/* Timer counter for delays */
-static volatile uint8 time = 0;
+/* One session per panel, indexed by panel address - FIRST_PANEL_ADDRESS */
+static CONTROL_SessionType sessions[CONTROL_PANELS];
 
-/* UART configuration structure */
-UART_ConfigType UART_CONFIG = {EIGHT_BITS, NO_PARITY, ONE_STOP_BIT, 2400};
+/* Door cycle in progress, the panel and the UNLOCK_DOOR request it will answer when done */
+static CONTROL_DoorStateType door_state = DOOR_IDLE;
+static uint8 door_address = 0;
+static uint8 door_sequence = FRAME_NO_SEQUENCE;
+static Timer_HandleType door_pir_timer = TIMER_NO_HANDLE;
 
-/* Timer configuration structure for 1-second delay using CTC mode */
-Timer_ConfigType TIMER1_CONFIG = {0, (uint16)(MILLISECONDS_TO_TICKS(1000)), TIMER_1, F_CPU_1024, CTC_MODE_OC_DISABLED};
+/* Baud rate on trial until HMI confirms it */
+static boolean baud_pending = FALSE;
+static uint32 baud_start_time = 0;
+static uint16 baud_framing_errors = 0;
+
+/* Framing errors counted when the link task last looked */
+static uint16 framing_errors = 0;
+
+/* Audit export in progress, the entries go out one frame per run of the export task */
+static boolean export_active = FALSE;
+static FRAME_Type export_request;
+static uint8 export_entries[AUDIT_EXPORT_ENTRIES * AUDIT_ENTRY_SIZE];
+static uint16 export_first_sequence = 0;
+static uint16 export_next_sequence = 0;
+static uint8 export_count = 0;
+static uint8 export_sent = 0;
+
+/* Scheduler tasks, in the order they take turns */
+static SCHED_TaskIdType link_task;
+static SCHED_TaskIdType door_task;
+static SCHED_TaskIdType lockout_task;
+static SCHED_TaskIdType storage_task;
+static SCHED_TaskIdType export_task;
+
+/* UART configuration structure, 9-bit data for the multi-processor bus */
+UART_ConfigType UART_CONFIG = {NINE_BITS, NO_PARITY, ONE_STOP_BIT, 2400};
+
+/* TWI configuration structure, the EEPROM bus runs at TWI_BIT_RATE */
+TWI_ConfigType TWI_CONFIG = {CONTROL_ADDRESS};
 
 /* ---------------------- FUNCTION DEFINITIONS ---------------------- */
 
 /*
- * Callback function for Timer1, increments the time counter.
+ * Callbacks of the UART and the software timers, they run inside the ISRs and only post events.
  */
-void CONTROL_countSeconds(void)
+void CONTROL_byteReceived(void)
+{
+	SCHED_post(link_task, LINK_RECEIVED);
+}
+
+void CONTROL_baudTimeout(void)
+{
+	SCHED_post(link_task, LINK_BAUD_TIMEOUT);
+}
+
+void CONTROL_doorTimer(void)
+{
+	SCHED_post(door_task, DOOR_TIMER);
+}
+
+void CONTROL_pirSample(void)
+{
+	SCHED_post(door_task, DOOR_PIR_SAMPLE);
+}
+
+void CONTROL_lockoutTimer(void)
+{
+	SCHED_post(lockout_task, LOCKOUT_TIMER);
+}
+
+void CONTROL_storageTick(void)
 {
-	time++;
+	SCHED_post(storage_task, STORAGE_SERVICE);
 }
 
 /*
- * Delay function using Timer1 for a given number of seconds.
+ * Return the session of the panel with the given address, NULL_PTR if it is not a panel of ours.
  */
-void CONTROL_delaySeconds(uint8 seconds)
+CONTROL_SessionType * CONTROL_getSession(uint8 address)
 {
-	time = 0;
-	Timer_setCallBack(CONTROL_countSeconds, TIMER_1);
-	Timer_init(&TIMER1_CONFIG);
-	while (time < seconds);
-	time = 0;
-	Timer_deInit(TIMER_1);
+	if ((address < FIRST_PANEL_ADDRESS) || (address >= FIRST_PANEL_ADDRESS + CONTROL_PANELS))
+	{
+		return NULL_PTR;
+	}
+	return &sessions[address - FIRST_PANEL_ADDRESS];
 }
 
 /*
- * Read the current password from EEPROM and store it into a buffer.
+ * Send a reply tagged with the sequence number of its request to the panel that
+ * sent it and keep it, so a retransmission of that request gets the same answer.
  */
-void CONTROL_updatePassword(uint8 * password)
+void CONTROL_reply(const FRAME_Type * request, uint8 command, const uint8 * payload, uint8 length)
 {
-	volatile uint8 digits = 0;
-	while (digits < PASSWORD_DIGITS)
+	CONTROL_SessionType * session = CONTROL_getSession(request->address);
+	FRAME_Type * reply = &session->reply_cache[session->reply_cache_next];
+	uint8 i;
+
+	reply->address = request->address;
+	reply->sequence = request->sequence;
+	reply->command = command;
+	reply->length = length;
+	for (i = 0; i < length; i++)
 	{
-		EEPROM_readByte((uint16)(ptr_to_pass + digits), password + digits);
-		_delay_ms(10);
-		digits++;
+		reply->payload[i] = payload[i];
+	}
+	session->reply_cache_next = (session->reply_cache_next + 1) % REPLY_CACHE_SIZE;
+
+	FRAME_send(request->address, request->sequence, command, payload, length);
+}
+
+/*
+ * Answer a request that was already handled, returns FALSE if it is a new one.
+ */
+uint8 CONTROL_answerDuplicate(const FRAME_Type * request)
+{
+	CONTROL_SessionType * session = CONTROL_getSession(request->address);
+	uint8 i;
+
+	/* Still running, the final reply comes once the door cycle gets there */
+	if (((door_state == DOOR_UNLOCKING) || (door_state == DOOR_OPEN)) &&
+			(request->address == door_address) && (request->sequence == door_sequence))
+	{
+		FRAME_send(request->address, request->sequence, REQUEST_PENDING, NULL_PTR, 0);
+		return TRUE;
+	}
+
+	/* Still exporting, the GET_AUDIT reply follows the data frames */
+	if ((export_active == TRUE) &&
+			(request->address == export_request.address) && (request->sequence == export_request.sequence))
+	{
+		return TRUE;
+	}
+
+	for (i = 0; i < REPLY_CACHE_SIZE; i++)
+	{
+		if (session->reply_cache[i].sequence == request->sequence)
+		{
+			FRAME_resend(&session->reply_cache[i]);
+			return TRUE;
+		}
 	}
+	return FALSE;
+}
+
+/*
+ * Forget the replies of a previous session, a panel numbers its requests from scratch after a reset.
+ */
+void CONTROL_clearReplyCache(CONTROL_SessionType * session)
+{
+	uint8 i;
+	for (i = 0; i < REPLY_CACHE_SIZE; i++)
+	{
+		session->reply_cache[i].sequence = FRAME_NO_SEQUENCE;
+	}
+}
+
+/*
+ * Read the current password from the record store and store it into a buffer.
+ */
+void CONTROL_updatePassword(uint8 * password)
+{
+	RECORD_read(RECORD_PASSWORD, password, PASSWORD_DIGITS);
 
 	/* Add terminator character at the end */
-	password[digits] = '#';
+	password[PASSWORD_DIGITS] = '#';
 }
 
 /*
- * Receive password from UART (sent by HMI ECU).
+ * Unpack a password received in a frame, two digits per byte, low nibble first.
  */
-void CONTROL_receivePassword(uint8 * password)
+void CONTROL_unpackPassword(const uint8 * packed, uint8 * password)
 {
-	volatile uint8 digits = 0;
+	uint8 digits = 0;
 	while (digits < PASSWORD_DIGITS)
 	{
-		password[digits] = UART_recieveByte();
-		UART_sendByte(NEXT_DIGIT);
+		password[digits] = (packed[digits / 2] >> ((digits % 2) * 4)) & 0x0F;
 		digits++;
 	}
 
-	/* Read the final terminator byte */
-	password[digits] = UART_recieveByte();
+	/* Add terminator character at the end */
+	password[digits] = PASSWORD_SAVED;
 }
 
 /*
- * Save the password into EEPROM memory.
+ * Save the password and its terminator in the record store, the store
+ * appends its record in the background once the password has settled.
  */
 void CONTROL_savePassword(uint8 * password)
 {
-	uint8 digits = 0;
-	while (digits < PASSWORD_DIGITS)
+	RECORD_write(RECORD_PASSWORD, password, PASSWORD_DIGITS + 1);
+}
+
+/*
+ * Move a password saved at the old fixed address into an empty record store.
+ */
+void CONTROL_importPassword(void)
+{
+	uint8 password[PASSWORD_DIGITS + 1];
+
+	if ((RECORD_read(RECORD_PASSWORD, password, PASSWORD_DIGITS + 1) == ERROR) &&
+			(EEPROM_readBlock(LEGACY_PASSWORD_ADDRESS, password, PASSWORD_DIGITS + 1) == SUCCESS) &&
+			(password[PASSWORD_DIGITS] == PASSWORD_SAVED))
 	{
-		EEPROM_writeByte((uint16)(ptr_to_pass + digits), password[digits]);
-		_delay_ms(10);
-		digits++;
+		CONTROL_savePassword(password);
 	}
+}
 
-	/* Store terminator */
-	EEPROM_writeByte((uint16)(ptr_to_pass + PASSWORD_DIGITS), password[digits]);
+/*
+ * Read the record store and find the end of the audit log, at boot and again
+ * on GET_STATUS while the EEPROM did not answer. Events are kept in RAM meanwhile.
+ * The saved password is loaded once here, its record already passed its CRC.
+ */
+void CONTROL_openStorage(void)
+{
+	uint8 password[PASSWORD_DIGITS + 1];
+
+	audit_ready = (AUDIT_init() == SUCCESS);
+	audit_retry_time = Timer_now();
+	if (RECORD_init() == SUCCESS)
+	{
+		storage_ready = TRUE;
+		CONTROL_importPassword();
+		if ((RECORD_read(RECORD_PASSWORD, password, PASSWORD_DIGITS + 1) == SUCCESS) &&
+				(password[PASSWORD_DIGITS] == PASSWORD_SAVED))
+		{
+			CONTROL_updatePassword(current_password);
+			password_saved = TRUE;
+		}
+	}
+}
+
+/*
+ * Fill the status that GET_STATUS and MC2_READY carry: the password state,
+ * PASSWORD_SAVED once there is one, the door cycle state and TRUE once the
+ * audit log was found.
+ */
+void CONTROL_getStatus(uint8 * status)
+{
+	uint8 password[PASSWORD_DIGITS + 1];
+
+	if (storage_ready == FALSE)
+	{
+		/* Fail closed: a password we can not read still exists, the panel must not offer a new one */
+		status[0] = PASSWORD_SAVED;
+	}
+	else if (RECORD_read(RECORD_PASSWORD, password, PASSWORD_DIGITS + 1) == SUCCESS)
+	{
+		status[0] = password[PASSWORD_DIGITS];
+	}
+	else
+	{
+		status[0] = 0xFF;    /* what an erased EEPROM used to answer */
+	}
+	status[1] = (uint8)door_state;
+	status[2] = audit_ready;
+}
+
+/*
+ * Return TRUE if a new password could not be kept: the store was never read or the last EEPROM write back failed.
+ */
+uint8 CONTROL_storageFault(void)
+{
+	return (storage_ready == FALSE) || (CACHE_getError() != 0);
 }
 
 /*
@@ -146,110 +432,713 @@ uint8 CONTROL_comparePasswords(uint8 * password, uint8 * other_password)
 	return TRUE;
 }
 
-/* ---------------------- MAIN FUNCTION ---------------------- */
+/*
+ * Switch to the baud rate requested by HMI and keep it only if HMI confirms it
+ * at the new rate within BAUD_CONFIRM_TIMEOUT_MS without framing errors.
+ */
+void CONTROL_changeBaudRate(const FRAME_Type * request)
+{
+	UART_BaudRateType baud_rate = (UART_BaudRateType)request->payload[0] |
+			((UART_BaudRateType)request->payload[1] << 8) |
+			((UART_BaudRateType)request->payload[2] << 16) |
+			((UART_BaudRateType)request->payload[3] << 24);
 
-int main(void)
+	/*
+	 * Only rates of our own baud table within the error tolerance are accepted,
+	 * and only with a single panel, one panel can not move a shared bus alone.
+	 * A build for several panels stays at the start rate, the panels stop
+	 * negotiating at the first BAUD_REJECTED.
+	 */
+	if ((CONTROL_PANELS > 1) || (UART_getFastestBaudRate(baud_rate + 1) != baud_rate))
+	{
+		FRAME_send(request->address, request->sequence, BAUD_REJECTED, NULL_PTR, 0);
+		return;
+	}
+
+	/* Without a software timer for the confirmation the trial could never end, stay at this rate */
+	baud_start_time = Timer_now();
+	if (Timer_startOneShot(BAUD_CONFIRM_TIMEOUT_MS, CONTROL_baudTimeout) == TIMER_NO_HANDLE)
+	{
+		FRAME_send(request->address, request->sequence, BAUD_REJECTED, NULL_PTR, 0);
+		return;
+	}
+
+	FRAME_send(request->address, request->sequence, RECIEVED, NULL_PTR, 0);
+	UART_flushTx();
+	UART_setBaudRate(baud_rate);
+
+	/* The next frame decides, CONTROL_checkBaudConfirm takes it */
+	baud_framing_errors = UART_getFramingErrors();
+	baud_pending = TRUE;
+}
+
+/*
+ * Keep the baud rate on trial if the frame is a clean BAUD_CONFIRM, go back to
+ * the start rate otherwise. A corrupted frame is passed as NULL_PTR.
+ */
+void CONTROL_checkBaudConfirm(const FRAME_Type * confirm)
 {
-	/* System status, password buffers */
-	uint8 status = 0;
-	uint8 new_password[PASSWORD_DIGITS + 1];
-	uint8 current_password[PASSWORD_DIGITS + 1];
-	uint8 confirm_password[PASSWORD_DIGITS + 1];
+	baud_pending = FALSE;
 
-	/* Initialize system peripherals */
-	Enable_Global_Interrupt();
-	UART_init(&UART_CONFIG);
-	UART_sendByte(MC2_READY);    /* Notify HMI ECU we're ready */
-	Buzzer_init();
-	DcMotor_Init();
-	PIR_init();
+	if ((confirm != NULL_PTR) && (confirm->command == BAUD_CONFIRM) &&
+			(UART_getFramingErrors() == baud_framing_errors))
+	{
+		FRAME_send(confirm->address, confirm->sequence, RECIEVED, NULL_PTR, 0);
+	}
+	else
+	{
+		UART_setBaudRate(UART_CONFIG.baud_rate);
+	}
+	framing_errors = UART_getFramingErrors();
+}
 
-	while (1)
+/*
+ * Reply to GET_DIAG with the link health counters of this ECU, each one
+ * little-endian 16-bit in this order: bytes in, bytes out, framing errors,
+ * overrun errors, parity errors, receive buffer overflows, dropped frames
+ * and retransmits.
+ * With DIAG_SCHEDULER as payload the reply is the latency probe of every task
+ * since the last such request instead, two bytes per task in the order they
+ * take turns: the longest wait for a run and the longest run, in milliseconds
+ * up to 255.
+ * With DIAG_POWER it is the time spent awake and in IDLE since power up, in
+ * milliseconds, each one little-endian 32-bit.
+ */
+void CONTROL_sendDiagnostics(const FRAME_Type * request)
+{
+	UART_StatsType uart_stats;
+	FRAME_StatsType frame_stats;
+	SCHED_StatsType task_stats;
+	POWER_StatsType power_stats;
+	uint16 counters[8];
+	uint8 payload[sizeof(counters)];
+	uint8 i;
+
+	if ((request->length > 0) && (request->payload[0] == DIAG_SCHEDULER))
+	{
+		for (i = 0; i <= export_task; i++)
+		{
+			SCHED_getStats(i, &task_stats, TRUE);
+			payload[2 * i] = (task_stats.max_latency > 0xFF) ? 0xFF : (uint8)task_stats.max_latency;
+			payload[2 * i + 1] = (task_stats.max_run_time > 0xFF) ? 0xFF : (uint8)task_stats.max_run_time;
+		}
+		CONTROL_reply(request, GET_DIAG, payload, 2 * i);
+		return;
+	}
+
+	if ((request->length > 0) && (request->payload[0] == DIAG_POWER))
+	{
+		POWER_getStats(&power_stats);
+		for (i = 0; i < 4; i++)
+		{
+			payload[i] = (uint8)(power_stats.time_ms[POWER_ACTIVE] >> (8 * i));
+			payload[4 + i] = (uint8)(power_stats.time_ms[POWER_IDLE] >> (8 * i));
+		}
+		CONTROL_reply(request, GET_DIAG, payload, 8);
+		return;
+	}
+
+	UART_getStats(&uart_stats);
+	FRAME_getStats(&frame_stats);
+
+	counters[0] = uart_stats.bytes_in;
+	counters[1] = uart_stats.bytes_out;
+	counters[2] = uart_stats.framing_errors;
+	counters[3] = uart_stats.overrun_errors;
+	counters[4] = uart_stats.parity_errors;
+	counters[5] = uart_stats.buffer_overflows;
+	counters[6] = frame_stats.dropped_frames;
+	counters[7] = frame_stats.retransmits;
+
+	for (i = 0; i < 8; i++)
+	{
+		payload[2 * i] = (uint8)counters[i];
+		payload[2 * i + 1] = (uint8)(counters[i] >> 8);
+	}
+
+	CONTROL_reply(request, GET_DIAG, payload, sizeof(payload));
+}
+
+#if (DIAG_COMMANDS != 0)
+/*
+ * Answer GET_PROFILE: the payload is a probe id, the reply is its entry of
+ * the probe table as PROF_encode writes it, REQUEST_REJECTED for an unknown probe.
+ */
+void CONTROL_sendProfile(const FRAME_Type * request)
+{
+	uint8 payload[PROF_RECORD_BYTES];
+	uint8 length = 0;
+
+	if (request->length > 0)
+	{
+		length = PROF_encode(request->payload[0], payload);
+	}
+
+	if (length == 0)
+	{
+		CONTROL_reply(request, REQUEST_REJECTED, NULL_PTR, 0);
+	}
+	else
+	{
+		CONTROL_reply(request, GET_PROFILE, payload, length);
+	}
+}
+
+/*
+ * Answer GET_TRACE: the payload is the offset of the first record wanted from
+ * the oldest one, the reply is the page TRACE_encode writes, empty past the end.
+ */
+void CONTROL_sendTrace(const FRAME_Type * request)
+{
+	uint8 payload[TRACE_PAGE_RECORDS * TRACE_RECORD_BYTES];
+	uint8 offset = (request->length > 0) ? request->payload[0] : 0;
+
+	CONTROL_reply(request, GET_TRACE, payload, TRACE_encode(offset, payload));
+}
+#endif
+
+/*
+ * Answer GET_AUDIT: the payload is the sequence number of the first entry
+ * wanted, little-endian 16-bit. Up to AUDIT_EXPORT_ENTRIES entries, as stored
+ * with their CRC, go out back to back in AUDIT_DATA frames, then the GET_AUDIT
+ * reply gives the sequence number of the first entry sent, the number of
+ * entries sent and the sequence number the next entry will get. Only that
+ * reply is kept for a retransmitted request, the panel asks again from the
+ * first entry it is missing.
+ * The entries are read here, the export task sends the frames.
+ */
+void CONTROL_exportAudit(const FRAME_Type * request)
+{
+	/* One export at a time for all panels */
+	if (export_active == TRUE)
+	{
+		CONTROL_reply(request, REQUEST_REJECTED, NULL_PTR, 0);
+		return;
+	}
+
+	export_first_sequence = (uint16)(request->payload[0] | (request->payload[1] << 8));
+	export_next_sequence = AUDIT_getNextSequence();
+	export_count = AUDIT_EXPORT_ENTRIES;
+
+	if (AUDIT_read(&export_first_sequence, export_entries, &export_count) == ERROR)
+	{
+		CONTROL_reply(request, REQUEST_REJECTED, NULL_PTR, 0);
+		return;
+	}
+
+	export_request = *request;
+	export_sent = 0;
+	export_active = TRUE;
+	SCHED_post(export_task, EXPORT_NEXT_FRAME);
+}
+
+/*
+ * Send the next AUDIT_DATA frame of the export, then the GET_AUDIT reply.
+ * A frame only goes out while the transmit FIFO keeps room for another whole
+ * frame, so the replies of other requests never wait behind the export.
+ */
+void CONTROL_exportTask(SCHED_EventType events)
+{
+	uint8 summary[5];
+	uint8 length;
+
+	(void)events;
+
+	if (export_active == FALSE)
+	{
+		return;
+	}
+
+	if (UART_getTxSpace() < 2 * FRAME_LINE_BYTES)
+	{
+		/* Try again after the other ready tasks */
+		SCHED_post(export_task, EXPORT_NEXT_FRAME);
+		return;
+	}
+
+	if (export_sent < export_count)
+	{
+		length = ((export_count - export_sent) < AUDIT_ENTRIES_PER_FRAME) ?
+				(export_count - export_sent) : AUDIT_ENTRIES_PER_FRAME;
+		FRAME_send(export_request.address, export_request.sequence, AUDIT_DATA,
+				&export_entries[export_sent * AUDIT_ENTRY_SIZE], length * AUDIT_ENTRY_SIZE);
+		export_sent += length;
+		SCHED_post(export_task, EXPORT_NEXT_FRAME);
+		return;
+	}
+
+	summary[0] = (uint8)export_first_sequence;
+	summary[1] = (uint8)(export_first_sequence >> 8);
+	summary[2] = export_count;
+	summary[3] = (uint8)export_next_sequence;
+	summary[4] = (uint8)(export_next_sequence >> 8);
+	CONTROL_reply(&export_request, GET_AUDIT, summary, 5);
+	export_active = FALSE;
+}
+
+/*
+ * Stop the door where it is and end the door cycle with REQUEST_REJECTED
+ * instead of LOCK_DOOR, when no software timer was left to run it on.
+ */
+void CONTROL_abortDoor(void)
+{
+	FRAME_Type unlock_request;
+
+	Timer_stop(door_pir_timer);
+	door_pir_timer = TIMER_NO_HANDLE;
+	DcMotor_Rotate(STOP, 0);
+	unlock_request.address = door_address;
+	unlock_request.sequence = door_sequence;
+	CONTROL_reply(&unlock_request, REQUEST_REJECTED, NULL_PTR, 0);
+	door_state = DOOR_IDLE;
+}
+
+/*
+ * Move the door cycle along on its timer and PIR events.
+ * UNLOCK_DOOR is answered with LOCK_DOOR once nobody is left in the doorway.
+ */
+void CONTROL_doorTask(SCHED_EventType events)
+{
+	FRAME_Type unlock_request;
+
+	switch (door_state)
 	{
-		/* Wait for command from HMI ECU */
-		received_key = UART_recieveByte();
+	case DOOR_IDLE:
+		break;
 
-		if (received_key != 0xFF)
+	case DOOR_UNLOCKING:
+		if (events & DOOR_TIMER)
 		{
-			if (received_key == GET_STATUS)
+			/* Stop motor after door is unlocked, then sample the PIR right away and every PIR_POLL_MS */
+			DcMotor_Rotate(STOP, 0);
+			door_pir_timer = Timer_startPeriodic(PIR_POLL_MS, CONTROL_pirSample);
+			if (door_pir_timer == TIMER_NO_HANDLE)
 			{
-				/* Respond with system status */
-				EEPROM_readByte((uint16)(ptr_to_pass + 5), &status);
-				_delay_ms(10);
-				UART_sendByte(status);
-
-				/* If password is already saved, update the buffer */
-				if (status == PASSWORD_SAVED)
-				{
-					CONTROL_updatePassword(current_password);
-				}
+				CONTROL_abortDoor();
+				break;
 			}
-			else if (received_key == SET_NEW_PASS)
+			door_state = DOOR_OPEN;
+			SCHED_post(door_task, DOOR_PIR_SAMPLE);
+		}
+		break;
+
+	case DOOR_OPEN:
+		/* Wait until no motion detected, then tell the panel the door locks */
+		if ((events & DOOR_PIR_SAMPLE) && (PIR_getState() != MOTION))
+		{
+			Timer_stop(door_pir_timer);
+			door_pir_timer = TIMER_NO_HANDLE;
+			if (Timer_startOneShot(DOOR_MOTOR_TIME_MS, CONTROL_doorTimer) == TIMER_NO_HANDLE)
 			{
-				/* Receive new password and confirmation */
-				CONTROL_receivePassword(new_password);
-				while (UART_recieveByte() != CONFIRM_PASS);
-				CONTROL_receivePassword(confirm_password);
-
-				/* Compare passwords and update if matched */
-				if (CONTROL_comparePasswords(new_password, confirm_password) == TRUE)
-				{
-					UART_sendByte(PASS_MATCH);
-					CONTROL_savePassword(new_password);
-					_delay_ms(30);
-					CONTROL_updatePassword(current_password);
-				}
-				else
-				{
-					UART_sendByte(PASS_NO_MATCH);
-				}
+				CONTROL_abortDoor();
+				break;
 			}
-			else if (received_key == CHECK_PASS)
+			unlock_request.address = door_address;
+			unlock_request.sequence = door_sequence;
+			CONTROL_reply(&unlock_request, LOCK_DOOR, NULL_PTR, 0);
+			DcMotor_Rotate(ANTICLOCKWISE, 100);
+			door_state = DOOR_LOCKING;
+		}
+		break;
+
+	case DOOR_LOCKING:
+		if (events & DOOR_TIMER)
+		{
+			DcMotor_Rotate(STOP, 0);
+			door_state = DOOR_IDLE;
+		}
+		break;
+	}
+}
+
+/*
+ * End the lockout of every panel whose time is over, the buzzer sounds while any panel is locked out.
+ * Every lockout starts a one-shot that posts LOCKOUT_TIMER when its time is over,
+ * CHECK_PASS of a locked out panel runs it as well.
+ */
+void CONTROL_lockoutTask(SCHED_EventType events)
+{
+	uint8 i;
+	uint8 any_active = FALSE;
+
+	(void)events;
+
+	for (i = 0; i < CONTROL_PANELS; i++)
+	{
+		if ((sessions[i].lockout_active == TRUE) &&
+				((Timer_now() - sessions[i].lockout_start_time) >= LOCKOUT_TIME_MS))
+		{
+			sessions[i].lockout_active = FALSE;
+		}
+		any_active |= sessions[i].lockout_active;
+	}
+
+	if (any_active == FALSE)
+	{
+		Buzzer_off();
+	}
+}
+
+/*
+ * Return TRUE if the request carries the payload its command reads. A shorter
+ * frame would leave the bytes of an earlier request in the payload.
+ */
+uint8 CONTROL_checkLength(const FRAME_Type * request)
+{
+	switch (request->command)
+	{
+	case SET_NEW_PASS:
+	case CONFIRM_PASS:
+	case CHECK_PASS:
+		return (request->length == PASSWORD_PACKED_BYTES);
+	case GET_AUDIT:
+		return (request->length >= 2);
+	case BAUD_CHANGE:
+		return (request->length == 4);
+	default:
+		return TRUE;
+	}
+}
+
+/*
+ * Execute one request from a panel and reply to it, long jobs are only started here.
+ */
+void CONTROL_handleRequest(const FRAME_Type * request)
+{
+	CONTROL_SessionType * session = CONTROL_getSession(request->address);
+	uint8 confirm_password[PASSWORD_DIGITS + 1];
+	uint8 status[STATUS_BYTES];
+	uint8 was_authorized = session->authorized;
+	uint8 was_exporting = session->exporting;
+
+	/* An authorization from CHECK_PASS only covers the request right after it */
+	session->authorized = FALSE;
+	session->exporting = FALSE;
+
+	/* Nothing of the payload is read before its length was checked */
+	if (CONTROL_checkLength(request) == FALSE)
+	{
+		if (request->command == BAUD_CHANGE)
+		{
+			FRAME_send(request->address, request->sequence, BAUD_REJECTED, NULL_PTR, 0);
+		}
+		else
+		{
+			CONTROL_reply(request, REQUEST_REJECTED, NULL_PTR, 0);
+		}
+		return;
+	}
+
+	if (request->command == BAUD_CHANGE)
+	{
+		CONTROL_changeBaudRate(request);
+	}
+	else if (request->command == GET_STATUS)
+	{
+		/* A panel starts every session with a status query */
+		CONTROL_clearReplyCache(session);
+
+		if (storage_ready == FALSE)
+		{
+			CONTROL_openStorage();
+		}
+
+		/* Respond with system status and the door cycle state */
+		CONTROL_getStatus(status);
+		CONTROL_reply(request, GET_STATUS, status, STATUS_BYTES);
+	}
+	else if (request->command == GET_DIAG)
+	{
+		session->authorized = was_authorized;
+		session->exporting = was_exporting;
+		CONTROL_sendDiagnostics(request);
+	}
+#if (DIAG_COMMANDS != 0)
+	else if (request->command == GET_PROFILE)
+	{
+		session->authorized = was_authorized;
+		session->exporting = was_exporting;
+		CONTROL_sendProfile(request);
+	}
+	else if (request->command == GET_TRACE)
+	{
+		session->authorized = was_authorized;
+		session->exporting = was_exporting;
+		CONTROL_sendTrace(request);
+	}
+#else
+	else if ((request->command == GET_PROFILE) || (request->command == GET_TRACE))
+	{
+		CONTROL_reply(request, REQUEST_REJECTED, NULL_PTR, 0);
+	}
+#endif
+	else if (request->command == SET_NEW_PASS)
+	{
+		/* Once there is a password, only a panel that just matched it may replace it */
+		if ((password_saved == TRUE) && (was_authorized == FALSE))
+		{
+			session->new_password_pending = FALSE;
+			CONTROL_reply(request, REQUEST_REJECTED, NULL_PTR, 0);
+			return;
+		}
+
+		/* Keep the new password until its confirmation frame arrives, the authorization goes with it */
+		CONTROL_unpackPassword(request->payload, session->new_password);
+		session->new_password_pending = TRUE;
+		session->authorized = was_authorized;
+		CONTROL_reply(request, RECIEVED, NULL_PTR, 0);
+	}
+	else if (request->command == CONFIRM_PASS)
+	{
+		CONTROL_unpackPassword(request->payload, confirm_password);
+
+		if ((password_saved == TRUE) && (was_authorized == FALSE))
+		{
+			session->new_password_pending = FALSE;
+			CONTROL_reply(request, REQUEST_REJECTED, NULL_PTR, 0);
+			return;
+		}
+
+		/* Compare passwords and update if matched */
+		if ((session->new_password_pending == TRUE) &&
+				(CONTROL_comparePasswords(session->new_password, confirm_password) == TRUE))
+		{
+			if (CONTROL_storageFault() == TRUE)
 			{
-				/* Validate entered password against saved one */
-				CONTROL_receivePassword(confirm_password);
-
-				if (CONTROL_comparePasswords(confirm_password, current_password) == TRUE)
-				{
-					UART_sendByte(PASS_MATCH);
-				}
-				else
-				{
-					UART_sendByte(PASS_NO_MATCH);
-				}
+				/* The EEPROM is not taking writes, keep the old password */
+				CONTROL_reply(request, REQUEST_REJECTED, NULL_PTR, 0);
 			}
-			else if (received_key == ATTEMPTS_ENDED)
+			else
 			{
-				/* Trigger buzzer and wait 60 seconds after 3 failed attempts */
-				Buzzer_on();
-				CONTROL_delaySeconds(60);
-				Buzzer_off();
+				CONTROL_reply(request, PASS_MATCH, NULL_PTR, 0);
+				CONTROL_savePassword(session->new_password);
+				CONTROL_updatePassword(current_password);
+				password_saved = TRUE;
+				AUDIT_log(AUDIT_PASSWORD_CHANGE, request->address);
 			}
-			else if (received_key == UNLOCK_DOOR)
+		}
+		else
+		{
+			CONTROL_reply(request, PASS_NO_MATCH, NULL_PTR, 0);
+		}
+		session->new_password_pending = FALSE;
+	}
+	else if (request->command == CHECK_PASS)
+	{
+		/* Validate entered password against saved one, each panel has its own attempts */
+		CONTROL_unpackPassword(request->payload, confirm_password);
+
+		/* A lockout that had no software timer for its end is ended here */
+		if (session->lockout_active == TRUE)
+		{
+			CONTROL_lockoutTask(LOCKOUT_TIMER);
+		}
+
+		if (session->lockout_active == TRUE)
+		{
+			CONTROL_reply(request, ATTEMPTS_ENDED, NULL_PTR, 0);
+		}
+		else if ((storage_ready == FALSE) || (password_saved == FALSE))
+		{
+			/* Nothing to compare with, and not the panel's fault, so no attempt is counted */
+			CONTROL_reply(request, REQUEST_REJECTED, NULL_PTR, 0);
+		}
+		else if (CONTROL_comparePasswords(confirm_password, current_password) == TRUE)
+		{
+			session->attempts = 0;
+			session->authorized = TRUE;
+			CONTROL_reply(request, PASS_MATCH, NULL_PTR, 0);
+		}
+		else if (++session->attempts == MAX_ATTEMPTS)
+		{
+			/* Sound the buzzer for 60 seconds and lock this panel out */
+			AUDIT_log(AUDIT_FAILED_ATTEMPT, request->address);
+			AUDIT_log(AUDIT_LOCKOUT, request->address);
+			session->attempts = 0;
+			session->lockout_active = TRUE;
+			session->lockout_start_time = Timer_now();
+			if (Timer_startOneShot(LOCKOUT_TIME_MS, CONTROL_lockoutTimer) == TIMER_NO_HANDLE)
 			{
-				/* Rotate motor clockwise to unlock door */
-				DcMotor_Rotate(CLOCKWISE, 100);
-				CONTROL_delaySeconds(15);
+				/* The panel stays locked out, but a buzzer nothing would stop is not started */
+				CONTROL_reply(request, REQUEST_REJECTED, NULL_PTR, 0);
+				return;
+			}
+			Buzzer_on();
+			CONTROL_reply(request, ATTEMPTS_ENDED, NULL_PTR, 0);
+		}
+		else
+		{
+			AUDIT_log(AUDIT_FAILED_ATTEMPT, request->address);
+			CONTROL_reply(request, PASS_NO_MATCH, NULL_PTR, 0);
+		}
+	}
+	else if (request->command == GET_AUDIT)
+	{
+		/* The log is read out after a matching CHECK_PASS, then page after page */
+		if ((was_authorized == FALSE) && (was_exporting == FALSE))
+		{
+			CONTROL_reply(request, REQUEST_REJECTED, NULL_PTR, 0);
+			return;
+		}
+		session->exporting = TRUE;
+		CONTROL_exportAudit(request);
+	}
+	else if (request->command == UNLOCK_DOOR)
+	{
+		/* Only right after a matching CHECK_PASS, and one door cycle at a time for all panels */
+		if ((was_authorized == FALSE) || (door_state != DOOR_IDLE))
+		{
+			CONTROL_reply(request, REQUEST_REJECTED, NULL_PTR, 0);
+			return;
+		}
 
-				/* Stop motor after door is unlocked */
-				DcMotor_Rotate(STOP, 0);
+		/* The motor only starts with a software timer to stop it */
+		if (Timer_startOneShot(DOOR_MOTOR_TIME_MS, CONTROL_doorTimer) == TIMER_NO_HANDLE)
+		{
+			CONTROL_reply(request, REQUEST_REJECTED, NULL_PTR, 0);
+			return;
+		}
 
-				/* Wait until no motion detected */
-				while (PIR_getState() == MOTION);
+		/* Accept now, LOCK_DOOR is the final reply once the cycle gets there */
+		FRAME_send(request->address, request->sequence, REQUEST_PENDING, NULL_PTR, 0);
 
-				/* Notify HMI to lock door */
-				UART_sendByte(LOCK_DOOR);
+		/* Rotate motor clockwise to unlock door */
+		DcMotor_Rotate(CLOCKWISE, 100);
+		door_address = request->address;
+		door_sequence = request->sequence;
+		door_state = DOOR_UNLOCKING;
+		AUDIT_log(AUDIT_UNLOCK, request->address);
+	}
+}
 
-				/* Rotate motor anti-clockwise to lock door */
-				DcMotor_Rotate(ANTICLOCKWISE, 100);
-				CONTROL_delaySeconds(15);
+/*
+ * Handle one received frame, the rest of the buffered bytes wait for the next
+ * run so the other tasks get their turn in between.
+ */
+void CONTROL_linkTask(SCHED_EventType events)
+{
+	FRAME_Type request;
+	FRAME_StatusType frame_status;
 
-				/* Stop motor */
-				DcMotor_Rotate(STOP, 0);
-			}
+	/* A trial baud rate without its confirmation goes, one-shots of earlier trials are ignored */
+	if ((events & LINK_BAUD_TIMEOUT) && (baud_pending == TRUE) &&
+			((Timer_now() - baud_start_time) >= BAUD_CONFIRM_TIMEOUT_MS))
+	{
+		CONTROL_checkBaudConfirm(NULL_PTR);
+	}
+
+	frame_status = FRAME_poll(&request);
+
+	if ((baud_pending == TRUE) && (frame_status != FRAME_NONE))
+	{
+		CONTROL_checkBaudConfirm((frame_status == FRAME_READY) ? &request : NULL_PTR);
+	}
+	else if (frame_status == FRAME_CORRUPTED)
+	{
+		/* Framing errors mean the panel is no longer on our baud rate, go back to the start rate */
+		if (UART_getFramingErrors() != framing_errors)
+		{
+			framing_errors = UART_getFramingErrors();
+			UART_setBaudRate(UART_CONFIG.baud_rate);
+		}
+		FRAME_sendNack();
+	}
+	else if ((frame_status == FRAME_READY) && (request.command != FRAME_NACK) &&
+			(CONTROL_getSession(request.address) != NULL_PTR) &&
+			(CONTROL_answerDuplicate(&request) == FALSE))
+	{
+		PROF_begin(PROF_REQUEST);
+		CONTROL_handleRequest(&request);
+		PROF_end(PROF_REQUEST);
+		if ((request.command == BAUD_CHANGE) && (baud_pending == FALSE))
+		{
+			framing_errors = UART_getFramingErrors();
+		}
+	}
+
+	if (UART_available() > 0)
+	{
+		SCHED_post(link_task, LINK_RECEIVED);
+	}
+}
+
+/*
+ * Hand the record store appends and the audit log entries to the EEPROM cache,
+ * write back its oldest dirty line, and look
+ * for the audit log again while a transient EEPROM error at boot kept it from us.
+ */
+void CONTROL_storageTask(SCHED_EventType events)
+{
+	(void)events;
+
+	if ((audit_ready == FALSE) && ((Timer_now() - audit_retry_time) >= AUDIT_RETRY_MS))
+	{
+		audit_ready = (AUDIT_init() == SUCCESS);
+		audit_retry_time = Timer_now();
+	}
 
-			/* Reset received key */
-			received_key = 0xFF;
+	RECORD_service();
+	AUDIT_service();
+	CACHE_service();
+}
+
+/* ---------------------- MAIN FUNCTION ---------------------- */
+
+int main(void)
+{
+	uint8 status[STATUS_BYTES];
+
+	/*
+	 * Initialize system peripherals, the door outputs first so they are in a
+	 * safe state right away and the link is up before the EEPROM is read.
+	 * The panels show their splash screen meanwhile.
+	 */
+	Enable_Global_Interrupt();
+	Timer_startSystemTick();
+	POWER_init();
+	PROF_init();
+	Buzzer_init();
+	DcMotor_Init();
+	PIR_init();
+	UART_init(&UART_CONFIG);
+	FRAME_init(CONTROL_ADDRESS);
+	TWI_init(&TWI_CONFIG);
+	CONTROL_openStorage();
+	AUDIT_log(AUDIT_BOOT, 0);
+
+	/* Notify the panels we're ready, with the GET_STATUS answer once the store was read so they can skip asking */
+	if (storage_ready == TRUE)
+	{
+		CONTROL_getStatus(status);
+		FRAME_send(UART_BROADCAST_ADDRESS, FRAME_NO_SEQUENCE, MC2_READY, status, STATUS_BYTES);
+	}
+	else
+	{
+		FRAME_send(UART_BROADCAST_ADDRESS, FRAME_NO_SEQUENCE, MC2_READY, NULL_PTR, 0);
+	}
+
+	/*
+	 * Every job runs as a task on its events: received bytes, the door and
+	 * lockout timers, the PIR sampling and the storage period, and ready
+	 * tasks take turns, so a request waits for at most one run of each.
+	 */
+	link_task = SCHED_addTask(CONTROL_linkTask);
+	door_task = SCHED_addTask(CONTROL_doorTask);
+	lockout_task = SCHED_addTask(CONTROL_lockoutTask);
+	storage_task = SCHED_addTask(CONTROL_storageTask);
+	export_task = SCHED_addTask(CONTROL_exportTask);
+	UART_setReceiveCallBack(CONTROL_byteReceived);
+	Timer_startPeriodic(STORAGE_SERVICE_MS, CONTROL_storageTick);
+
+	/* Bytes that came in before the callback was set */
+	SCHED_post(link_task, LINK_RECEIVED);
+
+	/* Sleep in IDLE whenever no task is ready, the next interrupt posts the next event */
+	while (1)
+	{
+		if (SCHED_dispatch() == FALSE)
+		{
+			POWER_idle();
 		}
 	}
 }
@@ -5,37 +5,64 @@
 # Add inputs and outputs from these tool invocations to the build variables 
 C_SRCS += \
 ../CONTROL_ECU.c \
+../audit_log.c \
 ../buzzer.c \
+../crc8.c \
 ../dcmotor.c \
+../eeprom_cache.c \
 ../external_eeprom.c \
+../frame.c \
 ../gpio.c \
 ../pir_sensor.c \
+../power.c \
+../profile.c \
 ../pwm.c \
+../record_store.c \
+../scheduler.c \
 ../timer.c \
+../trace.c \
 ../twi.c \
 ../uart.c 
 
 OBJS += \
 ./CONTROL_ECU.o \
+./audit_log.o \
 ./buzzer.o \
+./crc8.o \
 ./dcmotor.o \
+./eeprom_cache.o \
 ./external_eeprom.o \
+./frame.o \
 ./gpio.o \
 ./pir_sensor.o \
+./power.o \
+./profile.o \
 ./pwm.o \
+./record_store.o \
+./scheduler.o \
 ./timer.o \
+./trace.o \
 ./twi.o \
 ./uart.o 
 
 C_DEPS += \
 ./CONTROL_ECU.d \
+./audit_log.d \
 ./buzzer.d \
+./crc8.d \
 ./dcmotor.d \
+./eeprom_cache.d \
 ./external_eeprom.d \
+./frame.d \
 ./gpio.d \
 ./pir_sensor.d \
+./power.d \
+./profile.d \
 ./pwm.d \
+./record_store.d \
+./scheduler.d \
 ./timer.d \
+./trace.d \
 ./twi.d \
 ./uart.d 
 
@@ -0,0 +1,315 @@
+ /******************************************************************************
+ *
+ * Module: Audit Log
+ *
+ * File Name: audit_log.c
+ *
+ * Description: Source file for the append only access audit log on the
+ *              external EEPROM
+ *
+ * Author: Malik Anas
+ *
+ *******************************************************************************/
+
+#include "audit_log.h"
+#include "eeprom_cache.h"
+#include "crc8.h"
+#include "timer.h"
+
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+/* Byte offsets inside an entry */
+#define AUDIT_SEQUENCE_OFFSET    0
+#define AUDIT_EVENT_OFFSET       2
+#define AUDIT_DETAIL_OFFSET      3
+#define AUDIT_TIME_OFFSET        4
+#define AUDIT_CRC_OFFSET         (AUDIT_ENTRY_SIZE - 1)
+
+/* Event byte of an entry that was never written */
+#define AUDIT_ERASED             0xFF
+
+#if ((EEPROM_PAGE_SIZE % AUDIT_ENTRY_SIZE) != 0)
+#error "An audit entry must not span two EEPROM pages"
+#endif
+
+#if ((AUDIT_BASE_ADDRESS % EEPROM_PAGE_SIZE) != 0)
+#error "The audit log must start on an EEPROM page"
+#endif
+
+/*******************************************************************************
+ *                               Types Declaration                             *
+ *******************************************************************************/
+
+/* An event waiting in RAM, its sequence number is given when it is written */
+typedef struct {
+	uint8 event;
+	uint8 detail;
+	uint32 time;    /* Timer_now() when it was logged */
+}AUDIT_StagedType;
+
+/*******************************************************************************
+ *                           Global Variables                                  *
+ *******************************************************************************/
+
+/* Set once the newest entry was found, nothing is written before */
+static boolean g_ready = FALSE;
+
+/* Where the next entry goes and its sequence number */
+static uint8 g_nextEntry = 0;
+static uint16 g_nextSequence = 0;
+
+/* Entries in the ring, the last g_stored before g_nextEntry */
+static uint8 g_stored = 0;
+
+/* Staged events, oldest at g_stageHead */
+static AUDIT_StagedType g_stage[AUDIT_STAGE_ENTRIES];
+static uint8 g_stageHead = 0;
+static uint8 g_stageCount = 0;
+
+/* Events lost while the stage was full, not logged yet */
+static uint8 g_dropped = 0;
+
+/* Entries of the oldest staged events, built for the cache */
+static uint8 g_page[EEPROM_PAGE_SIZE];
+
+/*******************************************************************************
+ *                      Functions Definitions                                  *
+ *******************************************************************************/
+
+static uint16 AUDIT_entryAddress(uint8 entry)
+{
+	return (uint16)(AUDIT_BASE_ADDRESS + (uint16)entry * AUDIT_ENTRY_SIZE);
+}
+
+/*
+ * Description :
+ * Read the sequence number and event of an entry, the three bytes the binary search needs.
+ */
+static uint8 AUDIT_readHeader(uint8 entry, uint16 *sequence, uint8 *event)
+{
+	uint8 header[3];
+
+	if(EEPROM_readBlock(AUDIT_entryAddress(entry), header, 3) == ERROR)
+	{
+		return ERROR;
+	}
+	*sequence = (uint16)(header[AUDIT_SEQUENCE_OFFSET] | (header[AUDIT_SEQUENCE_OFFSET + 1] << 8));
+	*event = header[AUDIT_EVENT_OFFSET];
+	return SUCCESS;
+}
+
+uint8 AUDIT_init(void)
+{
+	uint8 entry[AUDIT_ENTRY_SIZE];
+	uint8 event;
+	uint8 low;
+	uint8 high;
+	uint8 mid;
+	uint16 first_sequence;
+	uint16 sequence;
+
+	if(g_ready == TRUE)
+	{
+		return SUCCESS;
+	}
+
+	/* Entries are written from entry 0 on, an empty entry 0 is an empty log */
+	if(AUDIT_readHeader(0, &first_sequence, &event) == ERROR)
+	{
+		return ERROR;
+	}
+	if(event == AUDIT_ERASED)
+	{
+		g_nextEntry = 0;
+		g_nextSequence = 0;
+		g_stored = 0;
+		g_ready = TRUE;
+		return SUCCESS;
+	}
+
+	/*
+	 * Entry i holds sequence first + i up to the newest one, the entries after
+	 * it are empty or hold the previous lap around the ring.
+	 */
+	low = 0;
+	high = AUDIT_ENTRIES;
+	while((high - low) > 1)
+	{
+		mid = (uint8)((low + high) / 2);
+		if(AUDIT_readHeader(mid, &sequence, &event) == ERROR)
+		{
+			return ERROR;
+		}
+		if((event != AUDIT_ERASED) && ((uint16)(sequence - first_sequence) == mid))
+		{
+			low = mid;
+		}
+		else
+		{
+			high = mid;
+		}
+	}
+
+	/* A reset in the middle of a page write leaves a torn newest entry, write over it */
+	if(EEPROM_readBlock(AUDIT_entryAddress(low), entry, AUDIT_ENTRY_SIZE) == ERROR)
+	{
+		return ERROR;
+	}
+	if(CRC8_compute(entry, AUDIT_CRC_OFFSET) == entry[AUDIT_CRC_OFFSET])
+	{
+		low++;
+	}
+	g_nextEntry = (uint8)(low % AUDIT_ENTRIES);
+	g_nextSequence = (uint16)(first_sequence + low);
+
+	/* The last entry of the ring is only written once the log went around */
+	if(AUDIT_readHeader(AUDIT_ENTRIES - 1, &sequence, &event) == ERROR)
+	{
+		return ERROR;
+	}
+	g_stored = (event == AUDIT_ERASED) ? g_nextEntry : AUDIT_ENTRIES;
+	g_ready = TRUE;
+	return SUCCESS;
+}
+
+/*
+ * Description :
+ * Put an event at the end of the stage, the caller checked there is room.
+ */
+static void AUDIT_stage(uint8 event, uint8 detail)
+{
+	AUDIT_StagedType *staged = &g_stage[(g_stageHead + g_stageCount) % AUDIT_STAGE_ENTRIES];
+
+	staged->event = event;
+	staged->detail = detail;
+	staged->time = Timer_now();
+	g_stageCount++;
+}
+
+void AUDIT_log(uint8 event, uint8 detail)
+{
+	/* Account for the lost events first, so the log shows where they were lost */
+	if((g_dropped != 0) && (g_stageCount < AUDIT_STAGE_ENTRIES))
+	{
+		AUDIT_stage(AUDIT_DROPPED, g_dropped);
+		g_dropped = 0;
+	}
+
+	if(g_stageCount < AUDIT_STAGE_ENTRIES)
+	{
+		AUDIT_stage(event, detail);
+	}
+	else if(g_dropped < 0xFF)
+	{
+		g_dropped++;
+	}
+}
+
+/*
+ * Description :
+ * Encode the oldest staged events that fit in the rest of the current page
+ * and hand them to the cache. While the cache has no free line they stay staged.
+ */
+static void AUDIT_write(void)
+{
+	AUDIT_StagedType *staged;
+	uint8 *entry;
+	uint8 room = (uint8)(AUDIT_ENTRIES_PER_PAGE - (g_nextEntry % AUDIT_ENTRIES_PER_PAGE));
+	uint8 count = (g_stageCount < room) ? g_stageCount : room;
+	uint16 sequence;
+	uint32 seconds;
+	uint8 i;
+
+	for(i = 0; i < count; i++)
+	{
+		staged = &g_stage[(g_stageHead + i) % AUDIT_STAGE_ENTRIES];
+		entry = &g_page[i * AUDIT_ENTRY_SIZE];
+		sequence = (uint16)(g_nextSequence + i);
+		seconds = staged->time / 1000;
+
+		entry[AUDIT_SEQUENCE_OFFSET] = (uint8)sequence;
+		entry[AUDIT_SEQUENCE_OFFSET + 1] = (uint8)(sequence >> 8);
+		entry[AUDIT_EVENT_OFFSET] = staged->event;
+		entry[AUDIT_DETAIL_OFFSET] = staged->detail;
+		entry[AUDIT_TIME_OFFSET] = (uint8)seconds;
+		entry[AUDIT_TIME_OFFSET + 1] = (uint8)(seconds >> 8);
+		entry[AUDIT_TIME_OFFSET + 2] = (uint8)(seconds >> 16);
+		entry[AUDIT_CRC_OFFSET] = CRC8_compute(entry, AUDIT_CRC_OFFSET);
+	}
+
+	if(CACHE_writeBlock(AUDIT_entryAddress(g_nextEntry), g_page, (uint8)(count * AUDIT_ENTRY_SIZE)) == ERROR)
+	{
+		return;
+	}
+	g_stageHead = (uint8)((g_stageHead + count) % AUDIT_STAGE_ENTRIES);
+	g_stageCount -= count;
+	g_nextEntry = (uint8)((g_nextEntry + count) % AUDIT_ENTRIES);
+	g_nextSequence += count;
+	g_stored = (g_stored > (AUDIT_ENTRIES - count)) ? AUDIT_ENTRIES : (uint8)(g_stored + count);
+}
+
+void AUDIT_service(void)
+{
+	uint8 room;
+
+	if((g_ready == FALSE) || (g_stageCount == 0))
+	{
+		return;
+	}
+
+	/* Write whole pages, a page that is not full waits for more events up to AUDIT_FLUSH_DELAY_MS */
+	room = (uint8)(AUDIT_ENTRIES_PER_PAGE - (g_nextEntry % AUDIT_ENTRIES_PER_PAGE));
+	if((g_stageCount >= room) || ((Timer_now() - g_stage[g_stageHead].time) >= AUDIT_FLUSH_DELAY_MS))
+	{
+		AUDIT_write();
+	}
+}
+
+uint8 AUDIT_read(uint16 *sequence, uint8 *data, uint8 *count)
+{
+	uint16 behind = (uint16)(g_nextSequence - *sequence);
+	uint8 entry;
+	uint8 first_part;
+
+	if(g_ready == FALSE)
+	{
+		return ERROR;
+	}
+
+	/* Entries from *sequence on, all of them if it was overwritten or never written */
+	if(behind > g_stored)
+	{
+		behind = g_stored;
+		*sequence = (uint16)(g_nextSequence - g_stored);
+	}
+	if(*count > behind)
+	{
+		*count = (uint8)behind;
+	}
+	if(*count == 0)
+	{
+		return SUCCESS;
+	}
+
+	/* A read that runs past the end of the ring goes on at its start */
+	entry = (uint8)((g_nextEntry + AUDIT_ENTRIES - behind) % AUDIT_ENTRIES);
+	first_part = (*count < (AUDIT_ENTRIES - entry)) ? *count : (uint8)(AUDIT_ENTRIES - entry);
+	if(CACHE_readBlock(AUDIT_entryAddress(entry), data, (uint16)(first_part * AUDIT_ENTRY_SIZE)) == ERROR)
+	{
+		return ERROR;
+	}
+	if((first_part < *count) &&
+			(CACHE_readBlock(AUDIT_entryAddress(0), &data[first_part * AUDIT_ENTRY_SIZE],
+					(uint16)((*count - first_part) * AUDIT_ENTRY_SIZE)) == ERROR))
+	{
+		return ERROR;
+	}
+	return SUCCESS;
+}
+
+uint16 AUDIT_getNextSequence(void)
+{
+	return g_nextSequence;
+}
@@ -0,0 +1,93 @@
+ /******************************************************************************
+ *
+ * Module: Audit Log
+ *
+ * File Name: audit_log.h
+ *
+ * Description: Header file for the append only access audit log on the
+ *              external EEPROM
+ *
+ * Author: Malik Anas
+ *
+ *******************************************************************************/
+
+#ifndef AUDIT_LOG_H_
+#define AUDIT_LOG_H_
+
+#include "std_types.h"
+#include "external_eeprom.h"
+
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+/*
+ * The log is a ring of fixed size entries in the upper half of the 24C16,
+ * the record store keeps the lower half. Every entry is
+ * SEQUENCE (2 bytes, LSB first) | EVENT | DETAIL | TIME (3 bytes, LSB first) | CRC-8
+ * The sequence number goes up by one per entry and survives resets, the
+ * oldest entries are overwritten once the ring is full.
+ */
+#define AUDIT_BASE_ADDRESS     0x0400
+#define AUDIT_ENTRY_SIZE       8
+#define AUDIT_ENTRIES          128
+#define AUDIT_ENTRIES_PER_PAGE (EEPROM_PAGE_SIZE / AUDIT_ENTRY_SIZE)
+
+/* Entries waiting in RAM until they are handed to the EEPROM cache */
+#define AUDIT_STAGE_ENTRIES    8
+
+/* A page that is not full yet is written once its oldest entry waited this long */
+#define AUDIT_FLUSH_DELAY_MS   1000
+
+/* Events, DETAIL is the panel address unless noted */
+#define AUDIT_BOOT             0x01    /* DETAIL is 0 */
+#define AUDIT_UNLOCK           0x02
+#define AUDIT_FAILED_ATTEMPT   0x03
+#define AUDIT_LOCKOUT          0x04
+#define AUDIT_PASSWORD_CHANGE  0x05
+#define AUDIT_DROPPED          0x06    /* DETAIL is the number of events lost to a full stage */
+
+/*******************************************************************************
+ *                      Functions Prototypes                                   *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Find the newest entry so the log carries on after it, blocks until done.
+ * Does nothing once it succeeded.
+ * Returns SUCCESS, or ERROR if the EEPROM could not be read even with retries,
+ * events are then kept in RAM until a later AUDIT_init succeeds.
+ */
+uint8 AUDIT_init(void);
+
+/*
+ * Description :
+ * Stage an event in RAM, the bus is not used. While the stage is full the
+ * event is lost and counted, an AUDIT_DROPPED entry records how many.
+ */
+void AUDIT_log(uint8 event, uint8 detail);
+
+/*
+ * Description :
+ * Write one page of staged entries, call it from the main loop.
+ * The entries go to the EEPROM cache, CACHE_service writes them back.
+ */
+void AUDIT_service(void);
+
+/*
+ * Description :
+ * Copy up to *count entries as they are stored, CRC included, starting at the
+ * entry with sequence number *sequence, in one or two sequential reads.
+ * A sequence number that is no longer in the ring starts at the oldest entry,
+ * *sequence and *count are set to what was copied. Blocks until done.
+ * Returns ERROR if the log was not found yet or the EEPROM could not be read.
+ */
+uint8 AUDIT_read(uint16 *sequence, uint8 *data, uint8 *count);
+
+/*
+ * Description :
+ * Return the sequence number the next entry written to the EEPROM gets.
+ */
+uint16 AUDIT_getNextSequence(void);
+
+#endif /* AUDIT_LOG_H_ */
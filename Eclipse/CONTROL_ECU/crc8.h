@@ -0,0 +1,42 @@
+ /******************************************************************************
+ *
+ * Module: CRC-8
+ *
+ * File Name: crc8.h
+ *
+ * Description: Header file for the CRC-8 of the frames and the EEPROM records
+ *
+ * Author: Malik Anas
+ *
+ *******************************************************************************/
+
+#ifndef CRC8_H_
+#define CRC8_H_
+
+#include "std_types.h"
+
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+/* CRC-8 polynomial x^8 + x^2 + x + 1, the CRC starts at 0 */
+#define CRC8_POLYNOMIAL    0x07
+#define CRC8_INITIAL       0x00
+
+/*******************************************************************************
+ *                      Functions Prototypes                                   *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Update the CRC-8 with one more byte.
+ */
+uint8 CRC8_update(uint8 crc, uint8 data);
+
+/*
+ * Description :
+ * CRC-8 of a buffer.
+ */
+uint8 CRC8_compute(const uint8 *data, uint8 length);
+
+#endif /* CRC8_H_ */
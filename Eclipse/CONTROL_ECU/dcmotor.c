@@ -9,6 +9,7 @@
 #include "dcmotor.h"
 #include "gpio.h"
 #include "pwm.h"
+#include "trace.h"
 
 /*
  * Function: DcMotor_Init
@@ -44,6 +45,8 @@ void DcMotor_Init(void)
  */
 void DcMotor_Rotate(DcMotor_State state, uint8 speed)
 {
+	TRACE_record(TRACE_MOTOR, (uint8)state);
+
 	/* Start PWM with the specified speed */
 	PWM_Timer0_Start(speed);
 
@@ -0,0 +1,211 @@
+ /******************************************************************************
+ *
+ * Module: EEPROM Cache
+ *
+ * File Name: eeprom_cache.c
+ *
+ * Description: Source file for the RAM write-back cache in front of the external EEPROM
+ *
+ * Author: Malik Anas
+ *
+ *******************************************************************************/
+
+#include "eeprom_cache.h"
+#include "timer.h"
+
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+#if (CACHE_LINE_SIZE > 16)
+#error "The dirty mask of a line has room for 16 bytes"
+#endif
+
+#define CACHE_PAGE_OF(ADDR)    ((uint16)((ADDR) - ((ADDR) % CACHE_LINE_SIZE)))
+
+/*******************************************************************************
+ *                               Types Declaration                             *
+ *******************************************************************************/
+
+typedef struct {
+	uint16 address;              /* first byte of the cached page */
+	uint16 dirty;                /* a bit for every byte not written back yet */
+	uint8 data[CACHE_LINE_SIZE];
+}CACHE_LineType;
+
+/*******************************************************************************
+ *                           Global Variables                                  *
+ *******************************************************************************/
+
+/* Lines in use, oldest at g_head */
+static CACHE_LineType g_lines[CACHE_LINES];
+static uint8 g_head = 0;
+static uint8 g_count = 0;
+
+/* Write back in progress, always of the oldest line */
+static EEPROM_RequestType g_writeBack;
+static boolean g_writeBackPending = FALSE;
+static uint16 g_writeBackMask = 0;
+
+/* A failed write back is tried again CACHE_RETRY_DELAY_MS after it failed */
+static boolean g_writeBackFailed = FALSE;
+static uint32 g_failTime = 0;
+
+/* TWI status of the last write back that failed for good, 0 once one succeeds */
+static uint8 g_error = 0;
+
+/*******************************************************************************
+ *                      Functions Definitions                                  *
+ *******************************************************************************/
+
+uint8 CACHE_readBlock(uint16 u16addr, uint8 *data, uint16 length)
+{
+	CACHE_LineType *line;
+	uint16 address;
+	uint8 i;
+	uint8 n;
+
+	if(EEPROM_readBlock(u16addr, data, length) == ERROR)
+	{
+		return ERROR;
+	}
+
+	/* Oldest line first, so the newest value of a byte is the one left */
+	for(n = 0; n < g_count; n++)
+	{
+		line = &g_lines[(g_head + n) % CACHE_LINES];
+		for(i = 0; i < CACHE_LINE_SIZE; i++)
+		{
+			address = (uint16)(line->address + i);
+			if(((line->dirty & (1u << i)) != 0) && (address >= u16addr) && ((address - u16addr) < length))
+			{
+				data[address - u16addr] = line->data[i];
+			}
+		}
+	}
+	return SUCCESS;
+}
+
+uint8 CACHE_writeBlock(uint16 u16addr, const uint8 *data, uint8 length)
+{
+	CACHE_LineType *line = NULL_PTR;
+	uint16 page = CACHE_PAGE_OF(u16addr);
+	uint8 offset = (uint8)(u16addr - page);
+	uint8 i;
+
+	if((length == 0) || ((offset + length) > CACHE_LINE_SIZE))
+	{
+		return ERROR;
+	}
+
+	/* Merge into the newest line unless its page write is already on the bus */
+	if(g_count > 0)
+	{
+		line = &g_lines[(g_head + g_count - 1) % CACHE_LINES];
+		if((line->address != page) || ((g_count == 1) && (g_writeBackPending == TRUE)))
+		{
+			line = NULL_PTR;
+		}
+	}
+	if(line == NULL_PTR)
+	{
+		if(g_count == CACHE_LINES)
+		{
+			return ERROR;
+		}
+		line = &g_lines[(g_head + g_count) % CACHE_LINES];
+		line->address = page;
+		line->dirty = 0;
+		g_count++;
+	}
+
+	for(i = 0; i < length; i++)
+	{
+		line->data[offset + i] = data[i];
+		line->dirty |= (uint16)(1u << (offset + i));
+	}
+	return SUCCESS;
+}
+
+/*
+ * Description :
+ * Account for the write back that just ended. The oldest line is freed once
+ * all its bytes are on the chip, after a failure it stays the oldest line.
+ */
+static void CACHE_writeBackDone(void)
+{
+	CACHE_LineType *line = &g_lines[g_head];
+
+	g_writeBackPending = FALSE;
+	if(g_writeBack.status == EEPROM_DONE)
+	{
+		g_error = 0;
+		g_writeBackFailed = FALSE;
+		line->dirty &= (uint16)~g_writeBackMask;
+		if(line->dirty == 0)
+		{
+			g_head = (uint8)((g_head + 1) % CACHE_LINES);
+			g_count--;
+		}
+	}
+	else
+	{
+		g_error = g_writeBack.error;
+		g_writeBackFailed = TRUE;
+		g_failTime = Timer_now();
+	}
+}
+
+/*
+ * Description :
+ * Start the page write of the first run of dirty bytes of the oldest line,
+ * the records and entries written through the cache are one run each.
+ */
+static void CACHE_startWriteBack(void)
+{
+	CACHE_LineType *line = &g_lines[g_head];
+	uint8 first = 0;
+	uint8 last;
+
+	while((line->dirty & (1u << first)) == 0)
+	{
+		first++;
+	}
+	last = first;
+	g_writeBackMask = 0;
+	while((last < CACHE_LINE_SIZE) && ((line->dirty & (1u << last)) != 0))
+	{
+		g_writeBackMask |= (uint16)(1u << last);
+		last++;
+	}
+
+	g_writeBackPending = TRUE;
+	EEPROM_submitWrite(&g_writeBack, (uint16)(line->address + first), &line->data[first], (uint16)(last - first));
+}
+
+void CACHE_service(void)
+{
+	if(g_writeBackPending == TRUE)
+	{
+		if(EEPROM_poll(&g_writeBack) == EEPROM_BUSY)
+		{
+			return;
+		}
+		CACHE_writeBackDone();
+	}
+
+	if(g_count == 0)
+	{
+		return;
+	}
+	if((g_writeBackFailed == TRUE) && ((Timer_now() - g_failTime) < CACHE_RETRY_DELAY_MS))
+	{
+		return;
+	}
+	CACHE_startWriteBack();
+}
+
+uint8 CACHE_getError(void)
+{
+	return g_error;
+}
@@ -0,0 +1,70 @@
+ /******************************************************************************
+ *
+ * Module: EEPROM Cache
+ *
+ * File Name: eeprom_cache.h
+ *
+ * Description: Header file for the RAM write-back cache in front of the
+ *              external EEPROM, the record store and the audit log write
+ *              their pages through it
+ *
+ * Author: Malik Anas
+ *
+ *******************************************************************************/
+
+#ifndef EEPROM_CACHE_H_
+#define EEPROM_CACHE_H_
+
+#include "std_types.h"
+#include "external_eeprom.h"
+
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+/*
+ * Every line holds the changed bytes of one EEPROM page, so a dirty line goes
+ * back in one page write. Lines are written back in the order they were
+ * filled, a write to the page of the newest line that is not on its way yet
+ * is merged into it.
+ */
+#define CACHE_LINE_SIZE        EEPROM_PAGE_SIZE
+#define CACHE_LINES            4
+
+/* A line whose write back failed after the EEPROM retries is tried again this long after */
+#define CACHE_RETRY_DELAY_MS   1000
+
+/*******************************************************************************
+ *                      Functions Prototypes                                   *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Read a buffer of any length from the EEPROM, bytes that are still waiting
+ * in a dirty line are taken from RAM. Blocks until done.
+ */
+uint8 CACHE_readBlock(uint16 u16addr, uint8 *data, uint16 length);
+
+/*
+ * Description :
+ * Copy bytes into a line and mark them dirty, the bus is not used.
+ * The bytes must not span two EEPROM pages.
+ * Returns ERROR if they do or every line is taken, the caller tries again later.
+ */
+uint8 CACHE_writeBlock(uint16 u16addr, const uint8 *data, uint8 length);
+
+/*
+ * Description :
+ * Write back the oldest dirty line, call it from the main loop.
+ * The page write runs in the background on the TWI interrupt.
+ */
+void CACHE_service(void);
+
+/*
+ * Description :
+ * Return the TWI status of the last write back that failed after all its
+ * retries, TWI_TIMEOUT for a stuck bus, or 0 if the last one went through.
+ */
+uint8 CACHE_getError(void);
+
+#endif /* EEPROM_CACHE_H_ */
@@ -10,73 +10,171 @@
  *
  *******************************************************************************/
 #include "external_eeprom.h"
-#include "twi.h"
+#include "timer.h"
+#include "power.h"
+#include "profile.h"
+
+static void EEPROM_startTransfer(EEPROM_RequestType *request);
+
+/*
+ * Description :
+ * Called by the TWI ISR when a transfer of the request ended, queues the
+ * next page of a write or completes the request.
+ */
+static void EEPROM_transferDone(TWI_TransactionType *transaction)
+{
+    EEPROM_RequestType *request = (EEPROM_RequestType *)transaction;
+
+    if (transaction->state == TWI_FAILED)
+    {
+        request->error = transaction->error_status;
+        if (request->attempts < EEPROM_RETRIES)
+        {
+            /* Take the transfer back, EEPROM_poll starts it again after the backoff */
+            request->attempts++;
+            request->address -= request->chunk;
+            request->data -= request->chunk;
+            request->remaining += request->chunk;
+            request->retry_time = Timer_now();
+            request->retry_pending = TRUE;
+        }
+        else
+            request->status = EEPROM_FAILED;
+    }
+    else
+    {
+        request->attempts = 0;
+        if (request->remaining > 0)
+            EEPROM_startTransfer(request);
+        else
+            request->status = EEPROM_DONE;
+    }
+}
+
+/*
+ * Description :
+ * Hand the next transfer of the request to the TWI engine: up to
+ * EEPROM_READ_CHUNK bytes for a read, up to the end of the page for a write.
+ */
+static void EEPROM_startTransfer(EEPROM_RequestType *request)
+{
+    TWI_TransactionType *transaction = &request->transaction;
+    uint16 chunk = request->remaining;
+
+    /* Never cross a page boundary, the address would wrap to the start of the page */
+    if ((transaction->read == FALSE) &&
+            (chunk > (EEPROM_PAGE_SIZE - (request->address & (EEPROM_PAGE_SIZE - 1)))))
+        chunk = EEPROM_PAGE_SIZE - (request->address & (EEPROM_PAGE_SIZE - 1));
+    else if ((transaction->read == TRUE) && (chunk > EEPROM_READ_CHUNK))
+        chunk = EEPROM_READ_CHUNK;
+
+    /* The device address carries the A8 A9 A10 bits of the memory location address */
+    transaction->slave_address = (uint8)(0xA0 | ((request->address & 0x0700)>>7));
+    transaction->header[0] = (uint8)(request->address);
+    transaction->header_length = 1;
+    transaction->data = request->data;
+    transaction->length = chunk;
+
+    /* While the EEPROM finishes a write cycle it NACKs its address, the engine keeps asking */
+    transaction->poll_limit = EEPROM_ACK_POLL_LIMIT;
+    transaction->callback = EEPROM_transferDone;
+
+    request->chunk = chunk;
+    request->address += chunk;
+    request->data += chunk;
+    request->remaining -= chunk;
+
+    if (TWI_submit(transaction) == FALSE)
+        request->status = EEPROM_FAILED;
+}
+
+void EEPROM_submitWrite(EEPROM_RequestType *request, uint16 u16addr, const uint8 *data, uint16 length)
+{
+    request->status = EEPROM_BUSY;
+    request->address = u16addr;
+    request->data = (uint8 *)data;
+    request->remaining = length;
+    request->transaction.read = FALSE;
+    request->attempts = 0;
+    request->retry_pending = FALSE;
+    request->error = 0;
+
+    if (length == 0)
+        request->status = EEPROM_DONE;
+    else
+        EEPROM_startTransfer(request);
+}
+
+void EEPROM_submitRead(EEPROM_RequestType *request, uint16 u16addr, uint8 *data, uint16 length)
+{
+    request->status = EEPROM_BUSY;
+    request->address = u16addr;
+    request->data = data;
+    request->remaining = length;
+    request->transaction.read = TRUE;
+    request->attempts = 0;
+    request->retry_pending = FALSE;
+    request->error = 0;
+
+    if (length == 0)
+        request->status = EEPROM_DONE;
+    else
+        EEPROM_startTransfer(request);
+}
+
+EEPROM_StatusType EEPROM_poll(EEPROM_RequestType *request)
+{
+    TWI_service();
+
+    /* Backoff doubles with every failed try of the transfer */
+    if ((request->retry_pending == TRUE) &&
+            ((Timer_now() - request->retry_time) >= ((uint32)EEPROM_RETRY_BACKOFF_MS << (request->attempts - 1))))
+    {
+        request->retry_pending = FALSE;
+        EEPROM_startTransfer(request);
+    }
+    return request->status;
+}
+
+/*
+ * Description :
+ * Wait for a request to finish, the TWI interrupt does the work.
+ */
+static uint8 EEPROM_wait(EEPROM_RequestType *request)
+{
+    while (EEPROM_poll(request) == EEPROM_BUSY)
+    {
+        /* The TWI interrupt or the tick of a retry backoff wakes us */
+        POWER_idle();
+    }
+
+    return (request->status == EEPROM_DONE) ? SUCCESS : ERROR;
+}
 
 uint8 EEPROM_writeByte(uint16 u16addr, uint8 u8data)
 {
-	/* Send the Start Bit */
-    TWI_start();
-    if (TWI_getStatus() != TWI_START)
-        return ERROR;
-		
-    /* Send the device address, we need to get A8 A9 A10 address bits from the
-     * memory location address and R/W=0 (write) */
-    TWI_writeByte((uint8)(0xA0 | ((u16addr & 0x0700)>>7)));
-    if (TWI_getStatus() != TWI_MT_SLA_W_ACK)
-        return ERROR; 
-		 
-    /* Send the required memory location address */
-    TWI_writeByte((uint8)(u16addr));
-    if (TWI_getStatus() != TWI_MT_DATA_ACK)
-        return ERROR;
-		
-    /* write byte to eeprom */
-    TWI_writeByte(u8data);
-    if (TWI_getStatus() != TWI_MT_DATA_ACK)
-        return ERROR;
-
-    /* Send the Stop Bit */
-    TWI_stop();
-	
-    return SUCCESS;
+    EEPROM_RequestType request;
+
+    EEPROM_submitWrite(&request, u16addr, &u8data, 1);
+    return EEPROM_wait(&request);
 }
 
 uint8 EEPROM_readByte(uint16 u16addr, uint8 *u8data)
 {
-	/* Send the Start Bit */
-    TWI_start();
-    if (TWI_getStatus() != TWI_START)
-        return ERROR;
-		
-    /* Send the device address, we need to get A8 A9 A10 address bits from the
-     * memory location address and R/W=0 (write) */
-    TWI_writeByte((uint8)((0xA0) | ((u16addr & 0x0700)>>7)));
-    if (TWI_getStatus() != TWI_MT_SLA_W_ACK)
-        return ERROR;
-		
-    /* Send the required memory location address */
-    TWI_writeByte((uint8)(u16addr));
-    if (TWI_getStatus() != TWI_MT_DATA_ACK)
-        return ERROR;
-		
-    /* Send the Repeated Start Bit */
-    TWI_start();
-    if (TWI_getStatus() != TWI_REP_START)
-        return ERROR;
-		
-    /* Send the device address, we need to get A8 A9 A10 address bits from the
-     * memory location address and R/W=1 (Read) */
-    TWI_writeByte((uint8)((0xA0) | ((u16addr & 0x0700)>>7) | 1));
-    if (TWI_getStatus() != TWI_MT_SLA_R_ACK)
-        return ERROR;
-
-    /* Read Byte from Memory without send ACK */
-    *u8data = TWI_readByteWithNACK();
-    if (TWI_getStatus() != TWI_MR_DATA_NACK)
-        return ERROR;
-
-    /* Send the Stop Bit */
-    TWI_stop();
-
-    return SUCCESS;
+    EEPROM_RequestType request;
+
+    EEPROM_submitRead(&request, u16addr, u8data, 1);
+    return EEPROM_wait(&request);
+}
+
+uint8 EEPROM_readBlock(uint16 u16addr, uint8 *data, uint16 length)
+{
+    EEPROM_RequestType request;
+    uint8 status;
+
+    PROF_begin(PROF_EEPROM_READ);
+    EEPROM_submitRead(&request, u16addr, data, length);
+    status = EEPROM_wait(&request);
+    PROF_end(PROF_EEPROM_READ);
+    return status;
 }
@@ -15,6 +15,7 @@
 #define EXTERNAL_EEPROM_H_
 
 #include "std_types.h"
+#include "twi.h"
 
 /*******************************************************************************
  *                      Preprocessor Macros                                    *
@@ -22,11 +23,94 @@
 #define ERROR 0
 #define SUCCESS 1
 
+/* 24C16 write page, a page write wraps around inside its page */
+#define EEPROM_PAGE_SIZE 16
+
+/*
+ * Device address attempts while the EEPROM is busy with its write cycle.
+ * One attempt is a start and the address byte, about 100 us at 100 kHz and
+ * 45 us at the fastest rate TWBR allows at 8 MHz, so this covers the 10 ms
+ * worst case write cycle of the 24Cxx parts.
+ */
+#define EEPROM_ACK_POLL_LIMIT 500
+
+/*
+ * A transfer that fails, by a timeout, a NACKed byte or a bus error, is tried
+ * again up to EEPROM_RETRIES times, waiting 1, 2, 4 ... times EEPROM_RETRY_BACKOFF_MS
+ * before each try. A dead bus fails a request in about 15 ms.
+ */
+#define EEPROM_RETRIES           3
+#define EEPROM_RETRY_BACKOFF_MS  1
+
+/* Longest sequential read in one transaction, so a retry repeats at most this much */
+#define EEPROM_READ_CHUNK        64
+
+/*******************************************************************************
+ *                         Types Declaration                                   *
+ *******************************************************************************/
+
+/* EEPROM_DONE comes first so a request that was never submitted is not busy */
+typedef enum
+{
+	EEPROM_DONE,EEPROM_BUSY,EEPROM_FAILED
+}EEPROM_StatusType;
+
+/*
+ * A read or write running in the background on the TWI engine.
+ * The caller owns the request and its buffer until the status leaves EEPROM_BUSY.
+ */
+typedef struct {
+	TWI_TransactionType transaction;   /* first member, the TWI callback finds the request through it */
+	uint16 address;                    /* next memory location to transfer */
+	uint8 *data;                       /* next byte to transfer */
+	uint16 remaining;                  /* bytes not handed to the TWI engine yet */
+	uint16 chunk;                      /* bytes of the transfer on the TWI engine */
+	uint8 attempts;                    /* failed tries of that transfer */
+	volatile boolean retry_pending;    /* waiting out the backoff before the next try */
+	uint32 retry_time;
+	volatile uint8 error;              /* TWI status of the last failure, TWI_TIMEOUT for a stuck bus */
+	volatile EEPROM_StatusType status;
+}EEPROM_RequestType;
+
 /*******************************************************************************
  *                      Functions Prototypes                                   *
  *******************************************************************************/
 
+/*
+ * Description :
+ * Start writing a buffer of any length in the background, one page write
+ * per EEPROM page it spans. The status turns EEPROM_DONE once the last page
+ * is sent, its write cycle is waited out by ACK polling on the next access.
+ */
+void EEPROM_submitWrite(EEPROM_RequestType *request, uint16 u16addr, const uint8 *data, uint16 length);
+
+/*
+ * Description :
+ * Start a sequential read of a buffer of any length in the background.
+ */
+void EEPROM_submitRead(EEPROM_RequestType *request, uint16 u16addr, uint8 *data, uint16 length);
+
+/*
+ * Description :
+ * Return the status of a submitted request. Poll requests through it, not
+ * through the status field: it restarts failed transfers after their backoff
+ * and runs the TWI watchdog.
+ */
+EEPROM_StatusType EEPROM_poll(EEPROM_RequestType *request);
+
+/*
+ * Blocking versions of the above, they wait for the request with the global
+ * interrupt enabled and return SUCCESS, or ERROR once the retries are used up.
+ */
 uint8 EEPROM_writeByte(uint16 u16addr,uint8 u8data);
 uint8 EEPROM_readByte(uint16 u16addr,uint8 *u8data);
+
+/*
+ * Description :
+ * Read a buffer of any length in sequential reads of up to EEPROM_READ_CHUNK
+ * bytes: the address is sent once, then the bytes are streamed with an ACK
+ * after each but the last.
+ */
+uint8 EEPROM_readBlock(uint16 u16addr, uint8 *data, uint16 length);
  
 #endif /* EXTERNAL_EEPROM_H_ */
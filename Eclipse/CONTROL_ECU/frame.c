@@ -0,0 +1,238 @@
+ /******************************************************************************
+ *
+ * Module: FRAME
+ *
+ * File Name: frame.c
+ *
+ * Description: Source file for the framed message layer on top of the UART driver
+ *
+ * Author: Malik Anas
+ *
+ *******************************************************************************/
+
+#include "frame.h"
+#include "uart.h"
+#include "crc8.h"
+#include "timer.h"
+#include "trace.h"
+
+/*******************************************************************************
+ *                               Types Declaration                             *
+ *******************************************************************************/
+
+typedef enum
+{
+	WAIT_START,WAIT_SOURCE,WAIT_SEQUENCE,WAIT_COMMAND,WAIT_LENGTH,WAIT_PAYLOAD,WAIT_CRC
+}FRAME_RxStateType;
+
+/*******************************************************************************
+ *                           Global Variables                                  *
+ *******************************************************************************/
+
+/* Receive parser state, survives between FRAME_poll calls */
+static FRAME_RxStateType g_rxState = WAIT_START;
+static FRAME_Type g_rxFrame;
+static uint8 g_rxIndex = 0;
+static uint8 g_rxCrc = CRC8_INITIAL;
+
+static FRAME_StatsType g_stats = {0};
+
+/* Address of this node */
+static uint8 g_address = 0;
+
+/*******************************************************************************
+ *                      Functions Definitions                                  *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Set the address of this node, sent as the source of every frame and used
+ * by the UART to receive only the frames addressed to this node.
+ */
+void FRAME_init(uint8 address)
+{
+	g_address = address;
+	UART_setAddress(address);
+}
+
+/*
+ * Description :
+ * Build a frame around the payload and queue it on the UART for the given node.
+ */
+void FRAME_send(uint8 address, uint8 sequence, uint8 command, const uint8 *payload, uint8 length)
+{
+	uint8 frame[FRAME_MAX_PAYLOAD + FRAME_OVERHEAD];
+	uint8 i;
+	uint8 crc = CRC8_INITIAL;
+
+	if(length > FRAME_MAX_PAYLOAD)
+	{
+		length = FRAME_MAX_PAYLOAD;
+	}
+
+	frame[0] = FRAME_START_BYTE;
+	frame[1] = g_address;
+	frame[2] = sequence;
+	frame[3] = command;
+	frame[4] = length;
+	crc = CRC8_update(crc, g_address);
+	crc = CRC8_update(crc, sequence);
+	crc = CRC8_update(crc, command);
+	crc = CRC8_update(crc, length);
+
+	for(i = 0; i < length; i++)
+	{
+		frame[5 + i] = payload[i];
+		crc = CRC8_update(crc, payload[i]);
+	}
+
+	frame[5 + length] = crc;
+
+	TRACE_record(TRACE_FRAME_SENT, command);
+	UART_sendAddress(address);
+	UART_sendBuffer(frame, (uint8)(length + FRAME_OVERHEAD));
+}
+
+/*
+ * Description :
+ * Send a frame kept by the caller again, counted as a retransmit.
+ */
+void FRAME_resend(const FRAME_Type *frame)
+{
+	g_stats.retransmits++;
+	FRAME_send(frame->address, frame->sequence, frame->command, frame->payload, frame->length);
+}
+
+/*
+ * Description :
+ * Tell the peer a frame arrived corrupted, so it resends what it is waiting on.
+ * The source of a corrupted frame is unknown, so every node gets the NACK.
+ */
+void FRAME_sendNack(void)
+{
+	FRAME_send(UART_BROADCAST_ADDRESS, FRAME_NO_SEQUENCE, FRAME_NACK, NULL_PTR, 0);
+}
+
+/*
+ * Description :
+ * Feed one received byte to the frame parser.
+ * Returns FRAME_READY with the frame filled when this byte completed a valid frame,
+ * FRAME_CORRUPTED if it completed a bad one, FRAME_NONE otherwise.
+ */
+static FRAME_StatusType FRAME_parseByte(uint8 data, FRAME_Type *frame)
+{
+	switch(g_rxState)
+	{
+	case WAIT_START:
+		/* Anything between frames is line noise, skip until the start byte */
+		if(data == FRAME_START_BYTE)
+		{
+			g_rxCrc = CRC8_INITIAL;
+			g_rxState = WAIT_SOURCE;
+		}
+		break;
+	case WAIT_SOURCE:
+		g_rxFrame.address = data;
+		g_rxCrc = CRC8_update(g_rxCrc, data);
+		g_rxState = WAIT_SEQUENCE;
+		break;
+	case WAIT_SEQUENCE:
+		g_rxFrame.sequence = data;
+		g_rxCrc = CRC8_update(g_rxCrc, data);
+		g_rxState = WAIT_COMMAND;
+		break;
+	case WAIT_COMMAND:
+		g_rxFrame.command = data;
+		g_rxCrc = CRC8_update(g_rxCrc, data);
+		g_rxState = WAIT_LENGTH;
+		break;
+	case WAIT_LENGTH:
+		if(data > FRAME_MAX_PAYLOAD)
+		{
+			g_stats.dropped_frames++;
+			g_rxState = WAIT_START;
+			TRACE_record(TRACE_FRAME_CORRUPTED, 0);
+			return FRAME_CORRUPTED;
+		}
+		g_rxFrame.length = data;
+		g_rxCrc = CRC8_update(g_rxCrc, data);
+		g_rxIndex = 0;
+		g_rxState = (data == 0) ? WAIT_CRC : WAIT_PAYLOAD;
+		break;
+	case WAIT_PAYLOAD:
+		g_rxFrame.payload[g_rxIndex] = data;
+		g_rxCrc = CRC8_update(g_rxCrc, data);
+		g_rxIndex++;
+		if(g_rxIndex == g_rxFrame.length)
+		{
+			g_rxState = WAIT_CRC;
+		}
+		break;
+	case WAIT_CRC:
+		g_rxState = WAIT_START;
+		if(data != g_rxCrc)
+		{
+			g_stats.dropped_frames++;
+			TRACE_record(TRACE_FRAME_CORRUPTED, 0);
+			return FRAME_CORRUPTED;
+		}
+		*frame = g_rxFrame;
+		TRACE_record(TRACE_FRAME_RECEIVED, g_rxFrame.command);
+		return FRAME_READY;
+	}
+
+	return FRAME_NONE;
+}
+
+/*
+ * Description :
+ * Consume the received bytes that are already buffered without blocking.
+ * Returns FRAME_READY with the frame filled once a complete frame passed its CRC,
+ * FRAME_CORRUPTED if a frame failed its CRC or length check, FRAME_NONE otherwise.
+ */
+FRAME_StatusType FRAME_poll(FRAME_Type *frame)
+{
+	uint8 data;
+	FRAME_StatusType status = FRAME_NONE;
+
+	while((status == FRAME_NONE) && UART_tryReceive(&data))
+	{
+		status = FRAME_parseByte(data, frame);
+	}
+
+	return status;
+}
+
+/*
+ * Description :
+ * Wait at most timeout_ms milliseconds for a complete frame.
+ * Returns FRAME_READY, FRAME_CORRUPTED, or FRAME_NONE if the time ran out.
+ */
+FRAME_StatusType FRAME_receiveTimeout(FRAME_Type *frame, uint32 timeout_ms)
+{
+	uint8 data;
+	uint32 start = Timer_now();
+	uint32 elapsed = 0;
+	FRAME_StatusType status = FRAME_NONE;
+
+	while((status == FRAME_NONE) && UART_receiveByteTimeout(&data, timeout_ms - elapsed))
+	{
+		status = FRAME_parseByte(data, frame);
+		elapsed = Timer_now() - start;
+		if(elapsed > timeout_ms)
+		{
+			elapsed = timeout_ms;
+		}
+	}
+
+	return status;
+}
+
+/*
+ * Description :
+ * Take a copy of the frame level link health counters.
+ */
+void FRAME_getStats(FRAME_StatsType *stats)
+{
+	*stats = g_stats;
+}
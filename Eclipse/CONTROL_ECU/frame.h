@@ -0,0 +1,113 @@
+ /******************************************************************************
+ *
+ * Module: FRAME
+ *
+ * File Name: frame.h
+ *
+ * Description: Header file for the framed message layer on top of the UART driver
+ *
+ * Author: Malik Anas
+ *
+ *******************************************************************************/
+
+#ifndef FRAME_H_
+#define FRAME_H_
+
+#include "std_types.h"
+
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+/*
+ * Every message between the ECUs is one frame, preceded by the UART address
+ * byte of the node it is for:
+ * START | SOURCE | SEQUENCE | COMMAND | LENGTH | PAYLOAD[LENGTH] | CRC-8
+ * The CRC-8 (polynomial 0x07) covers everything after START.
+ * A reply carries the sequence number of its request, so several requests
+ * can be outstanding and their replies may come back in any order.
+ */
+#define FRAME_START_BYTE       0x7E
+#define FRAME_MAX_PAYLOAD      16
+#define FRAME_OVERHEAD         6
+
+/* Sequence number of frames that are not a request or a reply, like notifications */
+#define FRAME_NO_SEQUENCE      0
+
+/* Sent when a frame arrived corrupted, the peer resends whatever it is still waiting on */
+#define FRAME_NACK             0x15
+
+/*******************************************************************************
+ *                               Types Declaration                             *
+ *******************************************************************************/
+
+typedef enum
+{
+	FRAME_NONE,FRAME_READY,FRAME_CORRUPTED
+}FRAME_StatusType;
+
+/* Frame level link health counters, they wrap around */
+typedef struct {
+	uint16 dropped_frames;    /* frames discarded for a bad CRC or length */
+	uint16 retransmits;       /* frames sent again with FRAME_resend */
+}FRAME_StatsType;
+
+typedef struct {
+	uint8 address;     /* other node, the source of a received frame or the destination of a sent one */
+	uint8 sequence;
+	uint8 command;
+	uint8 length;
+	uint8 payload[FRAME_MAX_PAYLOAD];
+}FRAME_Type;
+
+/*******************************************************************************
+ *                      Functions Prototypes                                   *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Set the address of this node, sent as the source of every frame and used
+ * by the UART to receive only the frames addressed to this node.
+ */
+void FRAME_init(uint8 address);
+
+/*
+ * Description :
+ * Build a frame around the payload and queue it on the UART for the given node.
+ */
+void FRAME_send(uint8 address, uint8 sequence, uint8 command, const uint8 *payload, uint8 length);
+
+/*
+ * Description :
+ * Send a frame kept by the caller again, counted as a retransmit.
+ */
+void FRAME_resend(const FRAME_Type *frame);
+
+/*
+ * Description :
+ * Tell the peer a frame arrived corrupted, so it resends what it is waiting on.
+ */
+void FRAME_sendNack(void);
+
+/*
+ * Description :
+ * Consume the received bytes that are already buffered without blocking.
+ * Returns FRAME_READY with the frame filled once a complete frame passed its CRC,
+ * FRAME_CORRUPTED if a frame failed its CRC or length check, FRAME_NONE otherwise.
+ */
+FRAME_StatusType FRAME_poll(FRAME_Type *frame);
+
+/*
+ * Description :
+ * Wait at most timeout_ms milliseconds for a complete frame.
+ * Returns FRAME_READY, FRAME_CORRUPTED, or FRAME_NONE if the time ran out.
+ */
+FRAME_StatusType FRAME_receiveTimeout(FRAME_Type *frame, uint32 timeout_ms);
+
+/*
+ * Description :
+ * Take a copy of the frame level link health counters.
+ */
+void FRAME_getStats(FRAME_StatsType *stats);
+
+#endif /* FRAME_H_ */
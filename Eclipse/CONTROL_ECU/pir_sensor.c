@@ -8,6 +8,10 @@
 
 #include "pir_sensor.h"
 #include "gpio.h"
+#include "trace.h"
+
+/* Last state read, to trace the changes only */
+static uint8 g_lastState = NO_MOTION;
 
 /*
  * Function: FlameSensor_init
@@ -36,5 +40,12 @@ void PIR_init(void)
  */
 uint8 PIR_getState(void)
 {
-    return GPIO_readPin(PIR_SENSOR_PORT_ID, PIR_SENSOR_PIN_ID);
+    uint8 state = GPIO_readPin(PIR_SENSOR_PORT_ID, PIR_SENSOR_PIN_ID);
+
+    if(state != g_lastState)
+    {
+        TRACE_record(TRACE_PIR, state);
+        g_lastState = state;
+    }
+    return state;
 }
@@ -0,0 +1,68 @@
+ /******************************************************************************
+ *
+ * Module: Power
+ *
+ * File Name: power.h
+ *
+ * Description: Header file for the sleep mode idle path and its time counters
+ *
+ * Author: Malik Anas
+ *
+ *******************************************************************************/
+
+#ifndef POWER_H_
+#define POWER_H_
+
+#include "std_types.h"
+
+/*******************************************************************************
+ *                               Types Declaration                             *
+ *******************************************************************************/
+
+/*
+ * Modes the CPU time is counted in. Waits only use IDLE: it is the one sleep
+ * mode that keeps the UART receiving, and the system tick on Timer2 runs from
+ * the CPU clock, which power-save stops.
+ */
+typedef enum
+{
+	POWER_ACTIVE,POWER_IDLE,POWER_MODES
+}POWER_ModeType;
+
+/* Milliseconds spent in every mode since POWER_init, in system ticks counted around every sleep */
+typedef struct {
+	uint32 time_ms[POWER_MODES];
+}POWER_StatsType;
+
+/*******************************************************************************
+ *                      Functions Prototypes                                   *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Start counting the time spent in every mode, needs the system tick.
+ */
+void POWER_init(void);
+
+/*
+ * Description :
+ * Put the CPU in IDLE until the next interrupt, with the global interrupt enabled.
+ * The UART, TWI and timer interrupts wake it, and the system tick wakes it every
+ * millisecond, so a wait that checks its condition before sleeping is at most
+ * one tick late when the interrupt it waits for came just before the sleep.
+ */
+void POWER_idle(void);
+
+/*
+ * Description :
+ * Sleep in IDLE for at least the given milliseconds of the system tick.
+ */
+void POWER_sleepMs(uint32 ms);
+
+/*
+ * Description :
+ * Get the time counters, call it from the main loop like POWER_idle.
+ */
+void POWER_getStats(POWER_StatsType *stats);
+
+#endif /* POWER_H_ */
@@ -0,0 +1,399 @@
+ /******************************************************************************
+ *
+ * Module: Record Store
+ *
+ * File Name: record_store.c
+ *
+ * Description: Source file for the wear leveled, log structured settings store
+ *              on the external EEPROM
+ *
+ * Author: Malik Anas
+ *
+ *******************************************************************************/
+
+#include "record_store.h"
+#include "eeprom_cache.h"
+#include "crc8.h"
+#include "timer.h"
+
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+/* Byte offsets inside a slot */
+#define RECORD_KEY_OFFSET        0
+#define RECORD_SEQUENCE_OFFSET   1
+#define RECORD_LENGTH_OFFSET     3
+#define RECORD_LIVE_OFFSET       4
+#define RECORD_DATA_OFFSET       5
+#define RECORD_CRC_OFFSET        (RECORD_SLOT_SIZE - 1)
+
+/* Key byte of a slot that was never written */
+#define RECORD_ERASED            0xFF
+
+#if ((RECORD_DATA_OFFSET + RECORD_MAX_DATA) != RECORD_CRC_OFFSET)
+#error "RECORD_MAX_DATA does not fill the slot"
+#endif
+
+#if (RECORD_KEYS > 8)
+#error "The live keys byte has room for 8 keys"
+#endif
+
+/*******************************************************************************
+ *                               Types Declaration                             *
+ *******************************************************************************/
+
+/* RAM copy of the newest record of a key */
+typedef struct {
+	boolean valid;       /* the setting has a value */
+	boolean stored;      /* that value has its record in slot, on the chip or in the cache */
+	boolean dirty;       /* changed since its record was appended */
+	uint32 dirty_time;
+	uint8 slot;
+	uint8 length;
+	uint8 data[RECORD_MAX_DATA];
+}RECORD_SettingType;
+
+/*******************************************************************************
+ *                           Global Variables                                  *
+ *******************************************************************************/
+
+static RECORD_SettingType g_settings[RECORD_KEYS];
+
+/* Where the next record goes and its sequence number */
+static uint8 g_nextSlot = 0;
+static uint16 g_nextSequence = 0;
+
+/* Slot read by the boot scan, or record built for an append */
+static uint8 g_page[RECORD_SLOT_SIZE];
+
+/*******************************************************************************
+ *                      Functions Definitions                                  *
+ *******************************************************************************/
+
+static uint16 RECORD_slotAddress(uint8 slot)
+{
+	return (uint16)(RECORD_BASE_ADDRESS + (uint16)slot * RECORD_SLOT_SIZE);
+}
+
+/*
+ * Description :
+ * Read the key and sequence number of a slot, the three bytes the binary search needs.
+ */
+static uint8 RECORD_readHeader(uint8 slot, uint8 *key, uint16 *sequence)
+{
+	uint8 header[3];
+
+	if(EEPROM_readBlock(RECORD_slotAddress(slot), header, 3) == ERROR)
+	{
+		return ERROR;
+	}
+	*key = header[RECORD_KEY_OFFSET];
+	*sequence = (uint16)(header[RECORD_SEQUENCE_OFFSET] | (header[RECORD_SEQUENCE_OFFSET + 1] << 8));
+	return SUCCESS;
+}
+
+/*
+ * Description :
+ * Return TRUE if the slot holds a whole record, a torn page write fails the CRC.
+ */
+static boolean RECORD_isValid(const uint8 *page)
+{
+	return (page[RECORD_KEY_OFFSET] < RECORD_KEYS) &&
+			(page[RECORD_LENGTH_OFFSET] <= RECORD_MAX_DATA) &&
+			(CRC8_compute(page, RECORD_CRC_OFFSET) == page[RECORD_CRC_OFFSET]);
+}
+
+static uint16 RECORD_pageSequence(const uint8 *page)
+{
+	return (uint16)(page[RECORD_SEQUENCE_OFFSET] | (page[RECORD_SEQUENCE_OFFSET + 1] << 8));
+}
+
+/*
+ * Description :
+ * Read every slot and find the valid record with the highest sequence number,
+ * for a ring whose slot 0 gives the binary search nothing to count from.
+ * *newest is RECORD_SLOTS if no slot holds a valid record.
+ */
+static uint8 RECORD_findNewest(uint8 *newest)
+{
+	uint8 slot;
+	uint16 sequence;
+	uint16 newest_sequence = 0;
+
+	*newest = RECORD_SLOTS;
+	for(slot = 0; slot < RECORD_SLOTS; slot++)
+	{
+		if(EEPROM_readBlock(RECORD_slotAddress(slot), g_page, RECORD_SLOT_SIZE) == ERROR)
+		{
+			return ERROR;
+		}
+		if(RECORD_isValid(g_page) == FALSE)
+		{
+			continue;
+		}
+
+		/* Sequence numbers wrap at 16 bits, the records in the ring are never more than RECORD_SLOTS apart */
+		sequence = RECORD_pageSequence(g_page);
+		if((*newest == RECORD_SLOTS) || ((sint16)(sequence - newest_sequence) > 0))
+		{
+			*newest = slot;
+			newest_sequence = sequence;
+		}
+	}
+	return SUCCESS;
+}
+
+uint8 RECORD_init(void)
+{
+	uint8 key;
+	uint8 slot;
+	uint8 low;
+	uint8 high;
+	uint8 mid;
+	uint8 i;
+	uint8 live = 0;
+	uint8 found = 0;
+	uint16 first_sequence;
+	uint16 sequence;
+	uint16 step;
+	boolean newest_found = FALSE;
+	RECORD_SettingType *setting;
+
+	for(key = 0; key < RECORD_KEYS; key++)
+	{
+		g_settings[key].valid = FALSE;
+		g_settings[key].stored = FALSE;
+		g_settings[key].dirty = FALSE;
+	}
+	g_nextSlot = 0;
+	g_nextSequence = 0;
+
+	/*
+	 * Records are appended from slot 0 on, and slot 0 is written again on every
+	 * lap around the ring. An erased or torn slot 0 is no empty store: the
+	 * newest record is then looked for in every slot.
+	 */
+	if(EEPROM_readBlock(RECORD_slotAddress(0), g_page, RECORD_SLOT_SIZE) == ERROR)
+	{
+		return ERROR;
+	}
+	if(RECORD_isValid(g_page) == TRUE)
+	{
+		/*
+		 * Slot i holds sequence first + i up to the newest record, the slots after
+		 * it are empty or hold records of the previous lap around the ring.
+		 */
+		first_sequence = RECORD_pageSequence(g_page);
+		low = 0;
+		high = RECORD_SLOTS;
+		while((high - low) > 1)
+		{
+			mid = (uint8)((low + high) / 2);
+			if(RECORD_readHeader(mid, &key, &sequence) == ERROR)
+			{
+				return ERROR;
+			}
+			if((key != RECORD_ERASED) && ((uint16)(sequence - first_sequence) == mid))
+			{
+				low = mid;
+			}
+			else
+			{
+				high = mid;
+			}
+		}
+	}
+	else
+	{
+		if(RECORD_findNewest(&low) == ERROR)
+		{
+			return ERROR;
+		}
+
+		/* Only a store without a single valid record is empty */
+		if(low == RECORD_SLOTS)
+		{
+			return SUCCESS;
+		}
+	}
+
+	/* Walk back from the newest slot, the first valid record of each key is its value */
+	for(step = 0; step < RECORD_SLOTS; step++)
+	{
+		slot = (uint8)((low + RECORD_SLOTS - step) % RECORD_SLOTS);
+		if(EEPROM_readBlock(RECORD_slotAddress(slot), g_page, RECORD_SLOT_SIZE) == ERROR)
+		{
+			return ERROR;
+		}
+		if(RECORD_isValid(g_page) == FALSE)
+		{
+			continue;
+		}
+
+		/* The newest valid record, a torn one after it gets overwritten by the next append */
+		if(newest_found == FALSE)
+		{
+			newest_found = TRUE;
+			live = g_page[RECORD_LIVE_OFFSET];
+			g_nextSlot = (uint8)((slot + 1) % RECORD_SLOTS);
+			g_nextSequence = (uint16)(RECORD_pageSequence(g_page) + 1);
+		}
+
+		key = g_page[RECORD_KEY_OFFSET];
+		if((found & (1 << key)) == 0)
+		{
+			found |= (uint8)(1 << key);
+			setting = &g_settings[key];
+			setting->valid = TRUE;
+			setting->stored = TRUE;
+			setting->slot = slot;
+			setting->length = g_page[RECORD_LENGTH_OFFSET];
+			for(i = 0; i < RECORD_MAX_DATA; i++)
+			{
+				setting->data[i] = g_page[RECORD_DATA_OFFSET + i];
+			}
+		}
+		if((found & live) == live)
+		{
+			break;
+		}
+	}
+	return SUCCESS;
+}
+
+uint8 RECORD_read(uint8 key, uint8 *data, uint8 length)
+{
+	uint8 i;
+
+	if((key >= RECORD_KEYS) || (g_settings[key].valid == FALSE))
+	{
+		return ERROR;
+	}
+	if(length > g_settings[key].length)
+	{
+		length = g_settings[key].length;
+	}
+	for(i = 0; i < length; i++)
+	{
+		data[i] = g_settings[key].data[i];
+	}
+	return SUCCESS;
+}
+
+uint8 RECORD_write(uint8 key, const uint8 *data, uint8 length)
+{
+	RECORD_SettingType *setting;
+	boolean changed;
+	uint8 i;
+
+	if((key >= RECORD_KEYS) || (length > RECORD_MAX_DATA))
+	{
+		return ERROR;
+	}
+
+	setting = &g_settings[key];
+	changed = (setting->valid == FALSE) || (setting->length != length);
+	for(i = 0; i < length; i++)
+	{
+		if(setting->data[i] != data[i])
+		{
+			setting->data[i] = data[i];
+			changed = TRUE;
+		}
+	}
+
+	/* Writing the value that is already stored costs no record */
+	if(changed == TRUE)
+	{
+		setting->valid = TRUE;
+		setting->length = length;
+		setting->dirty = TRUE;
+		setting->dirty_time = Timer_now();
+	}
+	return SUCCESS;
+}
+
+/*
+ * Description :
+ * Pick the key to append next, RECORD_KEYS if no change has settled.
+ */
+static uint8 RECORD_nextAppend(void)
+{
+	uint8 key;
+	uint8 candidate = RECORD_KEYS;
+
+	for(key = 0; key < RECORD_KEYS; key++)
+	{
+		if((g_settings[key].dirty == TRUE) && ((Timer_now() - g_settings[key].dirty_time) >= RECORD_WRITE_DELAY_MS))
+		{
+			candidate = key;
+			break;
+		}
+	}
+	if(candidate == RECORD_KEYS)
+	{
+		return RECORD_KEYS;
+	}
+
+	/* The next slot may hold the only record of another setting, move that one forward first */
+	for(key = 0; key < RECORD_KEYS; key++)
+	{
+		if((g_settings[key].stored == TRUE) && (g_settings[key].slot == g_nextSlot))
+		{
+			return key;
+		}
+	}
+	return candidate;
+}
+
+/*
+ * Description :
+ * Build the record of a key in the next slot and hand it to the cache.
+ * While the cache has no free line the key stays dirty and is tried again.
+ */
+static void RECORD_append(uint8 key)
+{
+	RECORD_SettingType *setting = &g_settings[key];
+	uint8 live = 0;
+	uint8 i;
+
+	for(i = 0; i < RECORD_KEYS; i++)
+	{
+		if(g_settings[i].valid == TRUE)
+		{
+			live |= (uint8)(1 << i);
+		}
+	}
+
+	g_page[RECORD_KEY_OFFSET] = key;
+	g_page[RECORD_SEQUENCE_OFFSET] = (uint8)g_nextSequence;
+	g_page[RECORD_SEQUENCE_OFFSET + 1] = (uint8)(g_nextSequence >> 8);
+	g_page[RECORD_LENGTH_OFFSET] = setting->length;
+	g_page[RECORD_LIVE_OFFSET] = live;
+	for(i = 0; i < RECORD_MAX_DATA; i++)
+	{
+		g_page[RECORD_DATA_OFFSET + i] = (i < setting->length) ? setting->data[i] : RECORD_ERASED;
+	}
+	g_page[RECORD_CRC_OFFSET] = CRC8_compute(g_page, RECORD_CRC_OFFSET);
+
+	if(CACHE_writeBlock(RECORD_slotAddress(g_nextSlot), g_page, RECORD_SLOT_SIZE) == ERROR)
+	{
+		return;
+	}
+	setting->dirty = FALSE;
+	setting->stored = TRUE;
+	setting->slot = g_nextSlot;
+	g_nextSlot = (uint8)((g_nextSlot + 1) % RECORD_SLOTS);
+	g_nextSequence++;
+}
+
+void RECORD_service(void)
+{
+	uint8 key = RECORD_nextAppend();
+
+	if(key < RECORD_KEYS)
+	{
+		RECORD_append(key);
+	}
+}
@@ -0,0 +1,80 @@
+ /******************************************************************************
+ *
+ * Module: Record Store
+ *
+ * File Name: record_store.h
+ *
+ * Description: Header file for the wear leveled, log structured settings store
+ *              on the external EEPROM
+ *
+ * Author: Malik Anas
+ *
+ *******************************************************************************/
+
+#ifndef RECORD_STORE_H_
+#define RECORD_STORE_H_
+
+#include "std_types.h"
+#include "external_eeprom.h"
+
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+/*
+ * The store is a ring of page sized slots over the lower 1 KB of the 24C16,
+ * the audit log keeps the upper half. A setting is never rewritten in place,
+ * every change is a new record in the next slot:
+ * KEY | SEQUENCE (2 bytes, LSB first) | LENGTH | LIVE KEYS | DATA[10] | CRC-8
+ * The sequence number goes up by one per slot, the newest record of a key wins.
+ * LIVE KEYS has a bit for every key that has a record, the boot scan stops
+ * once it found them all.
+ */
+#define RECORD_BASE_ADDRESS    0x0000
+#define RECORD_SLOT_SIZE       EEPROM_PAGE_SIZE
+#define RECORD_SLOTS           64
+#define RECORD_MAX_DATA        10
+
+/* Record keys, every setting has its own key, up to 8 */
+#define RECORD_PASSWORD        0
+#define RECORD_KEYS            1
+
+/* A changed setting is written once it was left alone this long, so a burst of changes costs one record */
+#define RECORD_WRITE_DELAY_MS  20
+
+/*******************************************************************************
+ *                      Functions Prototypes                                   *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Find the newest record of every key and load them into RAM, blocks until done.
+ * A binary search over the sequence numbers finds the newest slot in a few
+ * reads, from there the scan walks back until it has all live keys. Without
+ * a valid record in slot 0 every slot is read to find the newest one.
+ * Returns SUCCESS, or ERROR if the EEPROM could not be read even with retries.
+ */
+uint8 RECORD_init(void);
+
+/*
+ * Description :
+ * Copy up to length bytes of the setting from RAM, the bus is not used.
+ * Returns ERROR if the key has no record.
+ */
+uint8 RECORD_read(uint8 key, uint8 *data, uint8 length);
+
+/*
+ * Description :
+ * Change a setting in RAM, RECORD_service appends its record later.
+ * Returns ERROR for an unknown key or a length above RECORD_MAX_DATA.
+ */
+uint8 RECORD_write(uint8 key, const uint8 *data, uint8 length);
+
+/*
+ * Description :
+ * Append the record of one settled change, call it from the main loop.
+ * The record goes to the EEPROM cache, CACHE_service writes it back.
+ */
+void RECORD_service(void);
+
+#endif /* RECORD_STORE_H_ */
@@ -0,0 +1,134 @@
+ /******************************************************************************
+ *
+ * Module: Scheduler
+ *
+ * File Name: scheduler.c
+ *
+ * Description: Source file for the cooperative event driven task scheduler
+ *
+ * Author: Malik Anas
+ *
+ *******************************************************************************/
+
+#include "scheduler.h"
+#include "timer.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+/*******************************************************************************
+ *                           Global Variables                                  *
+ *******************************************************************************/
+
+typedef struct {
+	SCHED_TaskFunctionType function;
+	volatile SCHED_EventType events;    /* posted and not handed to the task yet */
+	volatile uint32 post_time;          /* when the first of them was posted */
+	SCHED_StatsType stats;
+}SCHED_TaskType;
+
+static SCHED_TaskType g_tasks[SCHED_MAX_TASKS];
+static uint8 g_taskCount = 0;
+
+/* Task that ran last, the search for a ready task starts after it */
+static uint8 g_lastTask = SCHED_MAX_TASKS - 1;
+
+/*******************************************************************************
+ *                      Functions Definitions                                  *
+ *******************************************************************************/
+
+SCHED_TaskIdType SCHED_addTask(SCHED_TaskFunctionType task)
+{
+	if(g_taskCount == SCHED_MAX_TASKS)
+	{
+		return SCHED_NO_TASK;
+	}
+
+	g_tasks[g_taskCount].function = task;
+	g_tasks[g_taskCount].events = 0;
+	return g_taskCount++;
+}
+
+void SCHED_post(SCHED_TaskIdType task, SCHED_EventType events)
+{
+	uint8 sreg;
+
+	if(task >= g_taskCount)
+	{
+		return;
+	}
+
+	/* ISRs post too, the events and their post time change together */
+	sreg = SREG;
+	cli();
+	if(g_tasks[task].events == 0)
+	{
+		g_tasks[task].post_time = Timer_now();
+	}
+	g_tasks[task].events |= events;
+	SREG = sreg;
+}
+
+boolean SCHED_dispatch(void)
+{
+	SCHED_TaskType *task;
+	SCHED_EventType events;
+	uint32 start;
+	uint32 elapsed;
+	uint8 sreg;
+	uint8 i;
+	uint8 id = g_lastTask;
+
+	for(i = 0; i < g_taskCount; i++)
+	{
+		id = (uint8)((id + 1 < g_taskCount) ? (id + 1) : 0);
+		task = &g_tasks[id];
+		if(task->events == 0)
+		{
+			continue;
+		}
+
+		/* Take the events, whatever is posted from now on makes the task ready again */
+		sreg = SREG;
+		cli();
+		events = task->events;
+		task->events = 0;
+		SREG = sreg;
+
+		start = Timer_now();
+		elapsed = start - task->post_time;
+		if(elapsed > task->stats.max_latency)
+		{
+			task->stats.max_latency = (elapsed > 0xFFFFUL) ? 0xFFFF : (uint16)elapsed;
+		}
+
+		task->function(events);
+
+		elapsed = Timer_now() - start;
+		if(elapsed > task->stats.max_run_time)
+		{
+			task->stats.max_run_time = (elapsed > 0xFFFFUL) ? 0xFFFF : (uint16)elapsed;
+		}
+		task->stats.runs++;
+
+		g_lastTask = id;
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+void SCHED_getStats(SCHED_TaskIdType task, SCHED_StatsType *stats, boolean clear)
+{
+	if(task >= g_taskCount)
+	{
+		return;
+	}
+
+	*stats = g_tasks[task].stats;
+	if(clear == TRUE)
+	{
+		g_tasks[task].stats.runs = 0;
+		g_tasks[task].stats.max_latency = 0;
+		g_tasks[task].stats.max_run_time = 0;
+	}
+}
@@ -0,0 +1,83 @@
+ /******************************************************************************
+ *
+ * Module: Scheduler
+ *
+ * File Name: scheduler.h
+ *
+ * Description: Header file for the cooperative event driven task scheduler
+ *
+ * Author: Malik Anas
+ *
+ *******************************************************************************/
+
+#ifndef SCHEDULER_H_
+#define SCHEDULER_H_
+
+#include "std_types.h"
+
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+/* Tasks that can be added */
+#define SCHED_MAX_TASKS        6
+
+/* Returned by SCHED_addTask when every task slot is in use */
+#define SCHED_NO_TASK          0xFF
+
+/*******************************************************************************
+ *                               Types Declaration                             *
+ *******************************************************************************/
+
+typedef uint8 SCHED_TaskIdType;
+
+/* Events of one task, one bit each, a task defines its own bits */
+typedef uint8 SCHED_EventType;
+
+/*
+ * A task runs to completion with every event posted to it since its last run,
+ * it never waits inside. Work that takes longer is split into steps, the task
+ * posts itself an event to run the next step after the other ready tasks.
+ */
+typedef void (*SCHED_TaskFunctionType)(SCHED_EventType events);
+
+/* Latency probe of one task, in milliseconds of the system tick */
+typedef struct {
+	uint16 runs;            /* wraps around */
+	uint16 max_latency;     /* longest wait from the first event posted to the start of the run */
+	uint16 max_run_time;    /* longest run */
+}SCHED_StatsType;
+
+/*******************************************************************************
+ *                      Functions Prototypes                                   *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Add a task, returns its id or SCHED_NO_TASK if all SCHED_MAX_TASKS are in use.
+ */
+SCHED_TaskIdType SCHED_addTask(SCHED_TaskFunctionType task);
+
+/*
+ * Description :
+ * Post events to a task, it runs on one of the next SCHED_dispatch calls.
+ * Safe to call from an ISR or a software timer callback.
+ */
+void SCHED_post(SCHED_TaskIdType task, SCHED_EventType events);
+
+/*
+ * Description :
+ * Run the next ready task once, ready tasks take turns in the order they
+ * were added, so a task waits for at most one run of every other task.
+ * Returns FALSE if no task was ready, the main loop may then idle until an
+ * interrupt posts an event.
+ */
+boolean SCHED_dispatch(void);
+
+/*
+ * Description :
+ * Copy the latency probe of a task, and clear it if clear is TRUE.
+ */
+void SCHED_getStats(SCHED_TaskIdType task, SCHED_StatsType *stats, boolean clear);
+
+#endif /* SCHEDULER_H_ */
@@ -13,6 +13,30 @@ static volatile void (*g_Timer0_CallBackPtr)(void) = NULL_PTR;
 static volatile void (*g_Timer1_CallBackPtr)(void) = NULL_PTR;
 static volatile void (*g_Timer2_CallBackPtr)(void) = NULL_PTR;
 
+/* Milliseconds counted by the system tick */
+static volatile uint32 g_tickCount = 0;
+
+/* A software timer, expired once the tick count passed its expiry */
+typedef struct
+{
+	void (*callback)(void);
+	uint32 expiry;
+	uint32 period;       /* 0 for a one-shot */
+	boolean active;
+}Timer_SoftTimerType;
+
+static Timer_SoftTimerType g_softTimers[TIMER_SOFT_TIMERS];
+
+/* Earliest expiry of the active timers, the tick only looks at the timers once it is reached */
+static volatile uint32 g_nextExpiry = 0;
+static volatile uint8 g_activeTimers = 0;
+
+/* Tick counts compare through their difference, an expiry up to half the range ahead is in the future */
+#define TIMER_EXPIRED(now, expiry)    ((uint32)((uint32)(now) - (uint32)(expiry)) < 0x80000000UL)
+
+static const Timer_ConfigType g_systemTickConfig =
+		TIMER_CONFIG(TIMER_2, F_CPU_64, CTC_MODE_OC_DISABLED, 0, SYSTEM_TICK_COMPARE_VALUE);
+
 ISR(TIMER0_OVF_vect)
 {
 	if(g_Timer0_CallBackPtr != NULL_PTR)
@@ -63,71 +87,27 @@ ISR(TIMER2_COMP_vect)
 }
 void Timer_init(const Timer_ConfigType * Config_Ptr)
 {
-	uint8 timer_clock = 0;
+	/* The clock is started last, by the control register store */
 	switch(Config_Ptr->timer_ID)
 	{
 	case TIMER_0:
-
-		if((Config_Ptr->timer_mode) > 0)
-		{
-			OCR0 = (Config_Ptr->timer_compare_MatchValue);
-			TIMSK |= 0x01;
-		}else
-		{
-			TIMSK |= 0x02;
-		}
-		TCNT0 = (uint8)(Config_Ptr->timer_InitialValue);
-
-		TCCR0 = (1 << FOC0) | ((((Config_Ptr->timer_mode) & 0x08) >> 3) << WGM01) | (((Config_Ptr->timer_mode) & 0x03) << COM00) | ((Config_Ptr->timer_clock) & 0x07);
-
+		OCR0 = (uint8)(Config_Ptr->compare_value);
+		TCNT0 = (uint8)(Config_Ptr->initial_value);
+		TIMSK |= Config_Ptr->interrupt_mask;
+		TCCR0 = Config_Ptr->control;
 		break;
 	case TIMER_1:
-
-		if((Config_Ptr->timer_mode) > 0)
-		{
-			OCR1A = (Config_Ptr->timer_compare_MatchValue);
-			TIMSK |= 0x10;
-		}else
-		{
-			TIMSK |= 0x04;
-		}
-		TCNT1 = (Config_Ptr->timer_InitialValue);
-		TCCR1A = (1<<FOC1A) |  (((Config_Ptr->timer_mode) & 0x03) << COM1A0);
-		TCCR1B = ((Config_Ptr->timer_clock) & 0x07) | ((((Config_Ptr->timer_mode) & 0x08) >> 3) << WGM12);
-
+		OCR1A = Config_Ptr->compare_value;
+		TCNT1 = Config_Ptr->initial_value;
+		TIMSK |= Config_Ptr->interrupt_mask;
+		TCCR1A = Config_Ptr->control_a;
+		TCCR1B = Config_Ptr->control;
 		break;
 	case TIMER_2:
-
-		if((Config_Ptr->timer_mode) > 0)
-		{
-			OCR2 = (Config_Ptr->timer_compare_MatchValue);
-			TIMSK |= 0x40;
-		}else
-		{
-			TIMSK |= 0x80;
-		}
-		TCNT2 = (uint8)(Config_Ptr->timer_InitialValue);
-		if((Config_Ptr->timer_clock) == TIMER2_F_CPU_128)
-		{
-
-			timer_clock = (uint8)0x05;
-
-		}else if((Config_Ptr->timer_clock) == TIMER2_F_CPU_32)
-		{
-			timer_clock = (uint8)0x03;
-		}else if((Config_Ptr->timer_clock) > 3)
-		{
-			timer_clock = (uint8)((Config_Ptr->timer_mode) + 2);
-		}else if((Config_Ptr->timer_clock) == F_CPU_64)
-		{
-			timer_clock = (uint8)((Config_Ptr->timer_mode) + 1);
-		}else
-		{
-			timer_clock = (uint8)(Config_Ptr->timer_mode);
-		}
-
-		TCCR2 = (1 << FOC2) | ((((Config_Ptr->timer_mode) & 0x08) >> 3) << WGM21) | (((Config_Ptr->timer_mode) & 0x03) << COM20) | (timer_clock & 0x07);
-
+		OCR2 = (uint8)(Config_Ptr->compare_value);
+		TCNT2 = (uint8)(Config_Ptr->initial_value);
+		TIMSK |= Config_Ptr->interrupt_mask;
+		TCCR2 = Config_Ptr->control;
 		break;
 	}
 }
@@ -176,3 +156,142 @@ void Timer_setCallBack(void(*a_ptr)(void), Timer_ID_Type a_timer_ID )
 		}
 }
 
+/*
+ * Find the earliest expiry of the active timers, called with interrupts disabled.
+ */
+static void Timer_updateNextExpiry(void)
+{
+	uint8 i;
+	boolean found = FALSE;
+
+	for(i = 0; i < TIMER_SOFT_TIMERS; i++)
+	{
+		if((g_softTimers[i].active == TRUE) &&
+				((found == FALSE) || TIMER_EXPIRED(g_nextExpiry, g_softTimers[i].expiry)))
+		{
+			g_nextExpiry = g_softTimers[i].expiry;
+			found = TRUE;
+		}
+	}
+}
+
+/*
+ * Timer2 callback of the system tick, runs the software timers that expired.
+ */
+static void Timer_tick(void)
+{
+	Timer_SoftTimerType *timer;
+	uint8 i;
+
+	g_tickCount++;
+
+	/* Most ticks end here, the timers are only scanned when the earliest one is due */
+	if((g_activeTimers == 0) || !TIMER_EXPIRED(g_tickCount, g_nextExpiry))
+	{
+		return;
+	}
+
+	for(i = 0; i < TIMER_SOFT_TIMERS; i++)
+	{
+		timer = &g_softTimers[i];
+		if((timer->active == TRUE) && TIMER_EXPIRED(g_tickCount, timer->expiry))
+		{
+			if(timer->period == 0)
+			{
+				timer->active = FALSE;
+				g_activeTimers--;
+			}
+			else
+			{
+				timer->expiry += timer->period;
+			}
+			timer->callback();
+		}
+	}
+	Timer_updateNextExpiry();
+}
+
+void Timer_startSystemTick(void)
+{
+	g_tickCount = 0;
+	Timer_setCallBack(Timer_tick, TIMER_2);
+	Timer_init(&g_systemTickConfig);
+}
+
+uint32 Timer_now(void)
+{
+	uint32 now;
+
+	/* 32-bit read shared with the tick ISR */
+	uint8 sreg = SREG;
+	cli();
+	now = g_tickCount;
+	SREG = sreg;
+
+	return now;
+}
+
+/*
+ * Take a free software timer and arm it, returns TIMER_NO_HANDLE if there is none.
+ */
+static Timer_HandleType Timer_startSoftTimer(uint32 delay_ms, uint32 period_ms, void (*callback)(void))
+{
+	Timer_HandleType handle = TIMER_NO_HANDLE;
+	uint8 i;
+
+	/* The tick ISR walks the same table */
+	uint8 sreg = SREG;
+	cli();
+	for(i = 0; i < TIMER_SOFT_TIMERS; i++)
+	{
+		if(g_softTimers[i].active == FALSE)
+		{
+			g_softTimers[i].callback = callback;
+			g_softTimers[i].expiry = g_tickCount + delay_ms;
+			g_softTimers[i].period = period_ms;
+			g_softTimers[i].active = TRUE;
+			g_activeTimers++;
+			Timer_updateNextExpiry();
+			handle = i;
+			break;
+		}
+	}
+	SREG = sreg;
+
+	return handle;
+}
+
+Timer_HandleType Timer_startOneShot(uint32 delay_ms, void (*callback)(void))
+{
+	return Timer_startSoftTimer(delay_ms, 0, callback);
+}
+
+Timer_HandleType Timer_startPeriodic(uint32 period_ms, void (*callback)(void))
+{
+	/* A period of 0 would make it a one-shot */
+	if(period_ms == 0)
+	{
+		period_ms = 1;
+	}
+	return Timer_startSoftTimer(period_ms, period_ms, callback);
+}
+
+void Timer_stop(Timer_HandleType handle)
+{
+	uint8 sreg;
+
+	if(handle >= TIMER_SOFT_TIMERS)
+	{
+		return;
+	}
+
+	sreg = SREG;
+	cli();
+	if(g_softTimers[handle].active == TRUE)
+	{
+		g_softTimers[handle].active = FALSE;
+		g_activeTimers--;
+		Timer_updateNextExpiry();
+	}
+	SREG = sreg;
+}
@@ -0,0 +1,101 @@
+ /******************************************************************************
+ *
+ * Module: Trace
+ *
+ * File Name: trace.h
+ *
+ * Description: Header file for the in-RAM event trace of the drivers
+ *
+ * Author: Malik Anas
+ *
+ *******************************************************************************/
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include "std_types.h"
+
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+/* Build with TRACE_ENABLE=0 to compile every trace point out */
+#ifndef TRACE_ENABLE
+#define TRACE_ENABLE           1
+#endif
+
+/* Records kept, the oldest is overwritten when the ring is full */
+#ifndef TRACE_RECORDS
+#define TRACE_RECORDS          32
+#endif
+
+/*
+ * A dump whose next page does not come within this time was abandoned, the
+ * next record resumes recording. Longer than a GET_TRACE round trip with its
+ * retransmissions.
+ */
+#ifndef TRACE_DUMP_TIMEOUT_MS
+#define TRACE_DUMP_TIMEOUT_MS  1000
+#endif
+
+#if (TRACE_RECORDS < 4) || (TRACE_RECORDS > 128) || ((TRACE_RECORDS & (TRACE_RECORDS - 1)) != 0)
+#error "TRACE_RECORDS must be a power of two from 4 to 128"
+#endif
+
+/*
+ * A record is the low 16 bits of Timer_now, then the event and its data byte,
+ * little-endian, and a GET_TRACE page carries up to TRACE_PAGE_RECORDS of them.
+ */
+#define TRACE_RECORD_BYTES     4
+#define TRACE_PAGE_RECORDS     4
+
+/* Events and their data byte, the same on both ECUs */
+#define TRACE_DUMP             0x01    /* 0, the dump started and recording paused */
+#define TRACE_DUMP_ABANDONED   0x02    /* 0, no page for TRACE_DUMP_TIMEOUT_MS, recording resumed */
+#define TRACE_FRAME_SENT       0x10    /* command */
+#define TRACE_FRAME_RECEIVED   0x11    /* command of a frame that passed its CRC */
+#define TRACE_FRAME_CORRUPTED  0x12    /* 0 */
+#define TRACE_UART_ERROR       0x20    /* FE, DOR and PE bits of UCSRA */
+#define TRACE_UART_BAUD        0x21    /* new baud rate / 1200, 255 above */
+#define TRACE_TWI_START        0x30    /* slave address byte of the transaction */
+#define TRACE_TWI_FAILED       0x31    /* TWSR status it ended with */
+#define TRACE_TWI_RECOVER      0x32    /* 0, SDA was stuck and the bus was clocked free */
+#define TRACE_KEY              0x40    /* key, TRACE_KEY_DIGIT for 0 to 9 */
+#define TRACE_MOTOR            0x50    /* DcMotor_State */
+#define TRACE_PIR              0x51    /* MOTION or NO_MOTION, on every change */
+
+/* Data byte of TRACE_KEY for every digit key, so no password is kept in the ring */
+#define TRACE_KEY_DIGIT        0xFF
+
+/*******************************************************************************
+ *                      Functions Prototypes                                   *
+ *******************************************************************************/
+
+#if (TRACE_ENABLE != 0)
+
+/*
+ * Description :
+ * Add a record to the ring, safe to call from an ISR. Nothing is recorded
+ * while a dump is in progress, unless it was abandoned.
+ */
+void TRACE_record(uint8 event, uint8 data);
+
+/*
+ * Description :
+ * Write the GET_TRACE page that starts offset records after the oldest one,
+ * returns its length, a multiple of TRACE_RECORD_BYTES. Offset 0 starts a
+ * dump: it records TRACE_DUMP as the newest record and pauses recording so
+ * the pages stay in place. A page shorter than TRACE_PAGE_RECORDS records
+ * is the last one and resumes recording, so does the first record after
+ * TRACE_DUMP_TIMEOUT_MS without a page, behind a TRACE_DUMP_ABANDONED.
+ */
+uint8 TRACE_encode(uint8 offset, uint8 *payload);
+
+#else
+
+#define TRACE_record(event, data)     ((void)0)
+#define TRACE_encode(offset, payload) ((void)(offset), (void)(payload), (uint8)0)
+
+#endif
+
+#endif /* TRACE_H_ */
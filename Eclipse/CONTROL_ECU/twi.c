@@ -12,14 +12,51 @@
  
 #include "twi.h"
 #include "common_macros.h"
+#include "timer.h"
+#include "trace.h"
 #include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/delay.h>
+
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+/* TWCR values of the interrupt driven engine, TWINT written as one starts the next bus action */
+#define TWI_ENGINE_CONTINUE    ((1<<TWINT) | (1<<TWEN) | (1<<TWIE))
+#define TWI_ENGINE_START       (TWI_ENGINE_CONTINUE | (1<<TWSTA))
+
+/* TWI pins, driven by hand while the bus is recovered */
+#define TWI_SCL_PIN            PC0
+#define TWI_SDA_PIN            PC1
+
+/* Half an SCL period of the recovery clocks, 100 kHz */
+#define TWI_RECOVERY_HALF_US   5
+
+/*******************************************************************************
+ *                           Global Variables                                  *
+ *******************************************************************************/
+
+/* Transactions waiting behind the one in progress */
+static TWI_TransactionType * volatile g_queue[TWI_QUEUE_SIZE];
+static volatile uint8 g_queueHead = 0;
+static volatile uint8 g_queueTail = 0;
+
+/* Transaction on the bus and how far it got */
+static TWI_TransactionType * volatile g_current = NULL_PTR;
+static uint16 g_index = 0;
+static uint16 g_polls = 0;
+static boolean g_reading = FALSE;
+
+/* Timer_now of the last TWI interrupt of the transaction on the bus */
+static volatile uint32 g_lastProgress = 0;
 
 void TWI_init(const TWI_ConfigType * Config_Ptr)
 {
+    /* Bit rate from TWI_BIT_RATE, checked in twi.h */
+    TWBR = (uint8)TWI_TWBR;
+	TWSR = TWI_TWPS;
 
-    TWBR =  (uint8)(((F_CPU / (Config_Ptr->bit_rate)) - 16)/2);;
-	TWSR = 0x00;
-	
 
     /* Two Wire Bus address my address if any master device want to call me: 0x1 (used in case this MC is a slave device)
        General Call Recognition: Off */
@@ -28,73 +65,253 @@ void TWI_init(const TWI_ConfigType * Config_Ptr)
     TWCR = (1<<TWEN); /* enable TWI */
 }
 
-void TWI_start(void)
+/*
+ * Description :
+ * Free a bus a slave holds by clocking SCL until it lets go of SDA, then
+ * send a STOP. The TWI is off meanwhile and the pins act as open drain
+ * outputs: DDR set pulls the line low, DDR clear lets the pull-up raise it.
+ */
+static void TWI_recoverBus(void)
+{
+	uint8 clocks;
+
+	TRACE_record(TRACE_TWI_RECOVER, 0);
+	TWCR = 0;
+	CLEAR_BIT(PORTC, TWI_SCL_PIN);
+	CLEAR_BIT(PORTC, TWI_SDA_PIN);
+	CLEAR_BIT(DDRC, TWI_SDA_PIN);
+
+	for(clocks = 0; (clocks < TWI_RECOVERY_CLOCKS) && BIT_IS_CLEAR(PINC, TWI_SDA_PIN); clocks++)
+	{
+		SET_BIT(DDRC, TWI_SCL_PIN);
+		_delay_us(TWI_RECOVERY_HALF_US);
+		CLEAR_BIT(DDRC, TWI_SCL_PIN);
+		_delay_us(TWI_RECOVERY_HALF_US);
+	}
+
+	/* STOP: SDA goes high while SCL is high */
+	SET_BIT(DDRC, TWI_SDA_PIN);
+	_delay_us(TWI_RECOVERY_HALF_US);
+	CLEAR_BIT(DDRC, TWI_SDA_PIN);
+	_delay_us(TWI_RECOVERY_HALF_US);
+
+	TWCR = (1<<TWEN);
+}
+
+/*
+ * Description :
+ * Put the next queued transaction on the bus, with a START or after the STOP of the last one.
+ */
+static void TWI_startNext(uint8 stop)
+{
+	g_current = NULL_PTR;
+	if(g_queueTail != g_queueHead)
+	{
+		g_current = g_queue[g_queueTail];
+		g_queueTail = (uint8)((g_queueTail + 1) % TWI_QUEUE_SIZE);
+		g_current->state = TWI_RUNNING;
+		g_index = 0;
+		g_polls = 0;
+		g_reading = FALSE;
+		g_lastProgress = Timer_now();
+		TRACE_record(TRACE_TWI_START, (uint8)(g_current->slave_address | ((g_current->read == TRUE) ? 1 : 0)));
+
+		/* With TWSTO and TWSTA both set the TWI sends the STOP and then a new START */
+		TWCR = TWI_ENGINE_START | stop;
+	}
+	else if(stop)
+	{
+		TWCR = (1<<TWINT) | (1<<TWSTO) | (1<<TWEN);
+	}
+}
+
+/*
+ * Description :
+ * End the transaction in progress, tell its owner and move on to the next one.
+ */
+static void TWI_finish(TWI_TransactionStateType state, uint8 status)
 {
-    /* 
-	 * Clear the TWINT flag before sending the start bit TWINT=1
-	 * send the start bit by TWSTA=1
-	 * Enable TWI Module TWEN=1 
-	 */
-    TWCR = (1 << TWINT) | (1 << TWSTA) | (1 << TWEN);
-    
-    /* Wait for TWINT flag set in TWCR Register (start bit is send successfully) */
-    while(BIT_IS_CLEAR(TWCR,TWINT));
+	TWI_TransactionType *transaction = g_current;
+
+	transaction->error_status = status;
+	transaction->state = state;
+	if(state == TWI_FAILED)
+	{
+		TRACE_record(TRACE_TWI_FAILED, status);
+	}
+
+	/* The callback may queue a follow-up transaction, it goes on the bus right after the STOP */
+	if(transaction->callback != NULL_PTR)
+	{
+		transaction->callback(transaction);
+	}
+
+	TWI_startNext(1<<TWSTO);
 }
 
-void TWI_stop(void)
+/*
+ * Description :
+ * Send the next header or data byte, then the repeated START of a read or the end of a write.
+ */
+static void TWI_sendNext(void)
 {
-    /* 
-	 * Clear the TWINT flag before sending the stop bit TWINT=1
-	 * send the stop bit by TWSTO=1
-	 * Enable TWI Module TWEN=1 
-	 */
-    TWCR = (1 << TWINT) | (1 << TWSTO) | (1 << TWEN);
+	TWI_TransactionType *transaction = g_current;
+
+	if(g_index < transaction->header_length)
+	{
+		TWDR = transaction->header[g_index];
+		g_index++;
+		TWCR = TWI_ENGINE_CONTINUE;
+	}
+	else if(transaction->read == TRUE)
+	{
+		g_reading = TRUE;
+		TWCR = TWI_ENGINE_START;
+	}
+	else if((g_index - transaction->header_length) < transaction->length)
+	{
+		TWDR = transaction->data[g_index - transaction->header_length];
+		g_index++;
+		TWCR = TWI_ENGINE_CONTINUE;
+	}
+	else
+	{
+		TWI_finish(TWI_DONE, TWI_MT_DATA_ACK);
+	}
 }
 
-void TWI_writeByte(uint8 data)
+/*
+ * Description :
+ * Ask for the next byte, with an ACK while more bytes are wanted and a NACK for the last one.
+ */
+static void TWI_receiveNext(void)
 {
-    /* Put data On TWI data Register */
-    TWDR = data;
-    /* 
-	 * Clear the TWINT flag before sending the data TWINT=1
-	 * Enable TWI Module TWEN=1 
-	 */ 
-    TWCR = (1 << TWINT) | (1 << TWEN);
-    /* Wait for TWINT flag set in TWCR Register(data is send successfully) */
-    while(BIT_IS_CLEAR(TWCR,TWINT));
+	if((g_current->length - g_index) > 1)
+	{
+		TWCR = TWI_ENGINE_CONTINUE | (1<<TWEA);
+	}
+	else
+	{
+		TWCR = TWI_ENGINE_CONTINUE;
+	}
 }
 
-uint8 TWI_readByteWithACK(void)
+ISR(TWI_vect)
 {
-	/* 
-	 * Clear the TWINT flag before reading the data TWINT=1
-	 * Enable sending ACK after reading or receiving data TWEA=1
-	 * Enable TWI Module TWEN=1 
-	 */ 
-    TWCR = (1 << TWINT) | (1 << TWEN) | (1 << TWEA);
-    /* Wait for TWINT flag set in TWCR Register (data received successfully) */
-    while(BIT_IS_CLEAR(TWCR,TWINT));
-    /* Read Data */
-    return TWDR;
+	uint8 status = TWSR & 0xF8;
+
+	g_lastProgress = Timer_now();
+
+	if(g_current == NULL_PTR)
+	{
+		/* Nothing to drive, release the bus */
+		TWCR = (1<<TWINT) | (1<<TWSTO) | (1<<TWEN);
+		return;
+	}
+
+	switch(status)
+	{
+	case TWI_START:
+	case TWI_REP_START:
+		TWDR = (uint8)(g_current->slave_address | ((g_reading == TRUE) ? 1 : 0));
+		TWCR = TWI_ENGINE_CONTINUE;
+		break;
+
+	case TWI_MT_SLA_W_ACK:
+		g_index = 0;
+		TWI_sendNext();
+		break;
+
+	case TWI_MT_DATA_ACK:
+		TWI_sendNext();
+		break;
+
+	case TWI_MT_SLA_W_NACK:
+	case TWI_MR_SLA_R_NACK:
+		/* A busy slave, like an EEPROM in its write cycle, ignores its address: try again */
+		g_polls++;
+		if(g_polls < g_current->poll_limit)
+		{
+			/* The retry starts the transaction over, header included */
+			g_index = 0;
+			g_reading = FALSE;
+			TWCR = TWI_ENGINE_START;
+		}
+		else
+		{
+			TWI_finish(TWI_FAILED, status);
+		}
+		break;
+
+	case TWI_MT_SLA_R_ACK:
+		g_index = 0;
+		TWI_receiveNext();
+		break;
+
+	case TWI_MR_DATA_ACK:
+		g_current->data[g_index] = TWDR;
+		g_index++;
+		TWI_receiveNext();
+		break;
+
+	case TWI_MR_DATA_NACK:
+		g_current->data[g_index] = TWDR;
+		TWI_finish(TWI_DONE, status);
+		break;
+
+	default:
+		/* Data NACK, lost arbitration or a bus error, the STOP of TWI_finish also clears a bus error */
+		TWI_finish(TWI_FAILED, status);
+		break;
+	}
 }
 
-uint8 TWI_readByteWithNACK(void)
+boolean TWI_submit(TWI_TransactionType *transaction)
 {
-	/* 
-	 * Clear the TWINT flag before reading the data TWINT=1
-	 * Enable TWI Module TWEN=1 
-	 */
-    TWCR = (1 << TWINT) | (1 << TWEN);
-    /* Wait for TWINT flag set in TWCR Register (data received successfully) */
-    while(BIT_IS_CLEAR(TWCR,TWINT));
-    /* Read Data */
-    return TWDR;
+	uint8 sreg = SREG;
+	uint8 next;
+	boolean queued = TRUE;
+
+	/* A read needs at least one byte to NACK */
+	if((transaction->read == TRUE) && (transaction->length == 0))
+	{
+		transaction->state = TWI_FAILED;
+		return FALSE;
+	}
+
+	transaction->state = TWI_QUEUED;
+
+	cli();
+	next = (uint8)((g_queueHead + 1) % TWI_QUEUE_SIZE);
+	if(next == g_queueTail)
+	{
+		queued = FALSE;
+	}
+	else
+	{
+		g_queue[g_queueHead] = transaction;
+		g_queueHead = next;
+
+		/* An idle bus starts right away, otherwise the ISR picks it up after the current one */
+		if(g_current == NULL_PTR)
+		{
+			TWI_startNext(0);
+		}
+	}
+	SREG = sreg;
+
+	return queued;
 }
 
-uint8 TWI_getStatus(void)
+void TWI_service(void)
 {
-    uint8 status;
-    /* masking to eliminate first 3 bits and get the last 5 bits (status bits) */
-    status = TWSR & 0xF8;
-    return status;
+	uint8 sreg = SREG;
+
+	cli();
+	if((g_current != NULL_PTR) && ((Timer_now() - g_lastProgress) > TWI_TIMEOUT_MS))
+	{
+		TWI_recoverBus();
+		TWI_finish(TWI_FAILED, TWI_TIMEOUT);
+	}
+	SREG = sreg;
 }
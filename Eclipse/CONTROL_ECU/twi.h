@@ -27,26 +27,125 @@
 #define TWI_MT_DATA_ACK   0x28 /* Master transmit data and ACK has been received from Slave. */
 #define TWI_MR_DATA_ACK   0x50 /* Master received data and send ACK to slave. */
 #define TWI_MR_DATA_NACK  0x58 /* Master received data but doesn't send ACK to slave. */
+#define TWI_MT_SLA_W_NACK 0x20 /* Master transmit ( slave address + Write request ) to slave + NACK received from slave. */
+#define TWI_MT_DATA_NACK  0x30 /* Master transmit data and NACK has been received from Slave. */
+#define TWI_MR_SLA_R_NACK 0x48 /* Master transmit ( slave address + Read request ) to slave + NACK received from slave. */
+#define TWI_BUS_ERROR     0x00 /* Illegal START or STOP on the bus. */
+#define TWI_TIMEOUT       0x01 /* Not a TWSR status: no TWINT within TWI_TIMEOUT_MS, the bus was recovered. */
+
+/*
+ * Longest wait for TWINT. A byte takes 90 us at 100 kHz, a TWI that is
+ * silent this long has a slave holding SDA or SCL low.
+ */
+#define TWI_TIMEOUT_MS    2
+
+/* SCL pulses clocked out by hand to make a stuck slave finish its byte and let go of SDA */
+#define TWI_RECOVERY_CLOCKS   9
+
+/* Transactions waiting for the bus behind the one in progress */
+#define TWI_QUEUE_SIZE    4
+
+/* Bytes written to the slave before the data, like the memory location address */
+#define TWI_MAX_HEADER    2
+
+/*
+ * SCL frequency, 100000UL (standard mode) up to 400000UL (fast mode).
+ * SCL = F_CPU / (16 + 2 * TWBR * 4^TWPS), TWBR and TWPS are worked out
+ * here and checked when the driver is built.
+ * The ATmega32 datasheet asks for TWBR >= 10 in master mode, so at 8 MHz
+ * the bus runs at 222 kHz at most and fast mode needs F_CPU >= 14.4 MHz.
+ */
+#ifndef TWI_BIT_RATE
+#define TWI_BIT_RATE      100000UL
+#endif
+
+#if (TWI_BIT_RATE > 400000UL)
+#error "TWI_BIT_RATE above the 400 kHz of fast mode"
+#endif
+#if ((F_CPU / TWI_BIT_RATE) < 16UL)
+#error "TWI_BIT_RATE above F_CPU / 16, it is out of reach of the TWI"
+#endif
+
+#define TWI_TWBR_FOR(PRESCALER)  (((F_CPU / TWI_BIT_RATE) - 16UL) / (2UL * (PRESCALER)))
+
+/* Smallest prescaler that gets TWBR into 8 bits, the finest steps */
+#if (TWI_TWBR_FOR(1) <= 255)
+#define TWI_TWPS          0
+#define TWI_TWBR          TWI_TWBR_FOR(1)
+#elif (TWI_TWBR_FOR(4) <= 255)
+#define TWI_TWPS          1
+#define TWI_TWBR          TWI_TWBR_FOR(4)
+#elif (TWI_TWBR_FOR(16) <= 255)
+#define TWI_TWPS          2
+#define TWI_TWBR          TWI_TWBR_FOR(16)
+#elif (TWI_TWBR_FOR(64) <= 255)
+#define TWI_TWPS          3
+#define TWI_TWBR          TWI_TWBR_FOR(64)
+#else
+#error "TWI_BIT_RATE too slow for F_CPU"
+#endif
+
+/* SCL the registers really give, it must be within 2 % of TWI_BIT_RATE and not above it */
+#define TWI_ACTUAL_BIT_RATE  (F_CPU / (16UL + 2UL * TWI_TWBR * (1UL << (2 * TWI_TWPS))))
+
+#if (TWI_TWBR < 10)
+#error "TWI_BIT_RATE needs TWBR below 10, the TWI master is not reliable there"
+#endif
+
+#if ((TWI_ACTUAL_BIT_RATE > TWI_BIT_RATE) || ((TWI_ACTUAL_BIT_RATE * 50UL) < (TWI_BIT_RATE * 49UL)))
+#error "TWI_BIT_RATE can not be reached with this F_CPU"
+#endif
 
 typedef uint8 TWI_AddressType;
-typedef uint32 TWI_BaudRateType;
 
 typedef struct {
 TWI_AddressType address;
-TWI_BaudRateType bit_rate;
 }TWI_ConfigType;
 
+typedef enum
+{
+	TWI_QUEUED,TWI_RUNNING,TWI_DONE,TWI_FAILED
+}TWI_TransactionStateType;
+
+/*
+ * One bus transaction run in the background by the TWI interrupt:
+ * START, SLA+W, the header bytes, then either the data bytes and STOP, or
+ * a repeated START, SLA+R, the data bytes read and STOP.
+ * The caller owns the transaction and its data until the state is TWI_DONE or TWI_FAILED.
+ */
+typedef struct TWI_Transaction {
+	uint8 slave_address;                  /* SLA with the R/W bit clear */
+	uint8 header[TWI_MAX_HEADER];
+	uint8 header_length;
+	uint8 *data;
+	uint16 length;
+	boolean read;                         /* TRUE to read the data after the header */
+	uint16 poll_limit;                    /* SLA retries while the slave NACKs it, for ACK polling */
+	volatile TWI_TransactionStateType state;
+	volatile uint8 error_status;          /* TWSR status that failed the transaction */
+	void (*callback)(struct TWI_Transaction *transaction);  /* called from the TWI ISR at the end, may be NULL_PTR */
+}TWI_TransactionType;
+
 /*******************************************************************************
  *                      Functions Prototypes                                   *
  *******************************************************************************/
 
 void TWI_init(const TWI_ConfigType * Config_Ptr);
-void TWI_start(void);
-void TWI_stop(void);
-void TWI_writeByte(uint8 data);
-uint8 TWI_readByteWithACK(void);
-uint8 TWI_readByteWithNACK(void);
-uint8 TWI_getStatus(void);
+
+/*
+ * Description :
+ * Queue a transaction, it starts at once if the bus is free.
+ * Returns FALSE if the queue is full. Safe to call from a transaction callback.
+ */
+boolean TWI_submit(TWI_TransactionType *transaction);
+
+/*
+ * Description :
+ * Watchdog of the transaction engine, call it while waiting on a transaction.
+ * A transaction that got no TWINT for TWI_TIMEOUT_MS is failed with TWI_TIMEOUT,
+ * the bus is recovered and the queue moves on.
+ */
+void TWI_service(void);
 
 
 #endif /* TWI_H_ */
@@ -5,26 +5,41 @@
 # Add inputs and outputs from these tool invocations to the build variables 
 C_SRCS += \
 ../HMI_ECU.c \
+../crc8.c \
+../frame.c \
 ../gpio.c \
 ../keypad.c \
 ../lcd.c \
+../power.c \
+../profile.c \
 ../timer.c \
+../trace.c \
 ../uart.c 
 
 OBJS += \
 ./HMI_ECU.o \
+./crc8.o \
+./frame.o \
 ./gpio.o \
 ./keypad.o \
 ./lcd.o \
+./power.o \
+./profile.o \
 ./timer.o \
+./trace.o \
 ./uart.o 
 
 C_DEPS += \
 ./HMI_ECU.d \
+./crc8.d \
+./frame.d \
 ./gpio.d \
 ./keypad.d \
 ./lcd.d \
+./power.d \
+./profile.d \
 ./timer.d \
+./trace.d \
 ./uart.d 
 
 
@@ -9,46 +9,117 @@
 #include "keypad.h"
 #include "interrupt.h"
 #include "std_types.h"
-#include <util/delay.h>
 #include "uart.h"
+#include "frame.h"
 #include "timer.h"
+#include "power.h"
+#include "profile.h"
+#include "trace.h"
 
 /* ---------------------- MACROS AND CONSTANTS ---------------------- */
 
 #define PASSWORD_DIGITS 	5   /* Number of digits in the password */
+#define PASSWORD_PACKED_BYTES	((PASSWORD_DIGITS + 1) / 2) /* Two digits per frame byte */
 
 /* UART command definitions */
 #define MC2_READY      		0xE0
 #define GET_STATUS     		0xE1
 #define SET_NEW_PASS   		0xE2
-#define NEXT_DIGIT     		0xE3
 #define CONFIRM_PASS   		0xE4
 #define PASS_MATCH     		0xE5
 #define PASS_NO_MATCH  		0xE6
 #define CHECK_PASS          0xE7
+#define GET_DIAG            0xE8
 #define RECIEVED            0xE9
 #define ATTEMPTS_ENDED      0xF0
 #define UNLOCK_DOOR         0xF1
 #define LOCK_DOOR           0xF2
 #define PASSWORD_SAVED      0x23
+#define BAUD_CHANGE         0xEA
+#define BAUD_CONFIRM        0xEB
+#define BAUD_REJECTED       0xEC
+#define REQUEST_PENDING     0xED
+#define REQUEST_REJECTED    0xEE
+#define GET_PROFILE         0xF5
+#define GET_TRACE           0xF6
 
-#define BUTTON_DEBOUNCE     250 /* Debounce delay in milliseconds */
+/*
+ * GET_PROFILE, GET_TRACE and GET_DIAG are only answered in a diagnostics
+ * build (-DDIAG_COMMANDS=1), any node may send them and the trace shows
+ * what the panel was used for.
+ */
+#ifndef DIAG_COMMANDS
+#define DIAG_COMMANDS       0
+#endif
+
+/* GET_DIAG payload byte of the one page a panel answers, as on CONTROL */
+#define DIAG_POWER          0x02
+
+/* Bus addresses, build every panel with its own PANEL_ADDRESS (-DPANEL_ADDRESS=3) */
+#define CONTROL_ADDRESS     0x01
+#ifndef PANEL_ADDRESS
+#define PANEL_ADDRESS       0x02
+#endif
 
-/* Convert milliseconds to timer ticks */
-#define MILLISECONDS_TO_TICKS(ms)  (((F_CPU / 1024) * (ms)) / 1000)
+/* Pseudo reply used when CONTROL did not answer at all */
+#define LINK_ERROR          0x00
+
+/* Time CONTROL keeps a new baud rate without a clean BAUD_CONFIRM */
+#define BAUD_CONFIRM_TIMEOUT_MS   100
+
+/* Protocol timeouts in milliseconds */
+#define REPLY_TIMEOUT_MS          500      /* Longest CONTROL takes to answer a request */
+#define REQUEST_RETRIES           3        /* Resends before the link is considered lost */
+#define READY_TIMEOUT_MS          1000     /* Wait for MC2_READY at power up */
+#define SPLASH_TIME_MS            3000     /* Splash screen at power up, the link is set up meanwhile */
+#define LOCK_DOOR_TIMEOUT_MS      120000UL /* Door cycle including people passing */
+
+/* Requests that may be outstanding at the same time */
+#define REQUEST_WINDOW_SIZE       3
+
+/*
+ * Extra wait before a panel resends, different for every panel so two panels
+ * whose frames collided on the bus do not collide again. Longer than one frame.
+ */
+#define BUS_BACKOFF_MS            (60UL * (PANEL_ADDRESS - CONTROL_ADDRESS))
+
+#define BUTTON_DEBOUNCE     250 /* Debounce delay in milliseconds */
 
 /* ---------------------- CONFIGURATIONS ---------------------- */
 
-/* UART configuration: 8-bit, no parity, 1 stop bit, 2400 baud */
-UART_ConfigType UART_CONFIG = {EIGHT_BITS, NO_PARITY, ONE_STOP_BIT, 2400};
+/* UART configuration: 9-bit for the multi-processor bus, no parity, 1 stop bit, 2400 baud */
+UART_ConfigType UART_CONFIG = {NINE_BITS, NO_PARITY, ONE_STOP_BIT, 2400};
 
-/* Timer configuration: 1-second delay using CTC mode */
-Timer_ConfigType TIMER1_CONFIG = {0, (uint16)(MILLISECONDS_TO_TICKS(1000)), TIMER_1, F_CPU_1024, CTC_MODE_OC_DISABLED};
+/* ---------------------- TYPES ---------------------- */
+
+typedef enum
+{
+	REQUEST_FREE,REQUEST_WAITING,REQUEST_DONE,REQUEST_FAILED
+}HMI_RequestStateType;
+
+/* One slot of the outstanding-request window */
+typedef struct {
+	FRAME_Type request;      /* kept for retransmission */
+	FRAME_Type reply;
+	uint32 sent_time;
+	uint32 timeout_ms;
+	uint8 retries;
+	uint8 accepted;          /* CONTROL answered REQUEST_PENDING, the final reply comes later */
+	HMI_RequestStateType state;
+}HMI_RequestType;
 
 /* ---------------------- GLOBAL VARIABLES ---------------------- */
 
-volatile uint8 received_key;
-static volatile uint8 time = 0;
+/* Set by the one-shot timer of HMI_delaySeconds */
+static volatile boolean delay_done = FALSE;
+
+static HMI_RequestType request_window[REQUEST_WINDOW_SIZE];
+
+/* Next sequence number, 0 is left for frames that answer no request */
+static uint8 next_sequence = 1;
+
+/* Last notification received from CONTROL ECU */
+static FRAME_Type last_notification;
 
 /* ---------------------- FUNCTION DEFINITIONS ---------------------- */
 
@@ -72,7 +143,7 @@ void HMI_enterPassword(uint8 * password)
 			LCD_displayCharacter('*');
 			digits++;
 		}
-		_delay_ms(BUTTON_DEBOUNCE);
+		POWER_sleepMs(BUTTON_DEBOUNCE);
 	}
 
 	/* Wait until ENTER key is pressed */
@@ -85,51 +156,525 @@ void HMI_enterPassword(uint8 * password)
 }
 
 /*
- * Timer callback to count seconds.
+ * One-shot timer callback of HMI_delaySeconds.
+ */
+void HMI_delayDone(void)
+{
+	delay_done = TRUE;
+}
+
+/*
+ * Find the window slot of an outstanding request by its sequence number.
+ */
+HMI_RequestType * HMI_findRequest(uint8 sequence)
+{
+	uint8 i;
+	for (i = 0; i < REQUEST_WINDOW_SIZE; i++)
+	{
+		if ((request_window[i].state != REQUEST_FREE) && (request_window[i].request.sequence == sequence))
+		{
+			return &request_window[i];
+		}
+	}
+	return NULL_PTR;
+}
+
+/*
+ * Send a request without waiting for its reply.
+ * Returns its sequence number, or FRAME_NO_SEQUENCE if the window is full.
+ */
+uint8 HMI_submit(uint8 command, const uint8 * payload, uint8 length)
+{
+	HMI_RequestType * slot = NULL_PTR;
+	uint8 i;
+
+	for (i = 0; (i < REQUEST_WINDOW_SIZE) && (slot == NULL_PTR); i++)
+	{
+		if (request_window[i].state == REQUEST_FREE)
+		{
+			slot = &request_window[i];
+		}
+	}
+
+	if (slot == NULL_PTR)
+	{
+		return FRAME_NO_SEQUENCE;
+	}
+
+	slot->request.address = CONTROL_ADDRESS;
+	slot->request.sequence = next_sequence;
+	slot->request.command = command;
+	slot->request.length = length;
+	for (i = 0; i < length; i++)
+	{
+		slot->request.payload[i] = payload[i];
+	}
+	slot->sent_time = Timer_now();
+	slot->timeout_ms = REPLY_TIMEOUT_MS;
+	slot->retries = 0;
+	slot->accepted = FALSE;
+	slot->state = REQUEST_WAITING;
+
+	next_sequence++;
+	if (next_sequence == FRAME_NO_SEQUENCE)
+	{
+		next_sequence = 1;
+	}
+
+	FRAME_send(CONTROL_ADDRESS, slot->request.sequence, command, payload, length);
+	return slot->request.sequence;
+}
+
+/*
+ * Send an outstanding request again, or give up on it once its retries are used.
  */
-void HMI_countSeconds(void)
+void HMI_retryRequest(HMI_RequestType * slot)
 {
-	time++;
+	if (slot->retries == REQUEST_RETRIES)
+	{
+		slot->state = REQUEST_FAILED;
+		return;
+	}
+
+	slot->retries++;
+	slot->sent_time = Timer_now();
+	slot->timeout_ms = REPLY_TIMEOUT_MS + BUS_BACKOFF_MS;
+	FRAME_resend(&slot->request);
 }
 
+#if (DIAG_COMMANDS != 0)
 /*
- * Blocking delay function in seconds using Timer1.
+ * Answer GET_DIAG from any node: with DIAG_POWER as payload the reply is the
+ * time spent awake and in IDLE since power up, in milliseconds, each one
+ * little-endian 32-bit. Other pages are CONTROL's, they are rejected.
+ */
+void HMI_sendDiagnostics(const FRAME_Type * request)
+{
+	POWER_StatsType power_stats;
+	uint8 payload[8];
+	uint8 i;
+
+	if ((request->length == 0) || (request->payload[0] != DIAG_POWER))
+	{
+		FRAME_send(request->address, request->sequence, REQUEST_REJECTED, NULL_PTR, 0);
+		return;
+	}
+
+	POWER_getStats(&power_stats);
+	for (i = 0; i < 4; i++)
+	{
+		payload[i] = (uint8)(power_stats.time_ms[POWER_ACTIVE] >> (8 * i));
+		payload[4 + i] = (uint8)(power_stats.time_ms[POWER_IDLE] >> (8 * i));
+	}
+	FRAME_send(request->address, request->sequence, GET_DIAG, payload, 8);
+}
+
+/*
+ * Answer GET_PROFILE from any node: the payload is a probe id, the reply is
+ * its entry of this panel's probe table, REQUEST_REJECTED for an unknown probe.
+ */
+void HMI_sendProfile(const FRAME_Type * request)
+{
+	uint8 payload[PROF_RECORD_BYTES];
+	uint8 length = 0;
+
+	if (request->length > 0)
+	{
+		length = PROF_encode(request->payload[0], payload);
+	}
+
+	if (length == 0)
+	{
+		FRAME_send(request->address, request->sequence, REQUEST_REJECTED, NULL_PTR, 0);
+	}
+	else
+	{
+		FRAME_send(request->address, request->sequence, GET_PROFILE, payload, length);
+	}
+}
+
+/*
+ * Answer GET_TRACE from any node: the payload is the offset of the first record
+ * wanted from the oldest one, the reply is the page TRACE_encode writes.
+ */
+void HMI_sendTrace(const FRAME_Type * request)
+{
+	uint8 payload[TRACE_PAGE_RECORDS * TRACE_RECORD_BYTES];
+	uint8 offset = (request->length > 0) ? request->payload[0] : 0;
+
+	FRAME_send(request->address, request->sequence, GET_TRACE, payload, TRACE_encode(offset, payload));
+}
+#endif
+
+/*
+ * Match received frames to the outstanding requests and resend the ones
+ * whose reply is late. Must be called while waiting on any request.
+ */
+void HMI_serviceLink(void)
+{
+	FRAME_Type frame;
+	FRAME_StatusType status;
+	HMI_RequestType * slot;
+	uint8 i;
+
+	status = FRAME_poll(&frame);
+
+	if ((status == FRAME_CORRUPTED) || ((status == FRAME_READY) && (frame.command == FRAME_NACK)))
+	{
+		/*
+		 * We cannot tell which frame was lost, resend everything still waiting
+		 * once this panel's backoff is over, the loop below does the resend.
+		 */
+		for (i = 0; i < REQUEST_WINDOW_SIZE; i++)
+		{
+			if (request_window[i].state == REQUEST_WAITING)
+			{
+				request_window[i].sent_time = Timer_now();
+				request_window[i].timeout_ms = BUS_BACKOFF_MS;
+			}
+		}
+	}
+#if (DIAG_COMMANDS != 0)
+	else if ((status == FRAME_READY) && (frame.command == GET_PROFILE))
+	{
+		HMI_sendProfile(&frame);
+	}
+	else if ((status == FRAME_READY) && (frame.command == GET_TRACE))
+	{
+		HMI_sendTrace(&frame);
+	}
+	else if ((status == FRAME_READY) && (frame.command == GET_DIAG))
+	{
+		HMI_sendDiagnostics(&frame);
+	}
+#else
+	else if ((status == FRAME_READY) &&
+			((frame.command == GET_PROFILE) || (frame.command == GET_TRACE) || (frame.command == GET_DIAG)))
+	{
+		FRAME_send(frame.address, frame.sequence, REQUEST_REJECTED, NULL_PTR, 0);
+	}
+#endif
+	else if ((status == FRAME_READY) && (frame.address == CONTROL_ADDRESS))
+	{
+		slot = HMI_findRequest(frame.sequence);
+
+		if (frame.sequence == FRAME_NO_SEQUENCE)
+		{
+			last_notification = frame;
+		}
+		else if ((slot == NULL_PTR) || (slot->state != REQUEST_WAITING))
+		{
+			/* Late duplicate of a reply we already have */
+		}
+		else if (frame.command == REQUEST_PENDING)
+		{
+			/* CONTROL is working on it, the final reply comes when the job is done */
+			slot->accepted = TRUE;
+			slot->sent_time = Timer_now();
+			slot->timeout_ms = LOCK_DOOR_TIMEOUT_MS;
+		}
+		else
+		{
+			slot->reply = frame;
+			slot->state = REQUEST_DONE;
+		}
+	}
+
+	for (i = 0; i < REQUEST_WINDOW_SIZE; i++)
+	{
+		slot = &request_window[i];
+		if ((slot->state == REQUEST_WAITING) && ((Timer_now() - slot->sent_time) >= slot->timeout_ms))
+		{
+			HMI_retryRequest(slot);
+		}
+	}
+}
+
+/*
+ * Sleep until the next interrupt while waiting on the link, unless received
+ * bytes are already waiting for HMI_serviceLink.
+ */
+void HMI_idle(void)
+{
+	if (UART_available() == 0)
+	{
+		POWER_idle();
+	}
+}
+
+/*
+ * Wait for the given number of seconds on a software timer of the system tick,
+ * the link is serviced meanwhile so replies and retransmissions are not held up.
  */
 void HMI_delaySeconds(uint8 seconds)
 {
-	time = 0;
-	Timer_setCallBack(HMI_countSeconds, TIMER_1);
-	Timer_init(&TIMER1_CONFIG);
-	while (time < seconds);
-	time = 0;
-	Timer_deInit(TIMER_1);
+	delay_done = FALSE;
+	if (Timer_startOneShot((uint32)seconds * 1000UL, HMI_delayDone) == TIMER_NO_HANDLE)
+	{
+		return;
+	}
+	while (delay_done == FALSE)
+	{
+		HMI_serviceLink();
+		HMI_idle();
+	}
 }
 
 /*
- * Send the password over UART byte by byte.
- * A specific command is sent first to indicate the context.
+ * Wait for the final reply of a submitted request and free its window slot.
+ * Returns FALSE if CONTROL still did not answer after REQUEST_RETRIES resends.
  */
-void HMI_sendPassword(uint8 * password, uint8 command)
+boolean HMI_waitReply(uint8 sequence, FRAME_Type * reply)
 {
-	UART_sendByte(command);
+	HMI_RequestType * slot = HMI_findRequest(sequence);
+
+	if ((slot == NULL_PTR) || (sequence == FRAME_NO_SEQUENCE))
+	{
+		return FALSE;
+	}
+
+	while (slot->state == REQUEST_WAITING)
+	{
+		HMI_serviceLink();
+		HMI_idle();
+	}
+
+	if (slot->state == REQUEST_FAILED)
+	{
+		slot->state = REQUEST_FREE;
+		return FALSE;
+	}
+
+	*reply = slot->reply;
+	slot->state = REQUEST_FREE;
+	return TRUE;
+}
+
+/*
+ * Send a request frame and wait for its reply frame.
+ */
+boolean HMI_exchange(uint8 command, const uint8 * payload, uint8 length, FRAME_Type * reply)
+{
+	return HMI_waitReply(HMI_submit(command, payload, length), reply);
+}
+
+/*
+ * Drop every outstanding request, used when the link is set up again.
+ */
+void HMI_resetWindow(void)
+{
+	uint8 i;
+	for (i = 0; i < REQUEST_WINDOW_SIZE; i++)
+	{
+		request_window[i].state = REQUEST_FREE;
+	}
+}
+
+/*
+ * Wait up to timeout_ms for a notification frame with the given command from CONTROL ECU
+ * and copy it to notification. Returns FALSE if it did not arrive in time.
+ */
+boolean HMI_waitFor(uint8 command, uint32 timeout_ms, FRAME_Type * notification)
+{
+	uint32 start = Timer_now();
+
+	last_notification.command = 0;
+	while ((Timer_now() - start) < timeout_ms)
+	{
+		HMI_serviceLink();
+		if (last_notification.command == command)
+		{
+			*notification = last_notification;
+			return TRUE;
+		}
+		HMI_idle();
+	}
+	return FALSE;
+}
+
+/*
+ * Step the link up from the start rate to the fastest rate of the baud table
+ * that both ECUs accept and that carries a confirmation without framing errors.
+ * BAUD_REJECTED is final: CONTROL serves several panels on one bus and keeps
+ * the start rate, a slower rate would be rejected as well.
+ */
+void HMI_negotiateBaudRate(void)
+{
+	UART_BaudRateType baud_rate = UART_getFastestBaudRate(0xFFFFFFFF);
+	uint8 payload[4];
+	uint16 framing_errors;
+	FRAME_Type reply;
+
+	while (baud_rate > UART_CONFIG.baud_rate)
+	{
+		payload[0] = (uint8)baud_rate;
+		payload[1] = (uint8)(baud_rate >> 8);
+		payload[2] = (uint8)(baud_rate >> 16);
+		payload[3] = (uint8)(baud_rate >> 24);
+
+		if (HMI_exchange(BAUD_CHANGE, payload, 4, &reply) == FALSE)
+		{
+			/* CONTROL falls back by itself if it switched and lost our confirmation */
+			POWER_sleepMs(2 * BAUD_CONFIRM_TIMEOUT_MS);
+			return;
+		}
+
+		if (reply.command == BAUD_REJECTED)
+		{
+			return;
+		}
+
+		if (reply.command == RECIEVED)
+		{
+			/* CONTROL switches as soon as its reply has left the wire */
+			UART_setBaudRate(baud_rate);
+			POWER_sleepMs(2);
+			framing_errors = UART_getFramingErrors();
+			FRAME_send(CONTROL_ADDRESS, reply.sequence, BAUD_CONFIRM, NULL_PTR, 0);
+
+			if ((FRAME_receiveTimeout(&reply, BAUD_CONFIRM_TIMEOUT_MS) == FRAME_READY) &&
+					(reply.command == RECIEVED) && (UART_getFramingErrors() == framing_errors))
+			{
+				return;
+			}
+
+			/* Not clean at this rate, CONTROL falls back once its timeout expires */
+			POWER_sleepMs(2 * BAUD_CONFIRM_TIMEOUT_MS);
+			UART_setBaudRate(UART_CONFIG.baud_rate);
+			HMI_resetWindow();
+		}
+
+		baud_rate = UART_getFastestBaudRate(baud_rate);
+	}
+}
+
+/*
+ * Pack the password for a frame, two digits per byte, low nibble first.
+ */
+void HMI_packPassword(const uint8 * password, uint8 * packed)
+{
+	uint8 digits = 0;
+	uint8 i;
+
+	for (i = 0; i < PASSWORD_PACKED_BYTES; i++)
+	{
+		packed[i] = 0;
+	}
 
-	volatile uint8 digits = 0;
 	while (digits < PASSWORD_DIGITS)
 	{
-		UART_sendByte(password[digits]);
-		while (UART_recieveByte() != NEXT_DIGIT);
+		packed[digits / 2] |= (uint8)(password[digits] << ((digits % 2) * 4));
 		digits++;
 	}
+}
+
+/*
+ * Send the password in one frame.
+ * A specific command is used to indicate the context, the reply command is returned,
+ * or LINK_ERROR if CONTROL did not answer.
+ */
+uint8 HMI_sendPassword(uint8 * password, uint8 command)
+{
+	uint8 packed[PASSWORD_PACKED_BYTES];
+	FRAME_Type reply;
+
+	HMI_packPassword(password, packed);
+
+	if (HMI_exchange(command, packed, PASSWORD_PACKED_BYTES, &reply) == FALSE)
+	{
+		return LINK_ERROR;
+	}
+
+	return reply.command;
+}
+
+/*
+ * Check the password and, when opening the door, queue UNLOCK_DOOR right behind it
+ * so CONTROL starts the motor as soon as the password matched.
+ * Returns the CHECK_PASS reply command or LINK_ERROR, unlock_sequence is the
+ * UNLOCK_DOOR request still waiting for its reply, FRAME_NO_SEQUENCE if none was sent.
+ */
+uint8 HMI_checkPassword(uint8 * password, uint8 open_door, uint8 * unlock_sequence)
+{
+	uint8 packed[PASSWORD_PACKED_BYTES];
+	uint8 check_sequence;
+	FRAME_Type reply;
+	FRAME_Type unlock_reply;
+	HMI_RequestType * unlock_slot;
+
+	HMI_packPassword(password, packed);
+
+	PROF_begin(PROF_CHECK_PASS);
+	check_sequence = HMI_submit(CHECK_PASS, packed, PASSWORD_PACKED_BYTES);
+	*unlock_sequence = FRAME_NO_SEQUENCE;
+	if (open_door == TRUE)
+	{
+		*unlock_sequence = HMI_submit(UNLOCK_DOOR, NULL_PTR, 0);
+	}
+
+	/* The probe is closed on both ends, a failed exchange is a round trip the user waited for too */
+	if (HMI_waitReply(check_sequence, &reply) == FALSE)
+	{
+		PROF_end(PROF_CHECK_PASS);
+		return LINK_ERROR;
+	}
+	PROF_end(PROF_CHECK_PASS);
+
+	unlock_slot = HMI_findRequest(*unlock_sequence);
+	if ((reply.command == PASS_MATCH) && (unlock_slot != NULL_PTR) && (unlock_slot->state == REQUEST_DONE))
+	{
+		/*
+		 * The unlock was answered before the password, so CONTROL rejected it
+		 * without an authorization: CHECK_PASS was lost and resent. The match
+		 * authorizes the next request of this panel, send the unlock again.
+		 */
+		unlock_slot->state = REQUEST_FREE;
+		*unlock_sequence = HMI_submit(UNLOCK_DOOR, NULL_PTR, 0);
+	}
+	else if ((reply.command != PASS_MATCH) && (*unlock_sequence != FRAME_NO_SEQUENCE))
+	{
+		/* CONTROL rejects the unlock, collect that reply to free its window slot */
+		HMI_waitReply(*unlock_sequence, &unlock_reply);
+		*unlock_sequence = FRAME_NO_SEQUENCE;
+	}
 
-	UART_sendByte(PASSWORD_SAVED);
+	return reply.command;
 }
 
 /*
- * Handle door unlocking process with user feedback.
+ * Handle door unlocking process with user feedback, the UNLOCK_DOOR request
+ * was already queued behind CHECK_PASS and is answered with LOCK_DOOR.
+ * Returns FALSE if the link to CONTROL was lost on the way.
  */
-void HMI_unlockDoor(void)
+boolean HMI_unlockDoor(uint8 unlock_sequence)
 {
-	UART_sendByte(UNLOCK_DOOR);
+	FRAME_Type reply;
+	HMI_RequestType * slot = HMI_findRequest(unlock_sequence);
+
+	if (slot == NULL_PTR)
+	{
+		return FALSE;
+	}
+
+	/* Wait until CONTROL accepted the unlock, another panel may be using the door */
+	while ((slot->state == REQUEST_WAITING) && (slot->accepted == FALSE))
+	{
+		HMI_serviceLink();
+		HMI_idle();
+	}
+
+	if (slot->state != REQUEST_WAITING)
+	{
+		if (HMI_waitReply(unlock_sequence, &reply) == FALSE)
+		{
+			return FALSE;
+		}
+
+		LCD_clearScreen();
+		LCD_displayString("DOOR BUSY");
+		POWER_sleepMs(1000);
+		return TRUE;
+	}
 
 	LCD_clearScreen();
 	LCD_displayString("DOOR IS");
@@ -143,7 +688,10 @@ void HMI_unlockDoor(void)
 	LCD_moveCursor(1, 4);
 	LCD_displayString("TO ENTER");
 
-	while (UART_recieveByte() != LOCK_DOOR);
+	if ((HMI_waitReply(unlock_sequence, &reply) == FALSE) || (reply.command != LOCK_DOOR))
+	{
+		return FALSE;
+	}
 
 	LCD_clearScreen();
 	LCD_displayString("DOOR IS");
@@ -151,6 +699,8 @@ void HMI_unlockDoor(void)
 	LCD_displayString("LOCKING");
 
 	HMI_delaySeconds(15);
+
+	return TRUE;
 }
 
 /* ---------------------- MAIN FUNCTION ---------------------- */
@@ -158,70 +708,125 @@ void HMI_unlockDoor(void)
 int main(void)
 {
 	volatile uint8 key;
-	volatile uint8 step;
+	volatile uint8 step = 0;
 	volatile uint8 system_status;
 	volatile uint8 pass_status = 0;
 	uint8 password[PASSWORD_DIGITS + 1];
-	uint8 attempts;
+	uint8 first_connection = TRUE;
+	uint8 status_known;
+	uint8 unlock_sequence;
+	uint32 splash_start = 0;
+	FRAME_Type reply;
 
 	Enable_Global_Interrupt();
 
+	Timer_startSystemTick();
+	POWER_init();
+	PROF_init();
 	UART_init(&UART_CONFIG);
+	FRAME_init(PANEL_ADDRESS);
 	LCD_init();
 
-	/* Wait for MC2 to be ready */
-	while (received_key != MC2_READY)
+	while (1)
 	{
-		received_key = UART_recieveByte();
-	}
+		LCD_clearScreen();
 
-	UART_sendByte(GET_STATUS);
+		switch (step)
+		{
+		case 0:
+			/* Connect at the start rate, also used to recover after the link was lost */
+			UART_setBaudRate(UART_CONFIG.baud_rate);
+			HMI_resetWindow();
+			status_known = FALSE;
 
-	system_status = UART_recieveByte();
+			if (first_connection == TRUE)
+			{
+				/* The splash screen stays up while the link is set up */
+				LCD_displayString("Door Lock System");
+				splash_start = Timer_now();
+
+				/*
+				 * Wait for MC2 to be ready, it may also have been up before us.
+				 * MC2_READY carries the GET_STATUS answer once CONTROL read its EEPROM.
+				 */
+				status_known = (HMI_waitFor(MC2_READY, READY_TIMEOUT_MS, &reply) == TRUE) && (reply.length >= 1);
+			}
 
-	/* Determine initial step based on whether password is already saved */
-	if (system_status != PASSWORD_SAVED)
-	{
-		step = 1;
-	}
-	else
-	{
-		step = 2;
-	}
+			if ((status_known == FALSE) && (HMI_exchange(GET_STATUS, NULL_PTR, 0, &reply) == FALSE))
+			{
+				LCD_clearScreen();
+				LCD_displayString("NO CONNECTION");
+				POWER_sleepMs(1000);
+				break;
+			}
 
-	LCD_displayString("Door Lock System");
-	_delay_ms(3000);
+			system_status = reply.payload[0];
+			HMI_negotiateBaudRate();
 
-	while (1)
-	{
-		attempts = 0;
-		LCD_clearScreen();
+			/* Determine next step based on whether password is already saved */
+			if (system_status != PASSWORD_SAVED)
+			{
+				step = 1;
+			}
+			else
+			{
+				step = 2;
+			}
+
+			if (first_connection == TRUE)
+			{
+				while ((Timer_now() - splash_start) < SPLASH_TIME_MS)
+				{
+					POWER_idle();
+				}
+				first_connection = FALSE;
+			}
+			break;
 
-		switch (step)
-		{
 		case 1:
 			/* Set a new password */
 			LCD_displayString("ENTER PASS: ");
 			HMI_enterPassword(password);
-			HMI_sendPassword(password, SET_NEW_PASS);
+			pass_status = HMI_sendPassword(password, SET_NEW_PASS);
+			if (pass_status == LINK_ERROR)
+			{
+				step = 0;
+				break;
+			}
+			else if (pass_status == REQUEST_REJECTED)
+			{
+				/* There is a password by now, CONTROL takes a new one only right after it matched */
+				system_status = PASSWORD_SAVED;
+				step = 4;
+				break;
+			}
 
 			LCD_displayString("RE-ENTER PASS: ");
 			HMI_enterPassword(password);
-			HMI_sendPassword(password, CONFIRM_PASS);
-
-			pass_status = UART_recieveByte();
+			pass_status = HMI_sendPassword(password, CONFIRM_PASS);
 
 			if (pass_status == PASS_MATCH)
 			{
 				LCD_displayString("PASS MATCH");
+				system_status = PASSWORD_SAVED;
 				step = 2;
 			}
+			else if (pass_status == LINK_ERROR)
+			{
+				LCD_displayString("NO CONNECTION");
+				step = 0;
+			}
 			else
 			{
+				/* The match that allowed a change is used up, the old password is asked again */
 				LCD_displayString("PASS DONT MATCH");
+				if (system_status == PASSWORD_SAVED)
+				{
+					step = 4;
+				}
 			}
 
-			_delay_ms(1000);
+			POWER_sleepMs(1000);
 			break;
 
 		case 2:
@@ -247,60 +852,66 @@ int main(void)
 
 		case 3:
 		case 4:
-			/* Verify password before proceeding */
+			/* Verify password before proceeding, CONTROL counts the attempts of this panel */
 			pass_status = 0;
 
 			while (pass_status != PASS_MATCH)
 			{
-				if (attempts == 3)
-				{
-					step = 5;
-					break;
-				}
-
 				LCD_displayString("ENTER PASS: ");
 				HMI_enterPassword(password);
-				HMI_sendPassword(password, CHECK_PASS);
-
-				pass_status = UART_recieveByte();
+				pass_status = HMI_checkPassword(password, (step == 3), &unlock_sequence);
 
 				if (pass_status == PASS_MATCH)
 				{
-					attempts = 0;
 					LCD_displayString("PASS MATCH");
-					_delay_ms(1000);
+					POWER_sleepMs(1000);
 
 					if (step == 3)
 					{
-						HMI_unlockDoor();
-						step = 2;
+						if (HMI_unlockDoor(unlock_sequence) == TRUE)
+						{
+							step = 2;
+						}
+						else
+						{
+							step = 0;
+						}
 					}
 					else if (step == 4)
 					{
 						step = 1;
 					}
 				}
+				else if (pass_status == LINK_ERROR)
+				{
+					LCD_displayString("NO CONNECTION");
+					POWER_sleepMs(1000);
+					step = 0;
+					break;
+				}
+				else if (pass_status == ATTEMPTS_ENDED)
+				{
+					step = 5;
+					break;
+				}
 				else
 				{
-					attempts++;
 					LCD_displayString("PASS DONT MATCH");
-					_delay_ms(1000);
+					POWER_sleepMs(1000);
 					LCD_clearScreen();
 				}
 			}
 			break;
 
 		case 5:
-			/* Lock the system after 3 failed attempts */
-			UART_sendByte(ATTEMPTS_ENDED);
+			/* CONTROL locked this panel out after 3 failed attempts and sounds the buzzer */
+			step = 2;
 
 			LCD_displayString("SYSTEM LOCKED");
 			LCD_moveCursor(1, 0);
 			LCD_displayString("WAIT FOR 1 MIN");
 
 			HMI_delaySeconds(60);
-
-			step = 2;
 			break;
 		}
 	}
@@ -0,0 +1,49 @@
+ /******************************************************************************
+ *
+ * Module: CRC-8
+ *
+ * File Name: crc8.c
+ *
+ * Description: Source file for the CRC-8 of the frames and the EEPROM records
+ *
+ * Author: Malik Anas
+ *
+ *******************************************************************************/
+
+#include "crc8.h"
+
+/*******************************************************************************
+ *                      Functions Definitions                                  *
+ *******************************************************************************/
+
+uint8 CRC8_update(uint8 crc, uint8 data)
+{
+	uint8 bit;
+
+	crc ^= data;
+	for(bit = 0; bit < 8; bit++)
+	{
+		if(crc & 0x80)
+		{
+			crc = (uint8)((crc << 1) ^ CRC8_POLYNOMIAL);
+		}
+		else
+		{
+			crc = (uint8)(crc << 1);
+		}
+	}
+	return crc;
+}
+
+uint8 CRC8_compute(const uint8 *data, uint8 length)
+{
+	uint8 crc = CRC8_INITIAL;
+
+	while(length > 0)
+	{
+		crc = CRC8_update(crc, *data);
+		data++;
+		length--;
+	}
+	return crc;
+}
@@ -11,7 +11,9 @@
  *******************************************************************************/
 #include "keypad.h"
 #include "gpio.h"
-#include <util/delay.h>
+#include "power.h"
+#include "profile.h"
+#include "trace.h"
 
 /*******************************************************************************
  *                      Functions Prototypes(Private)                          *
@@ -38,6 +40,7 @@ static uint8 KEYPAD_4x4_adjustKeyNumber(uint8 button_number);
 uint8 KEYPAD_getPressedKey(void)
 {
 	uint8 col,row;
+	uint8 key;
 	GPIO_setupPinDirection(KEYPAD_ROW_PORT_ID, KEYPAD_FIRST_ROW_PIN_ID, PIN_INPUT);
 	GPIO_setupPinDirection(KEYPAD_ROW_PORT_ID, KEYPAD_FIRST_ROW_PIN_ID+1, PIN_INPUT);
 	GPIO_setupPinDirection(KEYPAD_ROW_PORT_ID, KEYPAD_FIRST_ROW_PIN_ID+2, PIN_INPUT);
@@ -53,6 +56,8 @@ uint8 KEYPAD_getPressedKey(void)
 	{
 		for(row=0 ; row<KEYPAD_NUM_ROWS ; row++) /* loop for rows */
 		{
+			PROF_begin(PROF_KEYPAD_ROW);
+
 			/* 
 			 * Each time setup the direction for all keypad port as input pins,
 			 * except this row will be output pin
@@ -68,14 +73,18 @@ uint8 KEYPAD_getPressedKey(void)
 				if(GPIO_readPin(KEYPAD_COL_PORT_ID,KEYPAD_FIRST_COL_PIN_ID+col) == KEYPAD_BUTTON_PRESSED)
 				{
 					#if (KEYPAD_NUM_COLS == 3)
-						return KEYPAD_4x3_adjustKeyNumber((row*KEYPAD_NUM_COLS)+col+1);
+						key = KEYPAD_4x3_adjustKeyNumber((row*KEYPAD_NUM_COLS)+col+1);
 					#elif (KEYPAD_NUM_COLS == 4)
-						return KEYPAD_4x4_adjustKeyNumber((row*KEYPAD_NUM_COLS)+col+1);
+						key = KEYPAD_4x4_adjustKeyNumber((row*KEYPAD_NUM_COLS)+col+1);
 					#endif
+					/* Digits are recorded without their value, they may be a password */
+					TRACE_record(TRACE_KEY, (key <= 9) ? TRACE_KEY_DIGIT : key);
+					return key;
 				}
 			}
 			GPIO_setupPinDirection(KEYPAD_ROW_PORT_ID,KEYPAD_FIRST_ROW_PIN_ID+row,PIN_INPUT);
-			_delay_ms(10); /* Add small delay to fix CPU load issue in proteus */
+			PROF_end(PROF_KEYPAD_ROW);
+			POWER_sleepMs(10); /* Sleep between rows, also fixes the CPU load issue in proteus */
 		}
 	}	
 }
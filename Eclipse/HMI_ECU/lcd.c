@@ -14,6 +14,7 @@
 #include "common_macros.h" /* For GET_BIT Macro */
 #include "lcd.h"
 #include "gpio.h"
+#include "profile.h"
 #include <stdlib.h>
 
 /*******************************************************************************
@@ -107,6 +108,7 @@ void LCD_sendCommand(uint8 command)
  */
 void LCD_displayCharacter(uint8 data)
 {
+	PROF_begin(PROF_LCD_CHARACTER);
 	GPIO_writePin(LCD_RS_PORT_ID,LCD_RS_PIN_ID,LOGIC_HIGH); /* Data Mode RS=1 */
 	_delay_ms(1); /* delay for processing Tas = 50ns */
 	GPIO_writePin(LCD_E_PORT_ID,LCD_E_PIN_ID,LOGIC_HIGH); /* Enable LCD E=1 */
@@ -139,6 +141,7 @@ void LCD_displayCharacter(uint8 data)
 	GPIO_writePin(LCD_E_PORT_ID,LCD_E_PIN_ID,LOGIC_LOW); /* Disable LCD E=0 */
 	_delay_ms(1); /* delay for processing Th = 13ns */
 #endif
+	PROF_end(PROF_LCD_CHARACTER);
 }
 
 /*
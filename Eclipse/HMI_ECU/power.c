@@ -0,0 +1,75 @@
+ /******************************************************************************
+ *
+ * Module: Power
+ *
+ * File Name: power.c
+ *
+ * Description: Source file for the sleep mode idle path and its time counters
+ *
+ * Author: Malik Anas
+ *
+ *******************************************************************************/
+
+#include "power.h"
+#include "timer.h"
+#include "common_macros.h"
+#include <avr/io.h>
+#include <avr/sleep.h>
+
+/*******************************************************************************
+ *                           Global Variables                                  *
+ *******************************************************************************/
+
+/*
+ * Tick count at POWER_init and the ticks that came while the CPU was in IDLE,
+ * the tick that wakes it still counts as IDLE. Only the main loop sleeps.
+ */
+static uint32 g_startTime = 0;
+static uint32 g_idleTime = 0;
+
+/*******************************************************************************
+ *                      Functions Definitions                                  *
+ *******************************************************************************/
+
+void POWER_init(void)
+{
+	/* Counted around every sleep, so the tick needs no software timer for it */
+	g_startTime = Timer_now();
+	g_idleTime = 0;
+}
+
+void POWER_idle(void)
+{
+	uint32 start;
+
+	/* With the global interrupt disabled nothing would wake the CPU up */
+	if(BIT_IS_CLEAR(SREG,7))
+	{
+		return;
+	}
+
+	/* SM2:0 = 000 selects IDLE, the CPU clock stops and every peripheral keeps running */
+	MCUCR &= (uint8)~((1<<SM2) | (1<<SM1) | (1<<SM0));
+
+	start = Timer_now();
+	SET_BIT(MCUCR,SE);
+	sleep_cpu();
+	CLEAR_BIT(MCUCR,SE);
+	g_idleTime += Timer_now() - start;
+}
+
+void POWER_sleepMs(uint32 ms)
+{
+	uint32 start = Timer_now();
+
+	while((Timer_now() - start) < ms)
+	{
+		POWER_idle();
+	}
+}
+
+void POWER_getStats(POWER_StatsType *stats)
+{
+	stats->time_ms[POWER_IDLE] = g_idleTime;
+	stats->time_ms[POWER_ACTIVE] = Timer_now() - g_startTime - g_idleTime;
+}
@@ -0,0 +1,171 @@
+ /******************************************************************************
+ *
+ * Module: Profile
+ *
+ * File Name: profile.c
+ *
+ * Description: Source file for the cycle counting hot path probes on Timer1
+ *
+ * Author: Malik Anas
+ *
+ *******************************************************************************/
+
+#include "profile.h"
+#include "timer.h"
+#include "common_macros.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+/*******************************************************************************
+ *                           Global Variables                                  *
+ *******************************************************************************/
+
+/* Timer1 counts every CPU cycle and overflows every 65536 of them */
+static const Timer_ConfigType g_profileTimerConfig = TIMER_CONFIG(TIMER_1, F_CPU_CLOCK, NORMAL_MODE, 0, 0);
+
+/* High 16 bits of the cycle counter */
+static volatile uint16 g_overflows = 0;
+
+static uint32 g_start[PROF_PROBES];
+
+/* Sum and samples behind the mean, both halved before the sum overflows */
+static uint32 g_total[PROF_PROBES];
+static uint16 g_samples[PROF_PROBES];
+
+static PROF_StatsType g_stats[PROF_PROBES];
+
+/*******************************************************************************
+ *                      Functions Definitions                                  *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Timer1 overflow callback, carries into the high 16 bits.
+ */
+static void PROF_overflow(void)
+{
+	g_overflows++;
+}
+
+void PROF_init(void)
+{
+	uint8 id;
+
+	for(id = 0; id < PROF_PROBES; id++)
+	{
+		g_stats[id].min_cycles = 0xFFFFFFFF;
+	}
+
+	Timer_setCallBack(PROF_overflow, TIMER_1);
+	Timer_init(&g_profileTimerConfig);
+}
+
+uint32 PROF_now(void)
+{
+	uint8 sreg = SREG;
+	uint16 low;
+	uint16 high;
+
+	cli();
+	low = TCNT1;
+	high = g_overflows;
+
+	/*
+	 * Timer1 wrapped but its interrupt has not run yet, either inside a disabled
+	 * section or between the wrap and this read. A low count says the read came
+	 * after the wrap, a high one that it came just before.
+	 */
+	if(BIT_IS_SET(TIFR,TOV1) && (low < 0x8000))
+	{
+		high++;
+	}
+	SREG = sreg;
+
+	return ((uint32)high << 16) | low;
+}
+
+void PROF_begin(uint8 id)
+{
+	if(id < PROF_PROBES)
+	{
+		g_start[id] = PROF_now();
+	}
+}
+
+void PROF_end(uint8 id)
+{
+	uint32 cycles;
+
+	if(id >= PROF_PROBES)
+	{
+		return;
+	}
+
+	cycles = PROF_now() - g_start[id];
+
+	if((g_total[id] + cycles < g_total[id]) || (g_samples[id] == 0xFFFF))
+	{
+		g_total[id] /= 2;
+		g_samples[id] /= 2;
+	}
+	g_total[id] += cycles;
+	g_samples[id]++;
+
+	g_stats[id].count++;
+	if(cycles < g_stats[id].min_cycles)
+	{
+		g_stats[id].min_cycles = cycles;
+	}
+	if(cycles > g_stats[id].max_cycles)
+	{
+		g_stats[id].max_cycles = cycles;
+	}
+	g_stats[id].mean_cycles = g_total[id] / g_samples[id];
+}
+
+boolean PROF_getStats(uint8 id, PROF_StatsType *stats)
+{
+	if(id >= PROF_PROBES)
+	{
+		return FALSE;
+	}
+
+	*stats = g_stats[id];
+	if(stats->count == 0)
+	{
+		stats->min_cycles = 0;
+	}
+	return TRUE;
+}
+
+/*
+ * Description :
+ * Write a 32-bit value little-endian.
+ */
+static void PROF_put32(uint8 *payload, uint32 value)
+{
+	uint8 i;
+
+	for(i = 0; i < 4; i++)
+	{
+		payload[i] = (uint8)(value >> (8 * i));
+	}
+}
+
+uint8 PROF_encode(uint8 id, uint8 *payload)
+{
+	PROF_StatsType stats;
+
+	if(PROF_getStats(id, &stats) == FALSE)
+	{
+		return 0;
+	}
+
+	payload[0] = id;
+	payload[1] = (uint8)stats.count;
+	payload[2] = (uint8)(stats.count >> 8);
+	PROF_put32(&payload[3], stats.min_cycles);
+	PROF_put32(&payload[7], stats.max_cycles);
+	PROF_put32(&payload[11], stats.mean_cycles);
+	return PROF_RECORD_BYTES;
+}
@@ -0,0 +1,88 @@
+ /******************************************************************************
+ *
+ * Module: Profile
+ *
+ * File Name: profile.h
+ *
+ * Description: Header file for the cycle counting hot path probes on Timer1
+ *
+ * Author: Malik Anas
+ *
+ *******************************************************************************/
+
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include "std_types.h"
+
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+/* Probes, the same ids on both ECUs, each ECU only fills the ones it runs */
+#define PROF_LCD_CHARACTER     0     /* HMI: one character written to the LCD */
+#define PROF_KEYPAD_ROW        1     /* HMI: one keypad row scanned with no key pressed */
+#define PROF_CHECK_PASS        2     /* HMI: CHECK_PASS sent until its reply is received */
+#define PROF_EEPROM_READ       3     /* CONTROL: one EEPROM block read, from submit to done */
+#define PROF_REQUEST           4     /* CONTROL: handling of one request frame */
+#define PROF_PROBES            5
+
+/* Length of a GET_PROFILE answer: id, count(2), min, max and mean (4 each) */
+#define PROF_RECORD_BYTES      15
+
+/*******************************************************************************
+ *                               Types Declaration                             *
+ *******************************************************************************/
+
+/* Duration of one probe in CPU cycles, 1/F_CPU seconds each */
+typedef struct {
+	uint16 count;           /* wraps around */
+	uint32 min_cycles;
+	uint32 max_cycles;
+	uint32 mean_cycles;
+}PROF_StatsType;
+
+/*******************************************************************************
+ *                      Functions Prototypes                                   *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Run Timer1 free at F_CPU as the cycle counter. Timer1 is owned by the
+ * probes afterwards, and interrupts must be enabled for its overflows.
+ */
+void PROF_init(void);
+
+/*
+ * Description :
+ * Return the CPU cycles since PROF_init, Timer1 extended with its overflow
+ * count, wraps after ~9 minutes at 8 MHz. Subtract two readings for a duration.
+ */
+uint32 PROF_now(void);
+
+/*
+ * Description :
+ * Start a probe. Call it from the main loop only, a probe is not reentrant.
+ */
+void PROF_begin(uint8 id);
+
+/*
+ * Description :
+ * End a probe started by PROF_begin and add its duration to the probe table.
+ */
+void PROF_end(uint8 id);
+
+/*
+ * Description :
+ * Copy the table entry of a probe, FALSE for an unknown probe.
+ */
+boolean PROF_getStats(uint8 id, PROF_StatsType *stats);
+
+/*
+ * Description :
+ * Write the GET_PROFILE answer of a probe: id, count, min, max and mean
+ * cycles, little-endian. Returns PROF_RECORD_BYTES, or 0 for an unknown probe.
+ */
+uint8 PROF_encode(uint8 id, uint8 *payload);
+
+#endif /* PROFILE_H_ */
@@ -9,6 +9,7 @@
 #define TIMER_H_
 
 #include "std_types.h"
+#include <avr/io.h>
 
 typedef enum
 {
@@ -20,22 +21,121 @@ typedef enum
 	NO_CLOCK,F_CPU_CLOCK,F_CPU_8,F_CPU_64,F_CPU_256,F_CPU_1024,EXT_CLOCK_FALLING,EXT_CLOCK_RISING,
 	TIMER2_F_CPU_32, TIMER2_F_CPU_128
 }Timer_ClockType;
+
 typedef enum
 {
   NORMAL_MODE,
   CTC_MODE_OC_DISABLED=8,CTC_MODE_OC_TOGGLE,CTC_MODE_OC_CLEAR,CTC_MODE_OC_SET,
 }Timer_ModeType;
+
+/*
+ * Register images of a timer configuration, Timer_init only stores them.
+ * Build them with TIMER_CONFIG, which works them out at compile time.
+ */
 typedef struct
 {
-uint16 timer_InitialValue;
-uint16 timer_compare_MatchValue; /*it will be used in compare mode only*/
 Timer_ID_Type timer_ID;
-Timer_ClockType timer_clock;
-Timer_ModeType timer_mode;
+uint8 control;            /* TCCR0, TCCR1B or TCCR2 */
+uint8 control_a;          /* TCCR1A, Timer1 only */
+uint8 interrupt_mask;     /* TIMSK bit of the overflow or compare interrupt */
+uint16 initial_value;     /* TCNT */
+uint16 compare_value;     /* OCR0, OCR1A or OCR2, it will be used in compare mode only */
 }Timer_ConfigType;
 
+/* Clock select bits, Timer2 has its own prescaler table with /32 and /128 and no external clock */
+#define TIMER_CLOCK_BITS(id, clock) \
+	(((id) != TIMER_2) ? ((clock) & 0x07) : \
+	 ((clock) == F_CPU_CLOCK) ? 0x01 : ((clock) == F_CPU_8) ? 0x02 : ((clock) == TIMER2_F_CPU_32) ? 0x03 : \
+	 ((clock) == F_CPU_64) ? 0x04 : ((clock) == TIMER2_F_CPU_128) ? 0x05 : ((clock) == F_CPU_256) ? 0x06 : \
+	 ((clock) == F_CPU_1024) ? 0x07 : 0x00)
+
+/* TCCR0, TCCR1B or TCCR2: waveform, compare output and clock bits, TCCR1A keeps Timer1's compare output */
+#define TIMER_CONTROL(id, clock, mode) \
+	(((id) == TIMER_0) ? ((1<<FOC0) | ((((mode) & 0x08) >> 3) << WGM01) | (((mode) & 0x03) << COM00) | TIMER_CLOCK_BITS(id, clock)) : \
+	 ((id) == TIMER_1) ? ((((mode) & 0x08) >> 3) << WGM12) | TIMER_CLOCK_BITS(id, clock) : \
+	 ((1<<FOC2) | ((((mode) & 0x08) >> 3) << WGM21) | (((mode) & 0x03) << COM20) | TIMER_CLOCK_BITS(id, clock)))
+#define TIMER_CONTROL_A(id, mode) \
+	(((id) == TIMER_1) ? ((1<<FOC1A) | (((mode) & 0x03) << COM1A0)) : 0)
+
+/* The compare interrupt in compare mode, the overflow interrupt otherwise */
+#define TIMER_INTERRUPT_MASK(id, mode) \
+	(((id) == TIMER_0) ? (((mode) != NORMAL_MODE) ? (1<<OCIE0) : (1<<TOIE0)) : \
+	 ((id) == TIMER_1) ? (((mode) != NORMAL_MODE) ? (1<<OCIE1A) : (1<<TOIE1)) : \
+	 (((mode) != NORMAL_MODE) ? (1<<OCIE2) : (1<<TOIE2)))
+
+/*
+ * 0, or a compile error for what TIMER_CONFIG would get wrong: a prescaler the
+ * timer does not have, values too wide for the 8-bit timers and an unknown mode.
+ * The checks are members of a struct in sizeof, so they are part of the expression.
+ */
+#define TIMER_CONFIG_CHECK(id, clock, mode, initial_value, compare_value) \
+	(0 * sizeof(struct { \
+		_Static_assert(((id) == TIMER_2) ? (((clock) == NO_CLOCK) || (TIMER_CLOCK_BITS(id, clock) != 0)) : \
+				((clock) <= EXT_CLOCK_RISING), "prescaler not available on this timer"); \
+		_Static_assert(((id) == TIMER_1) || (((initial_value) <= 0xFF) && ((compare_value) <= 0xFF)), \
+				"value does not fit an 8-bit timer"); \
+		_Static_assert(((mode) == NORMAL_MODE) || (((mode) >= CTC_MODE_OC_DISABLED) && ((mode) <= CTC_MODE_OC_SET)), \
+				"unknown timer mode"); \
+		char checked; }))
+
+/* Initializer of a Timer_ConfigType, every argument must be a constant and an invalid one does not compile */
+#define TIMER_CONFIG(id, clock, mode, initial_value, compare_value) \
+	{(Timer_ID_Type)((id) + TIMER_CONFIG_CHECK(id, clock, mode, initial_value, compare_value)), \
+	 TIMER_CONTROL(id, clock, mode), TIMER_CONTROL_A(id, mode), TIMER_INTERRUPT_MASK(id, mode), \
+	 (initial_value), (compare_value)}
+
+/* The system tick runs Timer2 in CTC mode with F_CPU/64 and fires every millisecond */
+#define SYSTEM_TICK_COMPARE_VALUE    ((F_CPU / 64UL / 1000UL) - 1UL)
+
+#if (SYSTEM_TICK_COMPARE_VALUE > 255UL) || (SYSTEM_TICK_COMPARE_VALUE < 1UL)
+#error "F_CPU can not produce a 1 ms system tick on Timer2 with F_CPU/64"
+#endif
+
+/* Software timers that can run at the same time on the system tick */
+#define TIMER_SOFT_TIMERS            8
+
+/* Returned by Timer_startOneShot and Timer_startPeriodic when every software timer is in use */
+#define TIMER_NO_HANDLE              0xFF
+
+/* Software timer started on the system tick */
+typedef uint8 Timer_HandleType;
+
+/*
+ * Start a timer with a configuration from TIMER_CONFIG, a few register stores.
+ */
 void Timer_init(const Timer_ConfigType * Config_Ptr);
 void Timer_deInit(Timer_ID_Type timer_type);
 void Timer_setCallBack(void(*a_ptr)(void), Timer_ID_Type a_timer_ID );
 
+/*
+ * Start the free running millisecond system tick on Timer2.
+ * Timer2 is owned by the tick afterwards, and interrupts must be enabled.
+ */
+void Timer_startSystemTick(void);
+
+/*
+ * Return the milliseconds elapsed since Timer_startSystemTick, wraps after ~49 days.
+ * Compare times with (Timer_now() - start) so the wrap does not matter.
+ */
+uint32 Timer_now(void);
+
+/*
+ * Call the callback once, delay_ms milliseconds from now.
+ * Callbacks run inside the tick interrupt, keep them short, like setting a flag.
+ * Returns the handle of the timer, or TIMER_NO_HANDLE if all TIMER_SOFT_TIMERS are running.
+ */
+Timer_HandleType Timer_startOneShot(uint32 delay_ms, void (*callback)(void));
+
+/*
+ * Call the callback every period_ms milliseconds until the timer is stopped.
+ */
+Timer_HandleType Timer_startPeriodic(uint32 period_ms, void (*callback)(void));
+
+/*
+ * Stop a software timer, its callback is not called anymore.
+ * A one-shot is stopped once it fired and its handle goes to the next timer
+ * started, so only stop a one-shot that has not fired yet.
+ */
+void Timer_stop(Timer_HandleType handle);
+
 #endif /* TIMER_H_ */
@@ -0,0 +1,114 @@
+ /******************************************************************************
+ *
+ * Module: Trace
+ *
+ * File Name: trace.c
+ *
+ * Description: Source file for the in-RAM event trace of the drivers
+ *
+ * Author: Malik Anas
+ *
+ *******************************************************************************/
+
+#include "trace.h"
+
+#if (TRACE_ENABLE != 0)
+
+#include "timer.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+/*******************************************************************************
+ *                           Global Variables                                  *
+ *******************************************************************************/
+
+static volatile uint8 g_records[TRACE_RECORDS][TRACE_RECORD_BYTES];
+
+/* Next record written, and how many of the ring are filled */
+static volatile uint8 g_head = 0;
+static volatile uint8 g_count = 0;
+
+static volatile boolean g_paused = FALSE;
+
+/* Time of the last page of the dump in progress */
+static volatile uint32 g_pageTime = 0;
+
+/*******************************************************************************
+ *                      Functions Definitions                                  *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Store a record, with the interrupts already disabled.
+ */
+static void TRACE_store(uint8 event, uint8 data)
+{
+	uint16 time = (uint16)Timer_now();
+
+	g_records[g_head][0] = (uint8)time;
+	g_records[g_head][1] = (uint8)(time >> 8);
+	g_records[g_head][2] = event;
+	g_records[g_head][3] = data;
+	g_head = (uint8)((g_head + 1) & (TRACE_RECORDS - 1));
+	if(g_count < TRACE_RECORDS)
+	{
+		g_count++;
+	}
+}
+
+void TRACE_record(uint8 event, uint8 data)
+{
+	uint8 sreg = SREG;
+
+	cli();
+	if((g_paused == TRUE) && ((Timer_now() - g_pageTime) >= TRACE_DUMP_TIMEOUT_MS))
+	{
+		/* The reader is gone, the dump would otherwise stay paused until reset */
+		g_paused = FALSE;
+		TRACE_store(TRACE_DUMP_ABANDONED, 0);
+	}
+	if(g_paused == FALSE)
+	{
+		TRACE_store(event, data);
+	}
+	SREG = sreg;
+}
+
+uint8 TRACE_encode(uint8 offset, uint8 *payload)
+{
+	uint8 sreg = SREG;
+	uint8 oldest;
+	uint8 records = 0;
+	uint8 i;
+
+	cli();
+	if(offset == 0)
+	{
+		g_paused = FALSE;
+		TRACE_store(TRACE_DUMP, 0);
+		g_paused = TRUE;
+	}
+	g_pageTime = Timer_now();
+
+	oldest = (uint8)((g_head - g_count) & (TRACE_RECORDS - 1));
+	/* In 16 bits, an offset near 255 must not wrap around to the oldest records */
+	while((records < TRACE_PAGE_RECORDS) && (((uint16)offset + records) < g_count))
+	{
+		for(i = 0; i < TRACE_RECORD_BYTES; i++)
+		{
+			payload[records * TRACE_RECORD_BYTES + i] =
+					g_records[(oldest + offset + records) & (TRACE_RECORDS - 1)][i];
+		}
+		records++;
+	}
+
+	if(records < TRACE_PAGE_RECORDS)
+	{
+		g_paused = FALSE;
+	}
+	SREG = sreg;
+
+	return (uint8)(records * TRACE_RECORD_BYTES);
+}
+
+#endif
@@ -11,10 +11,162 @@
  *******************************************************************************/
 
 #include "uart.h"
+#include "timer.h" /* For the system tick used by the receive timeout */
+#include "power.h" /* To sleep while waiting on the UART interrupts */
+#include "trace.h" /* To record receive errors and baud rate changes */
 #include "avr/io.h" /* To use the UART Registers */
 #include <avr/interrupt.h>
 #include "common_macros.h" /* To use the macros like SET_BIT */
 
+/*******************************************************************************
+ *                               Types Declaration                             *
+ *******************************************************************************/
+
+typedef struct {
+	UART_BaudRateType baud_rate;
+	uint16 ubrr_value;
+	boolean usable;
+}UART_BaudEntryType;
+
+/*******************************************************************************
+ *                           Global Variables                                  *
+ *******************************************************************************/
+
+/* Baud rates the link can be switched to, from slowest to fastest, resolved at compile time */
+#define UART_BAUD_ENTRY(baud)    {(baud), (uint16)UART_UBRR_VALUE(baud), (UART_BAUD_ERROR(baud) <= UART_BAUD_ERROR_TOLERANCE)}
+
+static const UART_BaudEntryType g_baudTable[] = {
+	UART_BAUD_ENTRY(2400UL),
+	UART_BAUD_ENTRY(4800UL),
+	UART_BAUD_ENTRY(9600UL),
+	UART_BAUD_ENTRY(14400UL),
+	UART_BAUD_ENTRY(19200UL),
+	UART_BAUD_ENTRY(28800UL),
+	UART_BAUD_ENTRY(38400UL),
+	UART_BAUD_ENTRY(57600UL),
+	UART_BAUD_ENTRY(76800UL),
+	UART_BAUD_ENTRY(115200UL)
+};
+
+#define UART_BAUD_TABLE_SIZE     (sizeof(g_baudTable) / sizeof(g_baudTable[0]))
+
+#if (UART_BAUD_ERROR(2400UL) > UART_BAUD_ERROR_TOLERANCE)
+#error "F_CPU can not produce the 2400 baud start rate within UART_BAUD_ERROR_TOLERANCE"
+#endif
+
+/* Receive ring buffer, the RXC ISR writes at the head and the application reads at the tail */
+static volatile uint8 g_rxBuffer[UART_RX_BUFFER_SIZE];
+static volatile uint8 g_rxHead = 0;
+static volatile uint8 g_rxTail = 0;
+
+/* Transmit FIFO, the application writes at the head and the UDRE ISR sends from the tail */
+static volatile uint8 g_txBuffer[UART_TX_BUFFER_SIZE];
+static volatile uint8 g_txHead = 0;
+static volatile uint8 g_txTail = 0;
+
+/* 9th bit of every transmit FIFO entry, one bit per entry, set for address bytes */
+static volatile uint8 g_txNinthBit[UART_TX_BUFFER_SIZE / 8];
+
+/* Own node address in multi-processor communication mode */
+static volatile uint8 g_address = UART_BROADCAST_ADDRESS;
+static volatile boolean g_multiprocessor = FALSE;
+
+/* Set when a byte went to UDR, cleared once UART_flushTx saw it leave the shift register */
+static volatile boolean g_txStarted = FALSE;
+
+static volatile UART_StatsType g_stats = {0};
+
+/* Called by the RXC ISR for every byte it buffered */
+static void (*volatile g_receiveCallBackPtr)(void) = NULL_PTR;
+
+/*******************************************************************************
+ *                       Interrupt Service Routines                            *
+ *******************************************************************************/
+
+ISR(USART_RXC_vect)
+{
+	/* The error flags and RXB8 belong to the byte in UDR, so read them before UDR clears RXC */
+	uint8 status = UCSRA;
+	uint8 ninth_bit = UCSRB & (1<<RXB8);
+	uint8 data = UDR;
+	uint8 next = (uint8)((g_rxHead + 1) & (UART_RX_BUFFER_SIZE - 1));
+
+	g_stats.bytes_in++;
+	if(status & (1<<FE))
+	{
+		g_stats.framing_errors++;
+	}
+	if(status & (1<<DOR))
+	{
+		g_stats.overrun_errors++;
+	}
+	if(status & (1<<PE))
+	{
+		g_stats.parity_errors++;
+	}
+	if(status & ((1<<FE) | (1<<DOR) | (1<<PE)))
+	{
+		TRACE_record(TRACE_UART_ERROR, status & ((1<<FE) | (1<<DOR) | (1<<PE)));
+	}
+
+	if((g_multiprocessor == TRUE) && ninth_bit)
+	{
+		/* Address byte, listen to the data after it only if it is for us */
+		if((data == g_address) || (data == UART_BROADCAST_ADDRESS))
+		{
+			CLEAR_BIT(UCSRA,MPCM);
+		}
+		else
+		{
+			SET_BIT(UCSRA,MPCM);
+		}
+		return;
+	}
+
+	/* The byte is dropped if the buffer is full */
+	if(next != g_rxTail)
+	{
+		g_rxBuffer[g_rxHead] = data;
+		g_rxHead = next;
+		if(g_receiveCallBackPtr != NULL_PTR)
+		{
+			(*g_receiveCallBackPtr)();
+		}
+	}
+	else
+	{
+		g_stats.buffer_overflows++;
+	}
+}
+
+ISR(USART_UDRE_vect)
+{
+	if(g_txHead == g_txTail)
+	{
+		/* Nothing left to send, stop the interrupt until the next byte is queued */
+		CLEAR_BIT(UCSRB,UDRIE);
+	}
+	else
+	{
+		/* Clear TXC so UART_flushTx can tell when this byte has been shifted out */
+		UCSRA = (UCSRA & ((1<<U2X) | (1<<MPCM))) | (1<<TXC);
+
+		/* TXB8 has to be written before UDR */
+		if(g_txNinthBit[g_txTail >> 3] & (1 << (g_txTail & 7)))
+		{
+			SET_BIT(UCSRB,TXB8);
+		}
+		else
+		{
+			CLEAR_BIT(UCSRB,TXB8);
+		}
+		UDR = g_txBuffer[g_txTail];
+		g_txStarted = TRUE;
+		g_stats.bytes_out++;
+		g_txTail = (uint8)((g_txTail + 1) & (UART_TX_BUFFER_SIZE - 1));
+	}
+}
+
 /*******************************************************************************
  *                      Functions Definitions                                  *
  *******************************************************************************/
@@ -35,57 +187,198 @@ void UART_init(const UART_ConfigType * Config_Ptr)
 	UCSRA = (1<<U2X);
 
 	/************************** UCSRB Description **************************
-	 * RXCIE = 1 Disable USART RX Complete Interrupt Enable
+	 * RXCIE = 1 Enable USART RX Complete Interrupt to fill the receive buffer
 	 * TXCIE = 0 Disable USART Tx Complete Interrupt Enable
-	 * UDRIE = 0 Disable USART Data Register Empty Interrupt Enable
+	 * UDRIE = 0 Enabled by UART_sendByte while the transmit FIFO has data
 	 * RXEN  = 1 Receiver Enable
 	 * RXEN  = 1 Transmitter Enable
-	 * UCSZ2 = 0 For 8-bit data mode
-	 * RXB8 & TXB8 not used for 8-bit data mode
+	 * UCSZ2 = 1 only for 9-bit data mode
+	 * RXB8 & TXB8 carry the 9th bit in 9-bit data mode
 	 ***********************************************************************/
-	UCSRB = (1<<RXEN) | (1<<TXEN);
+	UCSRB = (1<<RXCIE) | (1<<RXEN) | (1<<TXEN) | ((Config_Ptr->bit_data) & (1<<UCSZ2));
 
 	/************************** UCSRC Description **************************
 	 * URSEL   = 1 The URSEL must be one when writing the UCSRC
 	 * UMSEL   = 0 Asynchronous Operation
 	 * UPM1:0  = 00 Disable parity bit
 	 * USBS    = 0 One stop bit
-	 * UCSZ1:0 = 11 For 8-bit data mode
+	 * UCSZ1:0 = 11 For 8-bit and 9-bit data mode
 	 * UCPOL   = 0 Used with the Synchronous operation only
 	 ***********************************************************************/
-	UCSRC = (1<<URSEL) | ((Config_Ptr->parity)<<UPM0) | ((Config_Ptr->bit_data)<<UCSZ0) | ((Config_Ptr->stop_bit)<<USBS) ;
+	UCSRC = (1<<URSEL) | ((Config_Ptr->parity)<<UPM0) | (((Config_Ptr->bit_data) & 0x03)<<UCSZ0) | ((Config_Ptr->stop_bit)<<USBS) ;
 
-	/* Calculate the UBRR register value */
-	ubrr_value = (uint16)(((F_CPU / ((Config_Ptr->baud_rate) * 8UL))) - 1);
+	/* Calculate the UBRR register value, rounded to the nearest one to keep the baud error low */
+	ubrr_value = (uint16)UART_UBRR_VALUE(Config_Ptr->baud_rate);
 
 	/* First 8 bits from the BAUD_PRESCALE inside UBRRL and last 4 bits in UBRRH*/
 	UBRRH = ubrr_value>>8;
 	UBRRL = ubrr_value;
 }
 
+/*
+ * Description :
+ * Switch the running UART to another baud rate from the compile time baud table.
+ * Returns FALSE without touching the UART if the rate is not in the table or
+ * its UBRR error is outside UART_BAUD_ERROR_TOLERANCE.
+ */
+boolean UART_setBaudRate(UART_BaudRateType baud_rate)
+{
+	uint8 i;
+
+	for(i = 0; i < UART_BAUD_TABLE_SIZE; i++)
+	{
+		if((g_baudTable[i].baud_rate == baud_rate) && (g_baudTable[i].usable == TRUE))
+		{
+			UBRRH = g_baudTable[i].ubrr_value>>8;
+			UBRRL = g_baudTable[i].ubrr_value;
+			TRACE_record(TRACE_UART_BAUD, (baud_rate / 1200UL > 255UL) ? 255 : (uint8)(baud_rate / 1200UL));
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/*
+ * Description :
+ * Return the fastest usable rate of the baud table that is lower than the given
+ * limit, or 0 if there is none. Pass 0xFFFFFFFF to get the fastest usable rate.
+ */
+UART_BaudRateType UART_getFastestBaudRate(UART_BaudRateType limit)
+{
+	uint8 i = UART_BAUD_TABLE_SIZE;
+
+	while(i > 0)
+	{
+		i--;
+		if((g_baudTable[i].usable == TRUE) && (g_baudTable[i].baud_rate < limit))
+		{
+			return g_baudTable[i].baud_rate;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Description :
+ * Wait until every queued byte has completely left the transmitter.
+ */
+void UART_flushTx(void)
+{
+	/* Wait for the UDRE ISR to move the whole FIFO into UDR */
+	while(g_txHead != g_txTail)
+	{
+		POWER_idle();
+	}
+
+	/* Then wait for the last byte to leave the shift register */
+	if(g_txStarted == TRUE)
+	{
+		while(BIT_IS_CLEAR(UCSRA,TXC)){}
+		g_txStarted = FALSE;
+	}
+}
+
+/*
+ * Description :
+ * Return the number of bytes received with a framing error since UART_init.
+ */
+uint16 UART_getFramingErrors(void)
+{
+	UART_StatsType stats;
+
+	UART_getStats(&stats);
+	return stats.framing_errors;
+}
+
+/*
+ * Description :
+ * Take a consistent copy of the link health counters.
+ */
+void UART_getStats(UART_StatsType *stats)
+{
+	/* The counters are 16-bit and updated by both UART ISRs, copy them with interrupts off */
+	uint8 sreg = SREG;
+	cli();
+	*stats = g_stats;
+	SREG = sreg;
+}
+
+/*
+ * Description :
+ * Turn on multi-processor communication mode (MPCM) with the given node address.
+ * Data bytes are then only received after an address byte that carries this
+ * address or UART_BROADCAST_ADDRESS. Needs the UART initialized with NINE_BITS.
+ */
+void UART_setAddress(uint8 address)
+{
+	g_address = address;
+	g_multiprocessor = TRUE;
+
+	/* Ignore everything until an address byte selects us */
+	SET_BIT(UCSRA,MPCM);
+}
+
+/*
+ * Description :
+ * Add one byte and its 9th bit to the transmit FIFO.
+ */
+static void UART_queueByte(uint8 data, boolean ninth_bit)
+{
+	uint8 next = (uint8)((g_txHead + 1) & (UART_TX_BUFFER_SIZE - 1));
+
+	/* Wait only if the transmit FIFO is full, the UDRE ISR frees a slot per byte sent */
+	while(next == g_txTail)
+	{
+		POWER_idle();
+	}
+
+	g_txBuffer[g_txHead] = data;
+	if(ninth_bit == TRUE)
+	{
+		g_txNinthBit[g_txHead >> 3] |= (uint8)(1 << (g_txHead & 7));
+	}
+	else
+	{
+		g_txNinthBit[g_txHead >> 3] &= (uint8)~(1 << (g_txHead & 7));
+	}
+	g_txHead = next;
+
+	/* UDRIE fires as soon as UDR is empty and keeps draining the FIFO */
+	SET_BIT(UCSRB,UDRIE);
+}
+
+/*
+ * Description :
+ * Queue an address byte, with the 9th bit set, that selects which node
+ * receives the data bytes after it. Sent as a plain byte outside NINE_BITS mode.
+ */
+void UART_sendAddress(uint8 address)
+{
+	UART_queueByte(address, TRUE);
+}
+
 /*
  * Description :
  * Functional responsible for send byte to another UART device.
  */
 void UART_sendByte(const uint8 data)
 {
-	/*
-	 * UDRE flag is set when the Tx buffer (UDR) is empty and ready for
-	 * transmitting a new byte so wait until this flag is set to one
-	 */
-	while(BIT_IS_CLEAR(UCSRA,UDRE)){}
+	UART_queueByte(data, FALSE);
+}
 
-	/*
-	 * Put the required data in the UDR register and it also clear the UDRE flag as
-	 * the UDR register is not empty now
-	 */
-	UDR = data;
+/*
+ * Description :
+ * Queue a buffer of bytes for transmission and return without waiting for them
+ * to go out on the line. Only waits if the transmit FIFO is full.
+ */
+void UART_sendBuffer(const uint8 *buffer, uint8 length)
+{
+	uint8 i;
 
-	/************************* Another Method *************************
-	UDR = data;
-	while(BIT_IS_CLEAR(UCSRA,TXC)){} // Wait until the transmission is complete TXC = 1
-	SET_BIT(UCSRA,TXC); // Clear the TXC flag
-	*******************************************************************/
+	for(i = 0; i < length; i++)
+	{
+		UART_sendByte(buffer[i]);
+	}
 }
 
 /*
@@ -94,14 +387,82 @@ void UART_sendByte(const uint8 data)
  */
 uint8 UART_recieveByte(void)
 {
-	/* RXC flag is set when the UART receive data so wait until this flag is set to one */
-	while(BIT_IS_CLEAR(UCSRA,RXC)){}
+	uint8 data;
+
+	/* Wait until the RXC interrupt puts a byte in the receive buffer */
+	while(!UART_tryReceive(&data))
+	{
+		POWER_idle();
+	}
+
+	return data;
+}
+
+/*
+ * Description :
+ * Wait at most timeout_ms milliseconds of the system tick for a received byte.
+ * Returns TRUE with the byte stored in data, or FALSE if the time ran out.
+ * Needs the system tick from Timer_startSystemTick.
+ */
+boolean UART_receiveByteTimeout(uint8 *data, uint32 timeout_ms)
+{
+	uint32 start = Timer_now();
+
+	while(!UART_tryReceive(data))
+	{
+		if((Timer_now() - start) >= timeout_ms)
+		{
+			return FALSE;
+		}
+		POWER_idle();
+	}
+	return TRUE;
+}
+
+/*
+ * Description :
+ * Return the number of received bytes waiting in the receive buffer.
+ */
+uint8 UART_available(void)
+{
+	return (uint8)((g_rxHead - g_rxTail) & (UART_RX_BUFFER_SIZE - 1));
+}
+
+/*
+ * Description :
+ * Take one byte from the receive buffer without blocking.
+ * Returns TRUE and stores the byte in data if one was available, FALSE otherwise.
+ */
+boolean UART_tryReceive(uint8 *data)
+{
+	if(g_rxHead == g_rxTail)
+	{
+		return FALSE;
+	}
+
+	*data = g_rxBuffer[g_rxTail];
+	g_rxTail = (uint8)((g_rxTail + 1) & (UART_RX_BUFFER_SIZE - 1));
+
+	return TRUE;
+}
 
-	/*
-	 * Read the received data from the Rx buffer (UDR)
-	 * The RXC flag will be cleared after read the data
-	 */
-    return UDR;		
+/*
+ * Description :
+ * Return how many bytes the transmit FIFO takes without waiting.
+ */
+uint8 UART_getTxSpace(void)
+{
+	/* One slot stays empty to tell a full FIFO from an empty one */
+	return (uint8)((g_txTail - g_txHead - 1) & (UART_TX_BUFFER_SIZE - 1));
+}
+
+/*
+ * Description :
+ * Set a function the RXC interrupt calls after it put a byte in the receive buffer.
+ */
+void UART_setReceiveCallBack(void(*a_ptr)(void))
+{
+	g_receiveCallBackPtr = a_ptr;
 }
 
 /*
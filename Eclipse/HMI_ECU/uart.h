@@ -15,12 +15,40 @@
 
 #include "std_types.h"
 
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+/* Size of the receive ring buffer filled by the RXC interrupt (power of two) */
+#define UART_RX_BUFFER_SIZE    32
 
+/* Size of the transmit FIFO drained by the UDRE interrupt (power of two) */
+#define UART_TX_BUFFER_SIZE    64
 
+/* Largest baud rate error accepted for a UBRR value, in per mille of the nominal rate */
+#define UART_BAUD_ERROR_TOLERANCE    20
+
+/*
+ * UBRR value for double speed mode (U2X = 1), rounded to the nearest integer,
+ * and the error of the rate it really produces in per mille.
+ * Both are plain integer expressions so they can be checked with #if.
+ */
+#define UART_UBRR_VALUE(baud)        (((F_CPU) + 4UL * (baud)) / (8UL * (baud)) - 1UL)
+#define UART_ACTUAL_BAUD(baud)       ((F_CPU) / (8UL * (UART_UBRR_VALUE(baud) + 1UL)))
+#define UART_BAUD_ERROR(baud)        ((UART_ACTUAL_BAUD(baud) > (baud)) ? \
+		(((UART_ACTUAL_BAUD(baud) - (baud)) * 1000UL) / (baud)) : \
+		((((baud) - UART_ACTUAL_BAUD(baud)) * 1000UL) / (baud)))
+
+/*
+ * Address that every node accepts in multi-processor communication mode.
+ * Several nodes can share one bus in NINE_BITS mode: an address byte has the
+ * 9th bit set and only the addressed node receives the data bytes after it.
+ */
+#define UART_BROADCAST_ADDRESS     0xFF
 
 typedef enum
 {
-	FIVE_BITS,SIX_BITS,SEVEN_BITS,EIGHT_BITS
+	FIVE_BITS,SIX_BITS,SEVEN_BITS,EIGHT_BITS,NINE_BITS = 7
 }UART_BitDataType;
 typedef enum
 {
@@ -34,6 +62,16 @@ typedef enum
 
 typedef uint32 UART_BaudRateType;
 
+/* Link health counters kept by the UART interrupts, all of them wrap around */
+typedef struct {
+	uint16 bytes_in;          /* bytes received on the line */
+	uint16 bytes_out;         /* bytes moved into UDR for transmission */
+	uint16 framing_errors;    /* bytes received with FE set */
+	uint16 overrun_errors;    /* DOR set, bytes lost in the USART itself */
+	uint16 parity_errors;     /* bytes received with PE set, only with parity enabled */
+	uint16 buffer_overflows;  /* bytes dropped because the receive buffer was full */
+}UART_StatsType;
+
 typedef struct {
 	UART_BitDataType bit_data;
 	UART_ParityType parity;
@@ -55,18 +93,107 @@ typedef struct {
  */
 void UART_init(const UART_ConfigType * Config_Ptr);
 
+/*
+ * Description :
+ * Switch the running UART to another baud rate from the compile time baud table.
+ * Returns FALSE without touching the UART if the rate is not in the table or
+ * its UBRR error is outside UART_BAUD_ERROR_TOLERANCE.
+ */
+boolean UART_setBaudRate(UART_BaudRateType baud_rate);
+
+/*
+ * Description :
+ * Return the fastest usable rate of the baud table that is lower than the given
+ * limit, or 0 if there is none. Pass 0xFFFFFFFF to get the fastest usable rate.
+ */
+UART_BaudRateType UART_getFastestBaudRate(UART_BaudRateType limit);
+
+/*
+ * Description :
+ * Wait until every queued byte has completely left the transmitter.
+ */
+void UART_flushTx(void);
+
+/*
+ * Description :
+ * Return the number of bytes received with a framing error since UART_init.
+ */
+uint16 UART_getFramingErrors(void);
+
+/*
+ * Description :
+ * Take a consistent copy of the link health counters.
+ */
+void UART_getStats(UART_StatsType *stats);
+
+/*
+ * Description :
+ * Turn on multi-processor communication mode (MPCM) with the given node address.
+ * Data bytes are then only received after an address byte that carries this
+ * address or UART_BROADCAST_ADDRESS. Needs the UART initialized with NINE_BITS.
+ */
+void UART_setAddress(uint8 address);
+
+/*
+ * Description :
+ * Queue an address byte, with the 9th bit set, that selects which node
+ * receives the data bytes after it. Sent as a plain byte outside NINE_BITS mode.
+ */
+void UART_sendAddress(uint8 address);
+
 /*
  * Description :
  * Functional responsible for send byte to another UART device.
  */
 void UART_sendByte(const uint8 data);
 
+/*
+ * Description :
+ * Queue a buffer of bytes for transmission and return without waiting for them
+ * to go out on the line. Only waits if the transmit FIFO is full.
+ */
+void UART_sendBuffer(const uint8 *buffer, uint8 length);
+
 /*
  * Description :
  * Functional responsible for receive byte from another UART device.
  */
 uint8 UART_recieveByte(void);
 
+/*
+ * Description :
+ * Wait at most timeout_ms milliseconds of the system tick for a received byte.
+ * Returns TRUE with the byte stored in data, or FALSE if the time ran out.
+ * Needs the system tick from Timer_startSystemTick.
+ */
+boolean UART_receiveByteTimeout(uint8 *data, uint32 timeout_ms);
+
+/*
+ * Description :
+ * Return the number of received bytes waiting in the receive buffer.
+ */
+uint8 UART_available(void);
+
+/*
+ * Description :
+ * Take one byte from the receive buffer without blocking.
+ * Returns TRUE and stores the byte in data if one was available, FALSE otherwise.
+ */
+boolean UART_tryReceive(uint8 *data);
+
+/*
+ * Description :
+ * Return how many bytes the transmit FIFO takes without waiting.
+ */
+uint8 UART_getTxSpace(void);
+
+/*
+ * Description :
+ * Set a function the RXC interrupt calls after it put a byte in the receive
+ * buffer, so the application can wake up for it. NULL_PTR removes it.
+ */
+void UART_setReceiveCallBack(void(*a_ptr)(void));
+
 /*
  * Description :
  * Send the required string through UART to the other UART device.
@@ -79,4 +206,6 @@ void UART_sendString(const uint8 *Str);
  */
 void UART_receiveString(uint8 *Str); // Receive until #
 
+
+
 #endif /* UART_H_ */
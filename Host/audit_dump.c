@@ -0,0 +1,604 @@
+ /******************************************************************************
+ *
+ * Module: Audit Dump
+ *
+ * File Name: audit_dump.c
+ *
+ * Description: Reads the access audit log out of control_host the way a
+ *              service panel would: it joins the emulated UART bus as a
+ *              panel, unlocks the export with CHECK_PASS and pages through
+ *              the log with GET_AUDIT, resuming from the first entry it is
+ *              missing. Prints the entries and the export rate.
+ *
+ * Author: Malik Anas
+ *
+ *******************************************************************************/
+
+#include "host_mcu.h"
+
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+/* Frame layout and commands, as in frame.h, audit_log.h and the CONTROL main file */
+#define FRAME_START_BYTE       0x7E
+#define FRAME_MAX_PAYLOAD      16
+#define FRAME_NACK             0x15
+#define CONTROL_ADDRESS        0x01
+#define BROADCAST_ADDRESS      0xFF
+#define MC2_READY              0xE0
+#define GET_STATUS             0xE1
+#define PASS_MATCH             0xE5
+#define CHECK_PASS             0xE7
+#define RECIEVED               0xE9
+#define BAUD_CHANGE            0xEA
+#define BAUD_CONFIRM           0xEB
+#define REQUEST_PENDING        0xED
+#define GET_AUDIT              0xF3
+#define AUDIT_DATA             0xF4
+
+#define PASSWORD_DIGITS        5
+#define AUDIT_ENTRY_SIZE       8
+#define AUDIT_MAX_ENTRIES      65536
+
+/* UART settings of CONTROL: 9-bit characters, double speed, starting at 2400 baud */
+#define DUMP_START_BAUD        2400UL
+#define DUMP_CHAR_SIZE         7
+#define DUMP_CHAR_BITS         11
+
+/* Wall clock time a request is given before it is sent again, and how often */
+#define DUMP_REPLY_TIMEOUT_MS  1000
+#define DUMP_ATTEMPTS          5
+
+/*******************************************************************************
+ *                               Types Declaration                             *
+ *******************************************************************************/
+
+typedef enum
+{
+	WAIT_START,WAIT_SOURCE,WAIT_SEQUENCE,WAIT_COMMAND,WAIT_LENGTH,WAIT_PAYLOAD,WAIT_CRC
+}DUMP_RxStateType;
+
+typedef struct {
+	uint8_t source;
+	uint8_t sequence;
+	uint8_t command;
+	uint8_t length;
+	uint8_t payload[FRAME_MAX_PAYLOAD];
+}DUMP_FrameType;
+
+/*******************************************************************************
+ *                           Global Variables                                  *
+ *******************************************************************************/
+
+static pid_t g_control;
+static int g_fd;
+static uint64_t g_epochNs;
+static double g_scale = 1.0;
+static uint8_t g_address = 0x02;
+static uint8_t g_sequence = 0;
+
+/* Line settings, both ends must agree or the characters arrive as framing errors */
+static uint16_t g_config;
+static uint64_t g_charNs;
+static uint64_t g_lineFreeNs;
+
+/* Receiver */
+static DUMP_RxStateType g_rxState = WAIT_START;
+static uint8_t g_rxSelected = 0;
+static uint8_t g_rxIndex;
+static uint8_t g_rxCrc;
+static DUMP_FrameType g_rxFrame;
+
+/* AUDIT_DATA frames that came with the GET_AUDIT in progress */
+static uint8_t g_data[FRAME_MAX_PAYLOAD * 16];
+static unsigned g_dataLength;
+
+/*******************************************************************************
+ *                      Functions Definitions                                  *
+ *******************************************************************************/
+
+static uint8_t DUMP_updateCrc(uint8_t crc, uint8_t data)
+{
+	uint8_t bit;
+
+	crc ^= data;
+	for(bit = 0; bit < 8; bit++)
+	{
+		crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+	}
+	return crc;
+}
+
+static uint64_t DUMP_wallNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Description :
+ * Emulated time of the nodes, the same clock host_mcu.c derives from HOST_EPOCH_NS.
+ */
+static uint64_t DUMP_now(void)
+{
+	return (uint64_t)((double)(DUMP_wallNs() - g_epochNs) * g_scale);
+}
+
+/*
+ * Description :
+ * Use the line settings CONTROL has for a baud rate, the UBRR value of uart.h in double speed mode.
+ */
+static void DUMP_setBaudRate(uint32_t baud_rate)
+{
+	uint32_t ubrr = (8000000UL + 4UL * baud_rate) / (8UL * baud_rate) - 1UL;
+
+	g_config = (uint16_t)((ubrr & HOST_WIRE_UBRR_MASK) | HOST_WIRE_U2X | (DUMP_CHAR_SIZE << HOST_WIRE_SIZE_SHIFT));
+	g_charNs = (uint64_t)DUMP_CHAR_BITS * 8 * (ubrr + 1) * 1000000000ULL / 8000000UL;
+}
+
+static void DUMP_sendChar(uint8_t data, uint8_t ninth_bit)
+{
+	HOST_WireCharType wire;
+	uint64_t now = DUMP_now();
+
+	memset(&wire, 0, sizeof(wire));
+	g_lineFreeNs = ((g_lineFreeNs > now) ? g_lineFreeNs : now) + g_charNs;
+	wire.end_ns = g_lineFreeNs;
+	wire.config = g_config;
+	wire.ninth_bit = ninth_bit;
+	wire.data = data;
+	if(send(g_fd, &wire, sizeof(wire), 0) < 0)
+	{
+		perror("audit_dump: send");
+		exit(1);
+	}
+}
+
+static void DUMP_sendFrame(uint8_t sequence, uint8_t command, const uint8_t * payload, uint8_t length)
+{
+	uint8_t crc = 0;
+	uint8_t header[4] = {g_address, sequence, command, length};
+	unsigned i;
+
+	DUMP_sendChar(CONTROL_ADDRESS, 1);
+	DUMP_sendChar(FRAME_START_BYTE, 0);
+	for(i = 0; i < sizeof(header); i++)
+	{
+		DUMP_sendChar(header[i], 0);
+		crc = DUMP_updateCrc(crc, header[i]);
+	}
+	for(i = 0; i < length; i++)
+	{
+		DUMP_sendChar(payload[i], 0);
+		crc = DUMP_updateCrc(crc, payload[i]);
+	}
+	DUMP_sendChar(crc, 0);
+}
+
+/*
+ * Description :
+ * Feed one character from the line to the frame parser, returns 1 once a frame
+ * for this panel passed its CRC.
+ */
+static int DUMP_parse(const HOST_WireCharType * wire)
+{
+	uint8_t data = wire->data;
+
+	/* Another baud rate, the receiver samples garbage */
+	if(wire->config != g_config)
+	{
+		g_rxState = WAIT_START;
+		return 0;
+	}
+	if(wire->ninth_bit)
+	{
+		g_rxSelected = (data == g_address) || (data == BROADCAST_ADDRESS);
+		g_rxState = WAIT_START;
+		return 0;
+	}
+	if(!g_rxSelected)
+	{
+		return 0;
+	}
+
+	switch(g_rxState)
+	{
+	case WAIT_START:
+		if(data == FRAME_START_BYTE)
+		{
+			g_rxCrc = 0;
+			g_rxState = WAIT_SOURCE;
+		}
+		return 0;
+	case WAIT_SOURCE:
+		g_rxFrame.source = data;
+		g_rxState = WAIT_SEQUENCE;
+		break;
+	case WAIT_SEQUENCE:
+		g_rxFrame.sequence = data;
+		g_rxState = WAIT_COMMAND;
+		break;
+	case WAIT_COMMAND:
+		g_rxFrame.command = data;
+		g_rxState = WAIT_LENGTH;
+		break;
+	case WAIT_LENGTH:
+		if(data > FRAME_MAX_PAYLOAD)
+		{
+			g_rxState = WAIT_START;
+			return 0;
+		}
+		g_rxFrame.length = data;
+		g_rxIndex = 0;
+		g_rxState = (data == 0) ? WAIT_CRC : WAIT_PAYLOAD;
+		break;
+	case WAIT_PAYLOAD:
+		g_rxFrame.payload[g_rxIndex++] = data;
+		if(g_rxIndex == g_rxFrame.length)
+		{
+			g_rxState = WAIT_CRC;
+		}
+		break;
+	case WAIT_CRC:
+		g_rxState = WAIT_START;
+		return (data == g_rxCrc) && (g_rxFrame.source == CONTROL_ADDRESS);
+	}
+	g_rxCrc = DUMP_updateCrc(g_rxCrc, data);
+	return 0;
+}
+
+/*
+ * Description :
+ * Wait at most timeout_ms of wall clock time for a frame from CONTROL, returns 1 if one came.
+ */
+static int DUMP_receive(DUMP_FrameType * frame, unsigned timeout_ms)
+{
+	uint64_t deadline = DUMP_wallNs() + (uint64_t)timeout_ms * 1000000ULL;
+	HOST_WireCharType wire;
+	struct pollfd fds;
+	uint64_t now;
+
+	for(;;)
+	{
+		while(recv(g_fd, &wire, sizeof(wire), MSG_DONTWAIT) == (ssize_t)sizeof(wire))
+		{
+			if(DUMP_parse(&wire))
+			{
+				*frame = g_rxFrame;
+				return 1;
+			}
+		}
+
+		now = DUMP_wallNs();
+		if(now >= deadline)
+		{
+			return 0;
+		}
+		fds.fd = g_fd;
+		fds.events = POLLIN;
+		fds.revents = 0;
+		poll(&fds, 1, (int)((deadline - now) / 1000000ULL) + 1);
+		if(waitpid(g_control, NULL, WNOHANG) == g_control)
+		{
+			fprintf(stderr, "audit_dump: control_host exited\n");
+			exit(1);
+		}
+	}
+}
+
+/*
+ * Description :
+ * Send a request until its reply comes, a retransmission keeps the sequence
+ * number so CONTROL answers it from its reply cache. AUDIT_DATA frames that
+ * come before the reply are collected in g_data.
+ */
+static int DUMP_exchange(uint8_t command, const uint8_t * payload, uint8_t length, DUMP_FrameType * reply)
+{
+	unsigned attempt;
+
+	if(++g_sequence == 0)
+	{
+		g_sequence = 1;
+	}
+	g_dataLength = 0;
+
+	for(attempt = 0; attempt < DUMP_ATTEMPTS; attempt++)
+	{
+		DUMP_sendFrame(g_sequence, command, payload, length);
+		while(DUMP_receive(reply, DUMP_REPLY_TIMEOUT_MS))
+		{
+			if(reply->command == FRAME_NACK)
+			{
+				break;
+			}
+			if(reply->sequence != g_sequence)
+			{
+				continue;
+			}
+			if(reply->command == AUDIT_DATA)
+			{
+				if(g_dataLength + reply->length <= sizeof(g_data))
+				{
+					memcpy(&g_data[g_dataLength], reply->payload, reply->length);
+					g_dataLength += reply->length;
+				}
+				continue;
+			}
+			if(reply->command != REQUEST_PENDING)
+			{
+				return 1;
+			}
+		}
+		g_dataLength = 0;
+	}
+	return 0;
+}
+
+/*
+ * Description :
+ * Move the link to a faster baud rate the way HMI does, CONTROL only agrees when it serves a single panel.
+ */
+static int DUMP_negotiateBaudRate(uint32_t baud_rate)
+{
+	uint8_t payload[4] = {(uint8_t)baud_rate, (uint8_t)(baud_rate >> 8), (uint8_t)(baud_rate >> 16),
+			(uint8_t)(baud_rate >> 24)};
+	DUMP_FrameType reply;
+
+	if(!DUMP_exchange(BAUD_CHANGE, payload, 4, &reply) || (reply.command != RECIEVED))
+	{
+		return 0;
+	}
+
+	/* CONTROL switches once its reply has left the line */
+	DUMP_setBaudRate(baud_rate);
+	usleep((useconds_t)(2000.0 / g_scale));
+	DUMP_sendFrame(g_sequence, BAUD_CONFIRM, NULL, 0);
+	if(DUMP_receive(&reply, DUMP_REPLY_TIMEOUT_MS) && (reply.command == RECIEVED))
+	{
+		return 1;
+	}
+	DUMP_setBaudRate(DUMP_START_BAUD);
+	return 0;
+}
+
+static const char * DUMP_eventName(uint8_t event)
+{
+	switch(event)
+	{
+	case 0x01: return "BOOT";
+	case 0x02: return "UNLOCK";
+	case 0x03: return "FAILED_ATTEMPT";
+	case 0x04: return "LOCKOUT";
+	case 0x05: return "PASSWORD_CHANGE";
+	case 0x06: return "DROPPED";
+	}
+	return "?";
+}
+
+/*
+ * Description :
+ * Print one entry as stored: SEQUENCE | EVENT | DETAIL | TIME | CRC-8, returns 0 if its CRC is wrong.
+ */
+static int DUMP_printEntry(uint16_t expected, const uint8_t * entry)
+{
+	uint8_t crc = 0;
+	unsigned i;
+	unsigned sequence = (unsigned)(entry[0] | (entry[1] << 8));
+	unsigned long seconds = (unsigned long)entry[4] | ((unsigned long)entry[5] << 8) | ((unsigned long)entry[6] << 16);
+
+	for(i = 0; i < AUDIT_ENTRY_SIZE - 1; i++)
+	{
+		crc = DUMP_updateCrc(crc, entry[i]);
+	}
+	if((crc != entry[AUDIT_ENTRY_SIZE - 1]) || (sequence != expected))
+	{
+		printf("%5u  corrupted entry\n", (unsigned)expected);
+		return 0;
+	}
+
+	if(entry[2] == 0x01)
+	{
+		printf("%5u %9lu s  %s\n", sequence, seconds, DUMP_eventName(entry[2]));
+	}
+	else if(entry[2] == 0x06)
+	{
+		printf("%5u %9lu s  %-16s%u events lost\n", sequence, seconds, DUMP_eventName(entry[2]), (unsigned)entry[3]);
+	}
+	else
+	{
+		printf("%5u %9lu s  %-16spanel 0x%02X\n", sequence, seconds, DUMP_eventName(entry[2]), (unsigned)entry[3]);
+	}
+	return 1;
+}
+
+static void DUMP_startControl(const char * path, const char * eeprom)
+{
+	int pair[2];
+	char number[32];
+
+	if(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, pair) < 0)
+	{
+		perror("socketpair");
+		exit(1);
+	}
+
+	g_fd = pair[0];
+	g_control = fork();
+	if(g_control < 0)
+	{
+		perror("fork");
+		exit(1);
+	}
+	if(g_control == 0)
+	{
+		prctl(PR_SET_PDEATHSIG, SIGKILL);
+		close(pair[0]);
+		snprintf(number, sizeof(number), "%d", pair[1]);
+		setenv(HOST_ENV_UART_FD, number, 1);
+		snprintf(number, sizeof(number), "%llu", (unsigned long long)g_epochNs);
+		setenv(HOST_ENV_EPOCH_NS, number, 1);
+		snprintf(number, sizeof(number), "%g", g_scale);
+		setenv(HOST_ENV_TIME_SCALE, number, 1);
+		setenv(HOST_ENV_EEPROM, eeprom, 1);
+		execl(path, path, (char *)NULL);
+		perror(path);
+		_exit(127);
+	}
+	close(pair[1]);
+}
+
+static void DUMP_usage(const char * program)
+{
+	fprintf(stderr,
+			"usage: %s -e eeprom_image [-k password] [-c cursor] [-b baud] [-a address] [-s scale] [-C control_host]\n"
+			"  -e  EEPROM image control_host keeps, as link_bench -e writes it\n"
+			"  -k  the door password, the export starts after a matching CHECK_PASS (default 12345)\n"
+			"  -c  sequence number to resume from, the oldest entry if it is no longer in the log (default 0)\n"
+			"  -b  switch the link to this baud rate first, needs CONTROL built with CONTROL_PANELS=1\n"
+			"  -a  panel address to use (default 0x02)\n"
+			"  -s  emulated seconds per wall clock second (default 1)\n",
+			program);
+}
+
+int main(int argc, char * argv[])
+{
+	const char * control_path = "./control_host";
+	const char * eeprom = NULL;
+	const char * password = "12345";
+	uint32_t baud_rate = DUMP_START_BAUD;
+	uint16_t cursor = 0;
+	uint16_t first;
+	uint16_t next_sequence;
+	uint8_t payload[FRAME_MAX_PAYLOAD];
+	DUMP_FrameType reply;
+	unsigned entries = 0;
+	unsigned corrupted = 0;
+	unsigned requests = 0;
+	unsigned count;
+	unsigned received;
+	uint64_t start_ns;
+	uint64_t start_wall;
+	int option;
+	unsigned i;
+
+	while((option = getopt(argc, argv, "e:k:c:b:a:s:C:h")) != -1)
+	{
+		switch(option)
+		{
+		case 'e': eeprom = optarg; break;
+		case 'k': password = optarg; break;
+		case 'c': cursor = (uint16_t)strtoul(optarg, NULL, 0); break;
+		case 'b': baud_rate = (uint32_t)strtoul(optarg, NULL, 0); break;
+		case 'a': g_address = (uint8_t)strtoul(optarg, NULL, 0); break;
+		case 's': g_scale = atof(optarg); break;
+		case 'C': control_path = optarg; break;
+		default:
+			DUMP_usage(argv[0]);
+			return 2;
+		}
+	}
+	if((eeprom == NULL) || (strlen(password) != PASSWORD_DIGITS) || (g_scale <= 0.0))
+	{
+		DUMP_usage(argv[0]);
+		return 2;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+	g_epochNs = DUMP_wallNs();
+	DUMP_setBaudRate(DUMP_START_BAUD);
+	DUMP_startControl(control_path, eeprom);
+
+	/* CONTROL announces itself once its storage is open */
+	while(!DUMP_receive(&reply, 10000) || (reply.command != MC2_READY)) {}
+
+	if(!DUMP_exchange(GET_STATUS, NULL, 0, &reply))
+	{
+		fprintf(stderr, "audit_dump: no answer to GET_STATUS\n");
+		return 1;
+	}
+	if((baud_rate != DUMP_START_BAUD) && !DUMP_negotiateBaudRate(baud_rate))
+	{
+		fprintf(stderr, "audit_dump: CONTROL kept %lu baud\n", (unsigned long)DUMP_START_BAUD);
+		baud_rate = DUMP_START_BAUD;
+	}
+
+	/* Digits two per byte, low nibble first */
+	memset(payload, 0, sizeof(payload));
+	for(i = 0; i < PASSWORD_DIGITS; i++)
+	{
+		payload[i / 2] |= (uint8_t)((password[i] - '0') << ((i % 2) * 4));
+	}
+	if(!DUMP_exchange(CHECK_PASS, payload, (PASSWORD_DIGITS + 1) / 2, &reply) || (reply.command != PASS_MATCH))
+	{
+		fprintf(stderr, "audit_dump: CHECK_PASS was not accepted (reply 0x%02X)\n", (unsigned)reply.command);
+		return 1;
+	}
+
+	/* Page through the log, every request asks for the first entry still missing */
+	start_ns = DUMP_now();
+	start_wall = DUMP_wallNs();
+	for(;;)
+	{
+		payload[0] = (uint8_t)cursor;
+		payload[1] = (uint8_t)(cursor >> 8);
+		requests++;
+		if(!DUMP_exchange(GET_AUDIT, payload, 2, &reply) || (reply.command != GET_AUDIT) || (reply.length != 5))
+		{
+			fprintf(stderr, "audit_dump: GET_AUDIT failed (reply 0x%02X)\n", (unsigned)reply.command);
+			return 1;
+		}
+
+		first = (uint16_t)(reply.payload[0] | (reply.payload[1] << 8));
+		count = reply.payload[2];
+		next_sequence = (uint16_t)(reply.payload[3] | (reply.payload[4] << 8));
+
+		/* Only the entries that arrived in one piece from the first one on count, the rest is asked for again */
+		received = g_dataLength / AUDIT_ENTRY_SIZE;
+		if(received > count)
+		{
+			received = count;
+		}
+		for(i = 0; i < received; i++)
+		{
+			if(!DUMP_printEntry((uint16_t)(first + i), &g_data[i * AUDIT_ENTRY_SIZE]))
+			{
+				corrupted++;
+			}
+			entries++;
+		}
+		cursor = (uint16_t)(first + received);
+
+		if((count == 0) || ((cursor == next_sequence) && (received == count)) || (entries >= AUDIT_MAX_ENTRIES))
+		{
+			break;
+		}
+	}
+
+	{
+		double emulated = (double)(DUMP_now() - start_ns) / 1e9;
+		double wall = (double)(DUMP_wallNs() - start_wall) / 1e9;
+
+		fprintf(stderr, "audit_dump: %u entries (%u corrupted) in %u requests at %lu baud, next sequence %u\n",
+				entries, corrupted, requests, (unsigned long)baud_rate, (unsigned)cursor);
+		fprintf(stderr, "audit_dump: %.3f s emulated, %.0f entries/s, %.3f s wall clock\n",
+				emulated, (emulated > 0.0) ? entries / emulated : 0.0, wall);
+	}
+
+	kill(g_control, SIGTERM);
+	waitpid(g_control, NULL, 0);
+	return 0;
+}
@@ -0,0 +1,25 @@
+ /******************************************************************************
+ *
+ * Module: Host MCU Emulation
+ *
+ * File Name: avr/interrupt.h
+ *
+ * Description: Host replacement for <avr/interrupt.h>. An ISR becomes a plain
+ *              function that host_mcu.c calls from its peripheral tick while
+ *              the I-bit in SREG is set, exactly like the AVR core would.
+ *
+ * Author: Malik Anas
+ *
+ *******************************************************************************/
+
+#ifndef HOST_AVR_INTERRUPT_H_
+#define HOST_AVR_INTERRUPT_H_
+
+#include <avr/io.h>
+
+#define ISR(vector, ...)   void vector(void); void vector(void)
+
+#define sei()              (SREG |= (1<<7))
+#define cli()              (SREG &= (uint8_t)~(1<<7))
+
+#endif /* HOST_AVR_INTERRUPT_H_ */
@@ -0,0 +1,216 @@
+ /******************************************************************************
+ *
+ * Module: Host MCU Emulation
+ *
+ * File Name: avr/io.h
+ *
+ * Description: Host replacement for <avr/io.h>. Every ATmega32 register used
+ *              by the drivers is a plain variable owned by host_mcu.c, which
+ *              emulates the peripherals behind them. The PINx registers are
+ *              computed on every read so the keypad and sensors can react
+ *              to the pins the firmware is driving.
+ *
+ * Author: Malik Anas
+ *
+ *******************************************************************************/
+
+#ifndef HOST_AVR_IO_H_
+#define HOST_AVR_IO_H_
+
+#include <stdint.h>
+
+/*******************************************************************************
+ *                              Registers                                      *
+ *******************************************************************************/
+
+/*
+ * SREG. A tick that finds the I-bit clear defers its ISRs, host_mcu.c runs
+ * them on the next SREG access once the I-bit is set again, standing in for
+ * the pending interrupt the AVR takes right after SEI.
+ */
+extern volatile uint8_t * HOST_sreg(void);
+#define SREG (*HOST_sreg())
+
+/* I/O ports, PINx is sampled through the emulated board */
+extern volatile uint8_t DDRA, DDRB, DDRC, DDRD;
+extern volatile uint8_t PORTA, PORTB, PORTC, PORTD;
+uint8_t HOST_readPins(uint8_t port);
+#define PINA (HOST_readPins(0))
+#define PINB (HOST_readPins(1))
+#define PINC (HOST_readPins(2))
+#define PIND (HOST_readPins(3))
+
+/*
+ * USART. UDR is wider than the real register: host_mcu.c sets bit 8 while
+ * UDR holds nothing new, so a byte written by the firmware shows up as a
+ * value below 0x100. Reading UDR into a uint8 drops the marker.
+ */
+extern volatile uint16_t UDR;
+extern volatile uint8_t UCSRA, UCSRB, UCSRC, UBRRH, UBRRL;
+
+/*
+ * TWI. Every TWCR access goes through host_mcu.c, so a command written by
+ * the firmware is carried out before TWCR is read back, just like the
+ * hardware clears TWINT the moment it is written with a one.
+ */
+extern volatile uint8_t TWBR, TWSR, TWAR, TWDR;
+volatile uint8_t * HOST_twcr(void);
+#define TWCR (*HOST_twcr())
+
+/* Timers */
+extern volatile uint8_t TCCR0, TCNT0, OCR0;
+extern volatile uint8_t TCCR1A, TCCR1B;
+extern volatile uint16_t TCNT1, OCR1A, OCR1B, ICR1;
+extern volatile uint8_t TCCR2, TCNT2, OCR2, ASSR;
+extern volatile uint8_t TIMSK, TIFR;
+
+/* MCU control */
+extern volatile uint8_t MCUCR, MCUCSR, GICR, GIFR;
+
+/*******************************************************************************
+ *                              Bit Positions                                  *
+ *******************************************************************************/
+
+/* Port pins */
+#define PA0 0
+#define PA1 1
+#define PA2 2
+#define PA3 3
+#define PA4 4
+#define PA5 5
+#define PA6 6
+#define PA7 7
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+#define PC0 0
+#define PC1 1
+#define PC2 2
+#define PC3 3
+#define PC4 4
+#define PC5 5
+#define PC6 6
+#define PC7 7
+#define PD0 0
+#define PD1 1
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+#define PD6 6
+#define PD7 7
+
+/* UCSRA */
+#define RXC   7
+#define TXC   6
+#define UDRE  5
+#define FE    4
+#define DOR   3
+#define PE    2
+#define U2X   1
+#define MPCM  0
+
+/* UCSRB */
+#define RXCIE 7
+#define TXCIE 6
+#define UDRIE 5
+#define RXEN  4
+#define TXEN  3
+#define UCSZ2 2
+#define RXB8  1
+#define TXB8  0
+
+/* UCSRC */
+#define URSEL 7
+#define UMSEL 6
+#define UPM1  5
+#define UPM0  4
+#define USBS  3
+#define UCSZ1 2
+#define UCSZ0 1
+#define UCPOL 0
+
+/* TWCR */
+#define TWINT 7
+#define TWEA  6
+#define TWSTA 5
+#define TWSTO 4
+#define TWWC  3
+#define TWEN  2
+#define TWIE  0
+
+/* TWSR */
+#define TWPS1 1
+#define TWPS0 0
+
+/* TCCR0 */
+#define FOC0  7
+#define WGM00 6
+#define COM01 5
+#define COM00 4
+#define WGM01 3
+#define CS02  2
+#define CS01  1
+#define CS00  0
+
+/* TCCR1A */
+#define COM1A1 7
+#define COM1A0 6
+#define COM1B1 5
+#define COM1B0 4
+#define FOC1A  3
+#define FOC1B  2
+#define WGM11  1
+#define WGM10  0
+
+/* TCCR1B */
+#define ICNC1 7
+#define ICES1 6
+#define WGM13 4
+#define WGM12 3
+#define CS12  2
+#define CS11  1
+#define CS10  0
+
+/* TCCR2 */
+#define FOC2  7
+#define WGM20 6
+#define COM21 5
+#define COM20 4
+#define WGM21 3
+#define CS22  2
+#define CS21  1
+#define CS20  0
+
+/* TIMSK */
+#define OCIE2  7
+#define TOIE2  6
+#define TICIE1 5
+#define OCIE1A 4
+#define OCIE1B 3
+#define TOIE1  2
+#define OCIE0  1
+#define TOIE0  0
+
+/* TIFR */
+#define OCF2  7
+#define TOV2  6
+#define ICF1  5
+#define OCF1A 4
+#define OCF1B 3
+#define TOV1  2
+#define OCF0  1
+#define TOV0  0
+
+/* MCUCR */
+#define SE    7
+#define SM2   6
+#define SM1   5
+#define SM0   4
+
+#endif /* HOST_AVR_IO_H_ */
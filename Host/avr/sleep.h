@@ -0,0 +1,22 @@
+ /******************************************************************************
+ *
+ * Module: Host MCU Emulation
+ *
+ * File Name: avr/sleep.h
+ *
+ * Description: Host replacement for <avr/sleep.h>. The SLEEP instruction
+ *              waits for the next ISR host_mcu.c calls, like the AVR core
+ *              waking up for an interrupt.
+ *
+ * Author: Malik Anas
+ *
+ *******************************************************************************/
+
+#ifndef HOST_AVR_SLEEP_H_
+#define HOST_AVR_SLEEP_H_
+
+#include <avr/io.h>
+
+#define sleep_cpu()        HOST_sleep()
+
+#endif /* HOST_AVR_SLEEP_H_ */
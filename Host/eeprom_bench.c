@@ -0,0 +1,136 @@
+ /******************************************************************************
+ *
+ * Module: EEPROM Benchmark
+ *
+ * File Name: eeprom_bench.c
+ *
+ * Description: Runs the CONTROL TWI and external EEPROM drivers on the host
+ *              MCU emulation and reports read and write throughput at the
+ *              TWI_BIT_RATE it was built with. The Makefile builds it once
+ *              for 100 kHz and once for 200 kHz, close to the fastest rate
+ *              TWBR >= 10 allows at 8 MHz. HOST_TWI_HANG and HOST_TWI_NACK
+ *              run it on a faulty bus.
+ *
+ * Author: Malik Anas
+ *
+ *******************************************************************************/
+
+#include <avr/io.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "twi.h"
+#include "external_eeprom.h"
+#include "timer.h"
+
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+#define BENCH_EEPROM_SIZE      2048
+#define BENCH_SINGLE_READS     64
+#define BENCH_BYTE_WRITES      16
+
+/*******************************************************************************
+ *                           Global Variables                                  *
+ *******************************************************************************/
+
+static uint8 g_buffer[BENCH_EEPROM_SIZE];
+
+/*******************************************************************************
+ *                      Functions Definitions                                  *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Write a buffer in the background as the firmware does and wait for it.
+ */
+static uint8 BENCH_write(uint16 address, const uint8 *data, uint16 length)
+{
+	EEPROM_RequestType request;
+
+	EEPROM_submitWrite(&request, address, data, length);
+	while(EEPROM_poll(&request) == EEPROM_BUSY) {}
+	return (request.status == EEPROM_DONE) ? SUCCESS : ERROR;
+}
+
+static void BENCH_report(const char * name, uint64_t elapsed_ns, unsigned bytes, unsigned operations, uint8 status)
+{
+	double ms = elapsed_ns / 1e6;
+
+	printf("%-26s %6u B %10.2f ms %10.0f B/s %10.3f ms/op%s\n", name, bytes, ms,
+			bytes / (ms / 1000.0), ms / operations, (status == SUCCESS) ? "" : "  FAILED");
+}
+
+int main(void)
+{
+	TWI_ConfigType twi_config = {0x01};
+	uint64_t start;
+	uint8 status;
+	uint8 data;
+	unsigned i;
+
+	SREG |= (1<<7);
+	Timer_startSystemTick();
+	TWI_init(&twi_config);
+
+	printf("TWI %lu Hz (TWBR %u, TWPS %u), 24C16 with a 5 ms write cycle\n",
+			(unsigned long)TWI_ACTUAL_BIT_RATE, (unsigned)TWI_TWBR, (unsigned)TWI_TWPS);
+
+	for(i = 0; i < BENCH_EEPROM_SIZE; i++)
+	{
+		g_buffer[i] = (uint8)(i * 7);
+	}
+
+	/* Page writes, one write cycle per 16 bytes */
+	start = HOST_now();
+	status = BENCH_write(0, g_buffer, BENCH_EEPROM_SIZE);
+	BENCH_report("page write 2 KB", HOST_now() - start, BENCH_EEPROM_SIZE, BENCH_EEPROM_SIZE / EEPROM_PAGE_SIZE, status);
+
+	/* One sequential read of the whole memory */
+	for(i = 0; i < BENCH_EEPROM_SIZE; i++)
+	{
+		g_buffer[i] = 0;
+	}
+	start = HOST_now();
+	status = EEPROM_readBlock(0, g_buffer, BENCH_EEPROM_SIZE);
+	for(i = 0; i < BENCH_EEPROM_SIZE; i++)
+	{
+		if(g_buffer[i] != (uint8)(i * 7))
+		{
+			status = ERROR;
+		}
+	}
+	BENCH_report("sequential read 2 KB", HOST_now() - start, BENCH_EEPROM_SIZE, 1, status);
+
+	/* Random reads, each one a whole transaction */
+	srand(1);
+	status = SUCCESS;
+	start = HOST_now();
+	for(i = 0; i < BENCH_SINGLE_READS; i++)
+	{
+		uint16 address = (uint16)(rand() % BENCH_EEPROM_SIZE);
+
+		if((EEPROM_readByte(address, &data) == ERROR) || (data != (uint8)(address * 7)))
+		{
+			status = ERROR;
+		}
+	}
+	BENCH_report("random byte reads", HOST_now() - start, BENCH_SINGLE_READS, BENCH_SINGLE_READS, status);
+
+	/* Byte writes, a write cycle each */
+	status = SUCCESS;
+	start = HOST_now();
+	for(i = 0; i < BENCH_BYTE_WRITES; i++)
+	{
+		if(EEPROM_writeByte((uint16)(i * 33), (uint8)i) == ERROR)
+		{
+			status = ERROR;
+		}
+	}
+	EEPROM_readByte(0, &data);    /* waits for the last write cycle */
+	BENCH_report("byte writes", HOST_now() - start, BENCH_BYTE_WRITES, BENCH_BYTE_WRITES, status);
+
+	printf("host tick %u us, a single transaction is timed up to the next tick\n", HOST_TICK_US);
+	return 0;
+}
@@ -0,0 +1,1282 @@
+ /******************************************************************************
+ *
+ * Module: Host MCU Emulation
+ *
+ * File Name: host_mcu.c
+ *
+ * Description: Emulation of the ATmega32 peripherals used by the drivers, so
+ *              the unmodified ECU firmwares run as Linux processes.
+ *              A SIGALRM tick plays the part of the interrupt hardware: it
+ *              advances the timers, shifts UART characters in and out of the
+ *              line socket at the configured baud rate, completes TWI
+ *              operations against a 24C16 model and calls the firmware ISRs
+ *              while the I-bit in SREG is set. The keypad, PIR sensor and
+ *              LCD are emulated from the port registers.
+ *
+ * Author: Malik Anas
+ *
+ *******************************************************************************/
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "host_mcu.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+/* Most ISR calls per vector and tick, the rest is kept for the next tick */
+#define HOST_MAX_ISR_CALLS       64
+
+/* Marker in the reserved TWCR bit 1, set once host_mcu.c has taken the last write */
+#define HOST_TWCR_TAKEN          (1<<1)
+
+/* UDR value while it holds nothing new, see avr/io.h */
+#define HOST_UDR_EMPTY           0x100
+
+/* 24C16: 2 KiB in 8 blocks of 256 bytes, 16-byte pages, 5 ms write cycle */
+#define HOST_EEPROM_SIZE         2048
+#define HOST_EEPROM_PAGE_SIZE    16
+#define HOST_EEPROM_WRITE_NS     5000000ULL
+
+/* Keypad timing of the scripted user in emulated milliseconds */
+#define HOST_KEY_HOLD_MS         20
+#define HOST_KEY_GAP_MS          30
+#define HOST_KEY_PAUSE_MS        1000
+
+/* An LCD content held this long in emulated milliseconds is traced even without a delay */
+#define HOST_LCD_STILL_MS        100
+
+#define HOST_MS_TO_NS(ms)        ((uint64_t)(ms) * 1000000ULL)
+
+/*******************************************************************************
+ *                              Registers                                      *
+ *******************************************************************************/
+
+static volatile uint8_t g_sreg;
+volatile uint8_t DDRA, DDRB, DDRC, DDRD;
+volatile uint8_t PORTA, PORTB, PORTC, PORTD;
+volatile uint16_t UDR = HOST_UDR_EMPTY;
+volatile uint8_t UCSRA = (1<<UDRE), UCSRB, UCSRC, UBRRH, UBRRL;
+volatile uint8_t TWBR, TWSR, TWAR, TWDR;
+volatile uint8_t TCCR0, TCNT0, OCR0;
+volatile uint8_t TCCR1A, TCCR1B;
+volatile uint16_t TCNT1, OCR1A, OCR1B, ICR1;
+volatile uint8_t TCCR2, TCNT2, OCR2, ASSR;
+volatile uint8_t TIMSK, TIFR;
+volatile uint8_t MCUCR, MCUCSR, GICR, GIFR;
+
+/* Storage behind the TWCR accessor */
+static volatile uint8_t g_twcr = HOST_TWCR_TAKEN;
+
+/*******************************************************************************
+ *                       Interrupt Vectors                                     *
+ *******************************************************************************/
+
+/* Vectors the firmware does not define fall back to these */
+#define HOST_WEAK_VECTOR(vector)    void vector(void) __attribute__((weak)); void vector(void) {}
+
+HOST_WEAK_VECTOR(TIMER0_OVF_vect)
+HOST_WEAK_VECTOR(TIMER0_COMP_vect)
+HOST_WEAK_VECTOR(TIMER1_OVF_vect)
+HOST_WEAK_VECTOR(TIMER1_COMPA_vect)
+HOST_WEAK_VECTOR(TIMER2_OVF_vect)
+HOST_WEAK_VECTOR(TIMER2_COMP_vect)
+HOST_WEAK_VECTOR(USART_RXC_vect)
+HOST_WEAK_VECTOR(USART_UDRE_vect)
+HOST_WEAK_VECTOR(TWI_vect)
+
+/*******************************************************************************
+ *                               Types Declaration                             *
+ *******************************************************************************/
+
+typedef struct {
+	uint64_t last_cycle;       /* CPU cycle the counter was brought up to */
+	uint32_t compare_matches;  /* compare ISRs still to be called */
+	uint32_t overflows;        /* overflow ISRs still to be called */
+}HOST_TimerType;
+
+typedef struct {
+	uint8_t data;
+	uint8_t ninth_bit;
+	uint8_t frame_error;
+}HOST_RxCharType;
+
+typedef enum
+{
+	TWI_NO_OP,TWI_START_OP,TWI_STOP_OP,TWI_WRITE_OP,TWI_READ_ACK_OP,TWI_READ_NACK_OP
+}HOST_TwiOpType;
+
+/*******************************************************************************
+ *                           Global Variables                                  *
+ *******************************************************************************/
+
+/* Emulated time */
+static uint64_t g_epochNs;
+static double g_timeScale = 1.0;
+static uint64_t g_prevTickNs;
+static volatile sig_atomic_t g_tickDeferred;
+
+static int g_trace = 0;
+
+/* Timers 0, 1 and 2 */
+static HOST_TimerType g_timers[3];
+
+/* UART line and the transmit side: holding register and shift register */
+static int g_uartFd = -1;
+static uint8_t g_txHoldingFull;
+static HOST_WireCharType g_txHolding;
+static uint8_t g_txShiftBusy;
+static uint64_t g_txShiftEndNs;
+static HOST_WireCharType g_txShift;
+
+/* Receive side: characters on the line not due yet, and the two level receive FIFO */
+#define HOST_LINE_QUEUE_SIZE    1024
+static HOST_WireCharType g_rxLine[HOST_LINE_QUEUE_SIZE];
+static unsigned g_rxLineHead, g_rxLineTail;
+static HOST_RxCharType g_rxFifo[2];
+static unsigned g_rxFifoCount;
+
+/* TWI master and the 24C16 on the bus */
+static volatile sig_atomic_t g_twiBusy;
+static HOST_TwiOpType g_twiOp = TWI_NO_OP;
+static uint64_t g_twiDoneNs;
+static uint8_t g_twiBusActive;
+static uint8_t g_twiExpectAddress;
+static uint8_t g_twiSelected;
+static uint8_t g_twiRead;
+static uint8_t g_twiWordPhase;
+static uint8_t g_eeprom[HOST_EEPROM_SIZE];
+static uint16_t g_eepromAddress;
+static uint8_t g_eepromPage[HOST_EEPROM_PAGE_SIZE];
+static uint16_t g_eepromPageMask;
+static uint64_t g_eepromBusyUntilNs;
+static int g_eepromFd = -1;
+
+/* Injected bus faults: a stuck slave holding SDA low and NACKed data bytes */
+static unsigned g_twiHangEvery, g_twiNackEvery;
+static unsigned g_twiOps, g_twiDataBytes;
+static uint8_t g_twiStuck;
+static unsigned g_twiStuckClocks;
+static uint8_t g_sclLow;
+
+/* Keypad script */
+static const char * g_keys;
+static unsigned g_keyIndex;
+static int g_keyRow = -1, g_keyCol = -1;
+static uint8_t g_keySeen;
+static uint64_t g_keyReleaseNs, g_keyNextNs;
+static uint8_t g_keypadScanned;
+
+/* PIR: people stay in the doorway for g_pirMs after it opens */
+static uint64_t g_pirMs = 2000;
+static uint64_t g_pirLastReadNs, g_pirMotionEndNs;
+
+/* LCD decoded from PORTA and the RS/E pins on PORTC */
+static char g_lcd[2][17];
+static uint8_t g_lcdAddress;
+static uint8_t g_lcdLastE;
+static uint8_t g_lcdChanged;
+static uint64_t g_lcdChangedNs;
+
+/* Outputs watched for the trace */
+static uint8_t g_lastMotor, g_lastBuzzer;
+
+/* ISRs called so far, a sleeping CPU wakes up when it changes */
+static volatile uint32_t g_isrCalls;
+
+/*******************************************************************************
+ *                      Functions Definitions                                  *
+ *******************************************************************************/
+
+static uint64_t HOST_monotonic(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Description :
+ * Return the emulated time in nanoseconds since HOST_EPOCH_NS.
+ */
+uint64_t HOST_now(void)
+{
+	uint64_t mono = HOST_monotonic();
+
+	if(mono < g_epochNs)
+	{
+		return 0;
+	}
+	return (uint64_t)((double)(mono - g_epochNs) * g_timeScale);
+}
+
+/*
+ * Description :
+ * Print one event line stamped with the given emulated time on stderr when
+ * HOST_TRACE is set, safe inside the tick.
+ */
+static void HOST_vtrace(uint64_t ns, const char * format, va_list args)
+{
+	char line[160];
+	int length;
+
+	if(!g_trace)
+	{
+		return;
+	}
+
+	length = snprintf(line, sizeof(line), "[%10.3f ms] %-12s ", (double)ns / 1e6, program_invocation_short_name);
+	length += vsnprintf(line + length, sizeof(line) - (size_t)length - 1, format, args);
+	if(length > (int)sizeof(line) - 2)
+	{
+		length = (int)sizeof(line) - 2;
+	}
+	line[length++] = '\n';
+	if(write(STDERR_FILENO, line, (size_t)length) < 0)
+	{
+		/* Nothing to do about a lost trace line */
+	}
+}
+
+static void HOST_trace(const char * format, ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	HOST_vtrace(HOST_now(), format, args);
+	va_end(args);
+}
+
+static void HOST_traceAt(uint64_t ns, const char * format, ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	HOST_vtrace(ns, format, args);
+	va_end(args);
+}
+
+/*
+ * Description :
+ * Advance a counter by the given number of timer clocks, counting compare
+ * matches and overflows. In CTC mode the counter clears after reaching top.
+ */
+static uint32_t HOST_countTimer(uint32_t count, uint32_t top, uint32_t compare, uint8_t ctc,
+		uint64_t clocks, HOST_TimerType * timer)
+{
+	while(clocks > 0)
+	{
+		uint64_t to_wrap = (uint64_t)(top - count) + 1;
+		uint64_t step = (clocks < to_wrap) ? clocks : to_wrap;
+
+		if(!ctc && (compare > count) && (compare <= count + step))
+		{
+			timer->compare_matches++;
+		}
+		count += (uint32_t)step;
+		clocks -= step;
+		if(count > top)
+		{
+			count = 0;
+			if(ctc)
+			{
+				timer->compare_matches++;
+			}
+			else
+			{
+				timer->overflows++;
+			}
+		}
+	}
+	return count;
+}
+
+/*
+ * Description :
+ * Timer clocks since the last update for the given prescaler, 0 if the timer is stopped.
+ */
+static uint64_t HOST_timerClocks(HOST_TimerType * timer, uint64_t cycle, uint32_t prescaler)
+{
+	uint64_t clocks = 0;
+
+	if(prescaler != 0)
+	{
+		clocks = cycle / prescaler - timer->last_cycle / prescaler;
+	}
+	timer->last_cycle = cycle;
+	return clocks;
+}
+
+/*
+ * Description :
+ * Call an ISR for every pending event while it is enabled, like the interrupt
+ * flag would, and forget the events of a disabled interrupt. Its TIFR flag is
+ * cleared once every event was handled, like the vector clears it, and stays
+ * set for a disabled interrupt as long as the firmware does not clear it.
+ */
+static void HOST_deliver(uint32_t * pending, uint8_t enabled, uint8_t interrupts_on, void (*vector)(void),
+		uint8_t flag)
+{
+	uint32_t calls = 0;
+
+	if(!enabled)
+	{
+		*pending = 0;
+		return;
+	}
+
+	while(interrupts_on && (*pending > 0) && (calls < HOST_MAX_ISR_CALLS))
+	{
+		(*pending)--;
+		calls++;
+		g_isrCalls++;
+		vector();
+	}
+	if(*pending == 0)
+	{
+		TIFR &= (uint8_t)~flag;
+	}
+}
+
+static void HOST_runTimers(uint64_t now, uint8_t interrupts_on)
+{
+	static const uint32_t prescalers[8] = {0, 1, 8, 64, 256, 1024, 0, 0};
+	static const uint32_t timer2_prescalers[8] = {0, 1, 8, 32, 64, 128, 256, 1024};
+	uint64_t cycle = now / 1000ULL * (F_CPU / 1000000UL);
+	uint64_t clocks;
+	uint8_t ctc;
+
+	/* Timer0, CTC with WGM01 alone, the PWM modes count up to 0xFF */
+	clocks = HOST_timerClocks(&g_timers[0], cycle, prescalers[TCCR0 & 0x07]);
+	ctc = (TCCR0 & (1<<WGM01)) && !(TCCR0 & (1<<WGM00));
+	TCNT0 = (uint8_t)HOST_countTimer(TCNT0, ctc ? OCR0 : 0xFF, OCR0, ctc, clocks, &g_timers[0]);
+
+	/* Timer1, CTC with WGM12 and OCR1A as top */
+	clocks = HOST_timerClocks(&g_timers[1], cycle, prescalers[TCCR1B & 0x07]);
+	ctc = (TCCR1B & (1<<WGM12)) != 0;
+	TCNT1 = (uint16_t)HOST_countTimer(TCNT1, ctc ? OCR1A : 0xFFFF, OCR1A, ctc, clocks, &g_timers[1]);
+
+	/* Timer2 has its own prescaler table */
+	clocks = HOST_timerClocks(&g_timers[2], cycle, timer2_prescalers[TCCR2 & 0x07]);
+	ctc = (TCCR2 & (1<<WGM21)) && !(TCCR2 & (1<<WGM20));
+	TCNT2 = (uint8_t)HOST_countTimer(TCNT2, ctc ? OCR2 : 0xFF, OCR2, ctc, clocks, &g_timers[2]);
+
+	if(g_timers[0].compare_matches) TIFR |= (1<<OCF0);
+	if(g_timers[0].overflows)       TIFR |= (1<<TOV0);
+	if(g_timers[1].compare_matches) TIFR |= (1<<OCF1A);
+	if(g_timers[1].overflows)       TIFR |= (1<<TOV1);
+	if(g_timers[2].compare_matches) TIFR |= (1<<OCF2);
+	if(g_timers[2].overflows)       TIFR |= (1<<TOV2);
+
+	HOST_deliver(&g_timers[0].compare_matches, TIMSK & (1<<OCIE0), interrupts_on, TIMER0_COMP_vect, 1<<OCF0);
+	HOST_deliver(&g_timers[0].overflows, TIMSK & (1<<TOIE0), interrupts_on, TIMER0_OVF_vect, 1<<TOV0);
+	HOST_deliver(&g_timers[1].compare_matches, TIMSK & (1<<OCIE1A), interrupts_on, TIMER1_COMPA_vect, 1<<OCF1A);
+	HOST_deliver(&g_timers[1].overflows, TIMSK & (1<<TOIE1), interrupts_on, TIMER1_OVF_vect, 1<<TOV1);
+	HOST_deliver(&g_timers[2].compare_matches, TIMSK & (1<<OCIE2), interrupts_on, TIMER2_COMP_vect, 1<<OCF2);
+	HOST_deliver(&g_timers[2].overflows, TIMSK & (1<<TOIE2), interrupts_on, TIMER2_OVF_vect, 1<<TOV2);
+}
+
+/*
+ * Description :
+ * Character configuration of this node as sent on the line.
+ */
+static uint16_t HOST_uartConfig(void)
+{
+	uint16_t ubrr = (uint16_t)(((UBRRH & 0x0F) << 8) | UBRRL);
+	uint16_t size = (uint16_t)((((UCSRB >> UCSZ2) & 1) << 2) | ((UCSRC >> UCSZ0) & 3));
+
+	return (uint16_t)((ubrr & HOST_WIRE_UBRR_MASK) | ((UCSRA & (1<<U2X)) ? HOST_WIRE_U2X : 0) |
+			(size << HOST_WIRE_SIZE_SHIFT));
+}
+
+/*
+ * Description :
+ * Time one character takes on the line with the current UART settings.
+ */
+static uint64_t HOST_uartCharNs(void)
+{
+	uint32_t ubrr = (uint32_t)(((UBRRH & 0x0F) << 8) | UBRRL);
+	uint32_t divider = (UCSRA & (1<<U2X)) ? 8 : 16;
+	uint8_t size = (uint8_t)((((UCSRB >> UCSZ2) & 1) << 2) | ((UCSRC >> UCSZ0) & 3));
+	uint32_t bits = 1 + ((size == 7) ? 9 : (size + 5)) + ((UCSRC & (1<<UPM1)) ? 1 : 0) + ((UCSRC & (1<<USBS)) ? 2 : 1);
+
+	/* bits * divider * (UBRR + 1) CPU cycles */
+	return (uint64_t)bits * divider * (ubrr + 1) * 1000000000ULL / F_CPU;
+}
+
+static void HOST_uartTransmit(uint64_t now, uint8_t interrupts_on)
+{
+	unsigned rounds;
+
+	for(rounds = 0; rounds < 256; rounds++)
+	{
+		/* A byte the firmware wrote to UDR goes to the holding register */
+		if(UDR < HOST_UDR_EMPTY)
+		{
+			g_txHolding.data = (uint8_t)UDR;
+			g_txHolding.ninth_bit = (UCSRB & (1<<TXB8)) ? 1 : 0;
+			g_txHoldingFull = 1;
+			UDR = HOST_UDR_EMPTY;
+			UCSRA &= (uint8_t)~(1<<TXC);
+		}
+
+		/* The shift register finished a character, put it on the line */
+		if(g_txShiftBusy && (g_txShiftEndNs <= now))
+		{
+			g_txShiftBusy = 0;
+			if(g_uartFd >= 0)
+			{
+				if(write(g_uartFd, &g_txShift, sizeof(g_txShift)) < 0)
+				{
+					/* The other end is gone, the line is dead */
+				}
+			}
+			if(!g_txHoldingFull)
+			{
+				UCSRA |= (1<<TXC);
+			}
+		}
+
+		/* Start the next character right after the last one, or at the previous tick when idle */
+		if(!g_txShiftBusy && g_txHoldingFull && (UCSRB & (1<<TXEN)))
+		{
+			uint64_t start = (g_txShiftEndNs > g_prevTickNs) ? g_txShiftEndNs : g_prevTickNs;
+
+			g_txShift = g_txHolding;
+			g_txShift.config = HOST_uartConfig();
+			g_txShiftEndNs = start + HOST_uartCharNs();
+			g_txShift.end_ns = g_txShiftEndNs;
+			g_txShiftBusy = 1;
+			g_txHoldingFull = 0;
+			continue;
+		}
+
+		if(g_txHoldingFull)
+		{
+			UCSRA &= (uint8_t)~(1<<UDRE);
+		}
+		else
+		{
+			UCSRA |= (1<<UDRE);
+		}
+
+		/* UDR is empty, let the UDRE ISR fill it */
+		if(!g_txHoldingFull && interrupts_on && (UCSRB & (1<<UDRIE)))
+		{
+			g_isrCalls++;
+			USART_UDRE_vect();
+			if(UDR < HOST_UDR_EMPTY)
+			{
+				continue;
+			}
+		}
+		break;
+	}
+}
+
+static void HOST_uartReceive(uint64_t now, uint8_t interrupts_on)
+{
+	HOST_WireCharType wire;
+
+	/* Collect what arrived on the line */
+	while(g_uartFd >= 0)
+	{
+		ssize_t got = recv(g_uartFd, &wire, sizeof(wire), MSG_DONTWAIT);
+		if(got != (ssize_t)sizeof(wire))
+		{
+			break;
+		}
+		if(((g_rxLineHead + 1) % HOST_LINE_QUEUE_SIZE) != g_rxLineTail)
+		{
+			g_rxLine[g_rxLineHead] = wire;
+			g_rxLineHead = (g_rxLineHead + 1) % HOST_LINE_QUEUE_SIZE;
+		}
+	}
+
+	/*
+	 * Characters whose stop bit has passed enter the receiver one by one.
+	 * A node that did not get the CPU for a while catches up in one tick,
+	 * so a character stays on the line until the ISR took the one before
+	 * it, instead of overrunning the FIFO or meeting a stale MPCM, which
+	 * the real line spacing would have prevented.
+	 */
+	for(;;)
+	{
+		HOST_RxCharType received;
+
+		/* Deliver what the receiver holds, the ISR may change MPCM for the next character */
+		while((g_rxFifoCount > 0) && interrupts_on && (UCSRB & (1<<RXCIE)))
+		{
+			UCSRA = (uint8_t)((UCSRA & ~((1<<FE) | (1<<DOR) | (1<<PE))) | (1<<RXC) |
+					(g_rxFifo[0].frame_error ? (1<<FE) : 0));
+			if(g_rxFifo[0].ninth_bit)
+			{
+				UCSRB |= (1<<RXB8);
+			}
+			else
+			{
+				UCSRB &= (uint8_t)~(1<<RXB8);
+			}
+			UDR = g_rxFifo[0].data;
+			g_isrCalls++;
+			USART_RXC_vect();
+			UDR = HOST_UDR_EMPTY;
+			g_rxFifo[0] = g_rxFifo[1];
+			g_rxFifoCount--;
+		}
+
+		if((g_rxFifoCount > 0) || (g_rxLineTail == g_rxLineHead) || (g_rxLine[g_rxLineTail].end_ns > now))
+		{
+			break;
+		}
+
+		wire = g_rxLine[g_rxLineTail];
+		g_rxLineTail = (g_rxLineTail + 1) % HOST_LINE_QUEUE_SIZE;
+
+		if(!(UCSRB & (1<<RXEN)))
+		{
+			continue;
+		}
+
+		/* A receiver on another baud rate or size samples garbage */
+		received.data = wire.data;
+		received.ninth_bit = wire.ninth_bit;
+		received.frame_error = (wire.config != HOST_uartConfig());
+		if(received.frame_error)
+		{
+			received.data ^= 0x5A;
+		}
+
+		/* In multi-processor mode only address characters get through */
+		if((UCSRA & (1<<MPCM)) && !received.ninth_bit)
+		{
+			continue;
+		}
+
+		g_rxFifo[g_rxFifoCount++] = received;
+	}
+
+	if(g_rxFifoCount > 0)
+	{
+		UCSRA |= (1<<RXC);
+	}
+	else
+	{
+		UCSRA &= (uint8_t)~(1<<RXC);
+	}
+}
+
+/*
+ * Description :
+ * Store the page buffer of a finished write and start the write cycle.
+ */
+static void HOST_eepromCommit(uint64_t now)
+{
+	uint16_t base = (uint16_t)(g_eepromAddress & ~(HOST_EEPROM_PAGE_SIZE - 1));
+	unsigned i;
+
+	if(g_eepromPageMask == 0)
+	{
+		return;
+	}
+
+	for(i = 0; i < HOST_EEPROM_PAGE_SIZE; i++)
+	{
+		if(g_eepromPageMask & (1u << i))
+		{
+			g_eeprom[base + i] = g_eepromPage[i];
+		}
+	}
+	g_eepromPageMask = 0;
+	g_eepromBusyUntilNs = now + HOST_EEPROM_WRITE_NS;
+
+	if(g_eepromFd >= 0)
+	{
+		if(pwrite(g_eepromFd, &g_eeprom[base], HOST_EEPROM_PAGE_SIZE, base) < 0)
+		{
+			/* The image file is only a convenience */
+		}
+	}
+}
+
+/*
+ * Description :
+ * Carry out a TWI operation on the bus with the 24C16 as the only slave.
+ */
+static void HOST_twiExecute(HOST_TwiOpType op, uint64_t now)
+{
+	uint8_t status = 0xF8;
+
+	switch(op)
+	{
+	case TWI_START_OP:
+		/* A repeated start drops page data that was never closed by a stop */
+		status = g_twiBusActive ? 0x10 : 0x08;
+		g_twiBusActive = 1;
+		g_twiExpectAddress = 1;
+		g_twiSelected = 0;
+		g_eepromPageMask = 0;
+		break;
+	case TWI_STOP_OP:
+		if(g_twiSelected && !g_twiRead)
+		{
+			HOST_eepromCommit(now);
+		}
+		g_twiBusActive = 0;
+		g_twiSelected = 0;
+		status = 0xF8;
+		break;
+	case TWI_WRITE_OP:
+		if(g_twiExpectAddress)
+		{
+			g_twiExpectAddress = 0;
+			g_twiRead = TWDR & 1;
+			/* The 24C16 answers 1010xxx, but not during its write cycle */
+			if(((TWDR & 0xF0) == 0xA0) && (now >= g_eepromBusyUntilNs))
+			{
+				g_twiSelected = 1;
+				g_twiWordPhase = !g_twiRead;
+				g_eepromAddress = (uint16_t)((((TWDR >> 1) & 0x07) << 8) | (g_eepromAddress & 0xFF));
+				status = g_twiRead ? 0x40 : 0x18;
+			}
+			else
+			{
+				g_twiSelected = 0;
+				status = g_twiRead ? 0x48 : 0x20;
+			}
+		}
+		else if(g_twiSelected && !g_twiRead)
+		{
+			if(g_twiWordPhase)
+			{
+				g_eepromAddress = (uint16_t)((g_eepromAddress & 0x700) | TWDR);
+				g_twiWordPhase = 0;
+			}
+			else if(g_twiNackEvery && ((++g_twiDataBytes % g_twiNackEvery) == 0))
+			{
+				HOST_trace("TWI data byte NACKed");
+				status = 0x30;
+				break;
+			}
+			else
+			{
+				/* Page write, the address rolls over inside the page */
+				uint8_t offset = (uint8_t)(g_eepromAddress & (HOST_EEPROM_PAGE_SIZE - 1));
+				g_eepromPage[offset] = TWDR;
+				g_eepromPageMask |= (uint16_t)(1u << offset);
+				g_eepromAddress = (uint16_t)((g_eepromAddress & ~(HOST_EEPROM_PAGE_SIZE - 1)) |
+						((offset + 1) & (HOST_EEPROM_PAGE_SIZE - 1)));
+			}
+			status = 0x28;
+		}
+		else
+		{
+			status = 0x30;
+		}
+		break;
+	case TWI_READ_ACK_OP:
+	case TWI_READ_NACK_OP:
+		if(g_twiSelected && g_twiRead)
+		{
+			TWDR = g_eeprom[g_eepromAddress];
+			g_eepromAddress = (uint16_t)((g_eepromAddress + 1) & (HOST_EEPROM_SIZE - 1));
+		}
+		else
+		{
+			TWDR = 0xFF;
+		}
+		status = (op == TWI_READ_ACK_OP) ? 0x50 : 0x58;
+		break;
+	case TWI_NO_OP:
+		break;
+	}
+
+	TWSR = (uint8_t)((TWSR & 0x03) | status);
+}
+
+/*
+ * Description :
+ * Take a new TWCR write, as if written at start_ns, and finish the running
+ * operation once its bus time is over.
+ */
+static void HOST_twiUpdate(uint64_t now, uint64_t start_ns)
+{
+	if(!(g_twcr & HOST_TWCR_TAKEN))
+	{
+		uint8_t command = g_twcr;
+
+		/* A stop is written without waiting for it, finish it before the next command */
+		if(g_twiOp == TWI_STOP_OP)
+		{
+			g_twiOp = TWI_NO_OP;
+			HOST_twiExecute(TWI_STOP_OP, start_ns);
+		}
+
+		g_twcr = (uint8_t)((command & ~(1<<TWINT)) | HOST_TWCR_TAKEN);
+
+		/* Turning the TWI off abandons the transfer, an unfinished page is never written */
+		if(!(command & (1<<TWEN)))
+		{
+			g_twiOp = TWI_NO_OP;
+			g_twiBusActive = 0;
+			g_twiSelected = 0;
+			g_eepromPageMask = 0;
+		}
+		else if(g_twiStuck)
+		{
+			/* SDA is held low, nothing the TWI does gets through */
+		}
+		else if(command & (1<<TWINT))
+		{
+			/* SCL = F_CPU / (16 + 2 * TWBR * 4^TWPS), a byte and its ACK take 9 clocks */
+			uint64_t scl_ns = (16ULL + 2ULL * TWBR * (1ULL << (2 * (TWSR & 0x03)))) * 1000000000ULL / F_CPU;
+
+			if(command & (1<<TWSTA))
+			{
+				/* With TWSTO as well the STOP goes out first and the START follows */
+				if(command & (1<<TWSTO))
+				{
+					HOST_twiExecute(TWI_STOP_OP, start_ns);
+					start_ns += scl_ns;
+				}
+				g_twiOp = TWI_START_OP;
+			}
+			else if(command & (1<<TWSTO))
+			{
+				g_twiOp = TWI_STOP_OP;
+			}
+			else if(g_twiRead && !g_twiExpectAddress)
+			{
+				g_twiOp = (command & (1<<TWEA)) ? TWI_READ_ACK_OP : TWI_READ_NACK_OP;
+			}
+			else
+			{
+				g_twiOp = TWI_WRITE_OP;
+			}
+			g_twiDoneNs = start_ns + (((g_twiOp == TWI_START_OP) || (g_twiOp == TWI_STOP_OP)) ? 1 : 9) * scl_ns;
+
+			if(g_twiHangEvery && ((++g_twiOps % g_twiHangEvery) == 0))
+			{
+				/* The slave lets go after finishing its byte, up to 9 clocks */
+				g_twiStuck = 1;
+				g_twiStuckClocks = 1 + g_twiOps % 9;
+				g_twiOp = TWI_NO_OP;
+				HOST_trace("TWI bus stuck, SDA low");
+			}
+		}
+	}
+
+	if((g_twiOp != TWI_NO_OP) && (now >= g_twiDoneNs))
+	{
+		HOST_TwiOpType op = g_twiOp;
+
+		g_twiOp = TWI_NO_OP;
+		HOST_twiExecute(op, g_twiDoneNs);
+		g_twcr &= (uint8_t)~((1<<TWSTA) | (1<<TWSTO));
+		if(op != TWI_STOP_OP)
+		{
+			g_twcr |= (1<<TWINT);
+		}
+	}
+}
+
+/*
+ * Description :
+ * TWCR accessor, a pending command is carried out before TWCR is used.
+ */
+volatile uint8_t * HOST_twcr(void)
+{
+	uint64_t now = HOST_now();
+
+	g_twiBusy = 1;
+	HOST_twiUpdate(now, now);
+	g_twiBusy = 0;
+	return &g_twcr;
+}
+
+static void HOST_runTwi(uint64_t now, uint8_t interrupts_on)
+{
+	unsigned steps;
+
+	/* The firmware is inside HOST_twcr, it finishes the update itself */
+	if(g_twiBusy)
+	{
+		return;
+	}
+
+	HOST_twiUpdate(now, now);
+
+	/*
+	 * Every operation that ended since the last tick gets its ISR call, the
+	 * command the ISR writes starts when the operation ended, so a whole
+	 * transaction is not stretched to one byte per tick.
+	 */
+	for(steps = 0; (steps < HOST_MAX_ISR_CALLS) && interrupts_on && (g_twcr & (1<<TWIE)) && (g_twcr & (1<<TWINT)); steps++)
+	{
+		uint64_t ended_ns = g_twiDoneNs;
+
+		g_isrCalls++;
+		TWI_vect();
+		g_twiBusy = 1;
+		HOST_twiUpdate(now, ended_ns);
+		g_twiBusy = 0;
+	}
+}
+
+/*
+ * Description :
+ * Print the LCD once the firmware holds it still, if it changed, stamped
+ * with the time it got its last character. The tick may call it as well.
+ */
+static void HOST_lcdShow(void)
+{
+	if(__atomic_exchange_n(&g_lcdChanged, 0, __ATOMIC_SEQ_CST))
+	{
+		HOST_traceAt(g_lcdChangedNs, "LCD |%-16s|%-16s|", g_lcd[0], g_lcd[1]);
+	}
+}
+
+/*
+ * Description :
+ * Watch the E pin of the LCD and latch a command or character on its falling edge.
+ */
+static void HOST_lcdSample(void)
+{
+	uint8_t e = (PORTC & (1<<PC1)) && (DDRC & (1<<PC1));
+
+	if(g_lcdLastE && !e)
+	{
+		uint8_t value = PORTA;
+
+		if(PORTC & (1<<PC0))
+		{
+			uint8_t row = (g_lcdAddress >= 0x40) ? 1 : 0;
+			uint8_t col = (uint8_t)(g_lcdAddress & 0x3F);
+			if(col < 16)
+			{
+				g_lcd[row][col] = (char)value;
+				g_lcdChangedNs = HOST_now();
+				g_lcdChanged = 1;
+			}
+			g_lcdAddress++;
+		}
+		else if(value == 0x01)
+		{
+			memset(g_lcd, 0, sizeof(g_lcd));
+			g_lcdAddress = 0;
+			g_lcdChangedNs = HOST_now();
+			g_lcdChanged = 1;
+		}
+		else if(value & 0x80)
+		{
+			g_lcdAddress = value & 0x7F;
+		}
+	}
+	g_lcdLastE = e;
+}
+
+/*
+ * Description :
+ * Busy wait for the given emulated time, used by _delay_ms and _delay_us.
+ */
+void HOST_delayMicroseconds(double us)
+{
+	uint64_t end = HOST_now() + (uint64_t)(us * 1000.0);
+	uint64_t now;
+
+	HOST_lcdSample();
+	if(DDRC & (1<<PC0))
+	{
+		g_sclLow = 1;
+	}
+	if(us >= 100000.0)
+	{
+		HOST_lcdShow();
+	}
+
+	while((now = HOST_now()) < end)
+	{
+		double wall_ns = (double)(end - now) / g_timeScale;
+		struct timespec pause = {0, (wall_ns > 200000.0) ? 200000L : (long)wall_ns};
+		nanosleep(&pause, NULL);
+	}
+}
+
+/*
+ * Description :
+ * Keypad position of a script character, '#' stands for ENTER.
+ */
+static int HOST_keyPosition(char key, int * row, int * col)
+{
+	static const char layout[4][5] = {"789%", "456*", "123-", "#0=+"};
+	int r, c;
+
+	for(r = 0; r < 4; r++)
+	{
+		for(c = 0; c < 4; c++)
+		{
+			if(layout[r][c] == key)
+			{
+				*row = r;
+				*col = c;
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+/*
+ * Description :
+ * Play the keypad script: a key is pressed while the firmware scans, held
+ * until the scan saw it, then released. '.' pauses for a second. The node
+ * exits once the script is used up and the firmware waits for a key again.
+ */
+static void HOST_keypadUpdate(uint64_t now)
+{
+	if(!g_keypadScanned)
+	{
+		g_keypadScanned = 1;
+		HOST_trace("KEYPAD first scan");
+	}
+
+	if((g_keyRow >= 0) && g_keySeen && (now >= g_keyReleaseNs))
+	{
+		g_keyRow = -1;
+		g_keyNextNs = now + HOST_MS_TO_NS(HOST_KEY_GAP_MS);
+	}
+
+	if((g_keyRow >= 0) || (g_keys == NULL) || (now < g_keyNextNs))
+	{
+		return;
+	}
+
+	HOST_lcdShow();
+
+	while(g_keys[g_keyIndex] != '\0')
+	{
+		char key = g_keys[g_keyIndex++];
+
+		if(key == '.')
+		{
+			g_keyNextNs = now + HOST_MS_TO_NS(HOST_KEY_PAUSE_MS);
+			return;
+		}
+		if(HOST_keyPosition(key, &g_keyRow, &g_keyCol))
+		{
+			g_keySeen = 0;
+			HOST_trace("KEY %c", key);
+			return;
+		}
+	}
+
+	HOST_trace("keypad script done");
+	exit(0);
+}
+
+/*
+ * Description :
+ * Return the level of the pins of a port as the board drives them.
+ */
+uint8_t HOST_readPins(uint8_t port)
+{
+	uint64_t now = HOST_now();
+	uint8_t value = 0;
+	int col;
+
+	switch(port)
+	{
+	case 0:
+		value = PORTA;
+		break;
+
+	case 1:
+		/* Keypad rows on PB0-PB3, columns on PB4-PB7 with pull-ups */
+		HOST_keypadUpdate(now);
+		value = (uint8_t)((PORTB & DDRB) | (~DDRB & 0xF0));
+		if((g_keyRow >= 0) && (DDRB & (1 << g_keyRow)) && !(PORTB & (1 << g_keyRow)))
+		{
+			col = 4 + g_keyCol;
+			if(!(DDRB & (1 << col)))
+			{
+				value &= (uint8_t)~(1 << col);
+				if(!g_keySeen)
+				{
+					g_keySeen = 1;
+					g_keyReleaseNs = now + HOST_MS_TO_NS(HOST_KEY_HOLD_MS);
+				}
+			}
+		}
+		break;
+
+	case 2:
+		/* PIR on PC2, a read after a quiet spell means the door just opened */
+		value = PORTC;
+		if(!(DDRC & (1<<PC2)))
+		{
+			if(now - g_pirLastReadNs > HOST_MS_TO_NS(100))
+			{
+				g_pirMotionEndNs = now + HOST_MS_TO_NS(g_pirMs);
+				HOST_trace("PIR motion for %llu ms", (unsigned long long)g_pirMs);
+			}
+			g_pirLastReadNs = now;
+			if(now < g_pirMotionEndNs)
+			{
+				value |= (1<<PC2);
+			}
+			else
+			{
+				value &= (uint8_t)~(1<<PC2);
+			}
+		}
+
+		/*
+		 * TWI pins when the TWI is off, open drain with pull-ups. A stuck
+		 * slave counts the SCL pulses, SCL low was seen by a delay in between.
+		 */
+		if(!(g_twcr & (1<<TWEN)))
+		{
+			if(DDRC & (1<<PC0))
+			{
+				g_sclLow = 1;
+			}
+			else if(g_sclLow)
+			{
+				g_sclLow = 0;
+				if(g_twiStuck && (--g_twiStuckClocks == 0))
+				{
+					g_twiStuck = 0;
+					HOST_trace("TWI bus released");
+				}
+			}
+		}
+		value = (uint8_t)((value & ~((1<<PC0) | (1<<PC1))) |
+				((DDRC & (1<<PC0)) ? 0 : (1<<PC0)) |
+				(((DDRC & (1<<PC1)) || g_twiStuck) ? 0 : (1<<PC1)));
+		break;
+
+	case 3:
+		value = PORTD;
+		break;
+	}
+
+	return value;
+}
+
+/*
+ * Description :
+ * Trace the door motor (PD6/PD7) and buzzer (PC7) when they change.
+ */
+static void HOST_watchOutputs(uint64_t now)
+{
+	static const char * const motor_states[4] = {"STOP", "ANTICLOCKWISE", "CLOCKWISE", "BRAKE"};
+	uint8_t motor = (DDRD & 0xC0) ? (uint8_t)((PORTD >> 6) & 0x03) : 0;
+	uint8_t buzzer = (DDRC & (1<<PC7)) ? ((PORTC >> PC7) & 1) : 0;
+
+	if(motor != g_lastMotor)
+	{
+		g_lastMotor = motor;
+		HOST_trace("MOTOR %s", motor_states[motor]);
+	}
+	if(buzzer != g_lastBuzzer)
+	{
+		g_lastBuzzer = buzzer;
+		HOST_trace("BUZZER %s", buzzer ? "ON" : "OFF");
+	}
+
+	/* An LCD the firmware holds still without a long delay, like while it polls the link */
+	if(g_lcdChanged && (now > g_lcdChangedNs) && ((now - g_lcdChangedNs) >= HOST_MS_TO_NS(HOST_LCD_STILL_MS)))
+	{
+		HOST_lcdShow();
+	}
+}
+
+/*
+ * Description :
+ * Peripheral tick, runs like an interrupt on top of the firmware.
+ */
+static void HOST_tick(int signal_number)
+{
+	int saved_errno = errno;
+	uint64_t now = HOST_now();
+	uint8_t sreg = g_sreg;
+	uint8_t interrupts_on = (sreg & (1<<7)) != 0;
+
+	(void)signal_number;
+
+	/* The ISRs that could not run now run when the firmware sets the I-bit again */
+	g_tickDeferred = !interrupts_on;
+
+	/* ISRs run with the I-bit cleared and SREG restored afterwards, like RETI */
+	g_sreg = (uint8_t)(sreg & ~(1<<7));
+
+	HOST_runTimers(now, interrupts_on);
+	HOST_uartTransmit(now, interrupts_on);
+	HOST_uartReceive(now, interrupts_on);
+	HOST_runTwi(now, interrupts_on);
+	HOST_watchOutputs(now);
+
+	g_sreg = sreg;
+	g_prevTickNs = now;
+
+	errno = saved_errno;
+}
+
+/*
+ * Description :
+ * SREG accessor, runs a deferred tick once the I-bit is set, SIGALRM is
+ * blocked meanwhile so it is not run twice at the same time.
+ */
+volatile uint8_t * HOST_sreg(void)
+{
+	sigset_t alarm_set;
+	sigset_t saved_set;
+
+	if(g_tickDeferred && (g_sreg & (1<<7)))
+	{
+		sigemptyset(&alarm_set);
+		sigaddset(&alarm_set, SIGALRM);
+		sigprocmask(SIG_BLOCK, &alarm_set, &saved_set);
+		if(g_tickDeferred && (g_sreg & (1<<7)))
+		{
+			HOST_tick(SIGALRM);
+		}
+		sigprocmask(SIG_SETMASK, &saved_set, NULL);
+	}
+	return &g_sreg;
+}
+
+/*
+ * Description :
+ * Read the environment and start the peripheral tick before main runs.
+ */
+__attribute__((constructor)) static void HOST_init(void)
+{
+	const char * value;
+	struct sigaction action;
+	struct itimerval period;
+
+	g_epochNs = HOST_monotonic();
+	if((value = getenv(HOST_ENV_EPOCH_NS)) != NULL)
+	{
+		g_epochNs = strtoull(value, NULL, 10);
+	}
+	if((value = getenv(HOST_ENV_TIME_SCALE)) != NULL)
+	{
+		g_timeScale = strtod(value, NULL);
+		if(g_timeScale <= 0.0)
+		{
+			g_timeScale = 1.0;
+		}
+	}
+	if((value = getenv(HOST_ENV_UART_FD)) != NULL)
+	{
+		g_uartFd = atoi(value);
+	}
+	if((value = getenv(HOST_ENV_PIR_MS)) != NULL)
+	{
+		g_pirMs = strtoull(value, NULL, 10);
+	}
+	if((value = getenv(HOST_ENV_TWI_HANG)) != NULL)
+	{
+		g_twiHangEvery = (unsigned)atoi(value);
+	}
+	if((value = getenv(HOST_ENV_TWI_NACK)) != NULL)
+	{
+		g_twiNackEvery = (unsigned)atoi(value);
+	}
+	g_keys = getenv(HOST_ENV_KEYS);
+	g_trace = (getenv(HOST_ENV_TRACE) != NULL);
+	g_prevTickNs = HOST_now();
+
+	/* A blank 24C16 reads 0xFF, the image file keeps it between runs */
+	memset(g_eeprom, 0xFF, sizeof(g_eeprom));
+	if((value = getenv(HOST_ENV_EEPROM)) != NULL)
+	{
+		g_eepromFd = open(value, O_RDWR | O_CREAT, 0644);
+		if((g_eepromFd >= 0) && (pread(g_eepromFd, g_eeprom, sizeof(g_eeprom), 0) != (ssize_t)sizeof(g_eeprom)))
+		{
+			memset(g_eeprom, 0xFF, sizeof(g_eeprom));
+			if(pwrite(g_eepromFd, g_eeprom, sizeof(g_eeprom), 0) < 0)
+			{
+				close(g_eepromFd);
+				g_eepromFd = -1;
+			}
+		}
+	}
+
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = HOST_tick;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGALRM, &action, NULL);
+
+	period.it_interval.tv_sec = 0;
+	period.it_interval.tv_usec = HOST_TICK_US;
+	period.it_value = period.it_interval;
+	setitimer(ITIMER_REAL, &period, NULL);
+}
+
+/*
+ * Description :
+ * The SLEEP instruction: with SE in MCUCR and the I-bit set, wait until an ISR
+ * was called. The process sleeps meanwhile instead of spinning.
+ */
+void HOST_sleep(void)
+{
+	uint32_t calls = g_isrCalls;
+
+	if(!(MCUCR & (1<<SE)) || !(g_sreg & (1<<7)))
+	{
+		return;
+	}
+
+	/* Every peripheral tick ends a pause, a tick that came before it only makes it one tick late */
+	while(g_isrCalls == calls)
+	{
+		pause();
+	}
+}
+
+/*
+ * Description :
+ * The avr-libc itoa used by the LCD driver, glibc has none.
+ */
+char * itoa(int value, char * buffer, int radix)
+{
+	char digits[34];
+	unsigned magnitude = (value < 0 && radix == 10) ? (unsigned)(-(long)value) : (unsigned)value;
+	int length = 0;
+	int i = 0;
+
+	do
+	{
+		unsigned digit = magnitude % (unsigned)radix;
+		digits[length++] = (char)((digit < 10) ? ('0' + digit) : ('a' + digit - 10));
+		magnitude /= (unsigned)radix;
+	}while(magnitude != 0);
+
+	if(value < 0 && radix == 10)
+	{
+		buffer[i++] = '-';
+	}
+	while(length > 0)
+	{
+		buffer[i++] = digits[--length];
+	}
+	buffer[i] = '\0';
+	return buffer;
+}
@@ -0,0 +1,98 @@
+ /******************************************************************************
+ *
+ * Module: Host MCU Emulation
+ *
+ * File Name: host_mcu.h
+ *
+ * Description: Header file for running the ECU firmwares as Linux processes.
+ *              host_mcu.c emulates the ATmega32 peripherals the drivers use,
+ *              the UART line is a Unix socket carrying one HOST_WireCharType
+ *              per character, so link_bench can wire several nodes together.
+ *
+ * Author: Malik Anas
+ *
+ *******************************************************************************/
+
+#ifndef HOST_MCU_H_
+#define HOST_MCU_H_
+
+#include <stdint.h>
+
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+/*
+ * Environment of an emulated node:
+ * HOST_UART_FD     socket of the UART line, no line if unset
+ * HOST_EPOCH_NS    CLOCK_MONOTONIC time that is emulated time zero, shared by all nodes
+ * HOST_TIME_SCALE  emulated seconds per wall clock second, 1 by default
+ * HOST_KEYS        keypad script, see host_mcu.c, the node exits once it is used up
+ * HOST_PIR_MS      time people stay in the doorway after it opens, 2000 by default
+ * HOST_EEPROM      file that keeps the 24C16 contents between runs
+ * HOST_TRACE       print LCD, keypad, motor and buzzer events on stderr when set
+ * HOST_TWI_HANG    every Nth TWI operation never ends and a slave holds SDA low
+ *                  until SCL is clocked by hand, off by default
+ * HOST_TWI_NACK    every Nth data byte written to the 24C16 is NACKed, off by default
+ */
+#define HOST_ENV_UART_FD       "HOST_UART_FD"
+#define HOST_ENV_EPOCH_NS      "HOST_EPOCH_NS"
+#define HOST_ENV_TIME_SCALE    "HOST_TIME_SCALE"
+#define HOST_ENV_KEYS          "HOST_KEYS"
+#define HOST_ENV_PIR_MS        "HOST_PIR_MS"
+#define HOST_ENV_EEPROM        "HOST_EEPROM"
+#define HOST_ENV_TRACE         "HOST_TRACE"
+#define HOST_ENV_TWI_HANG      "HOST_TWI_HANG"
+#define HOST_ENV_TWI_NACK      "HOST_TWI_NACK"
+
+/* Wall clock period of the peripheral tick, interrupts are only taken on a tick */
+#define HOST_TICK_US           100
+
+/* Character configuration of HOST_WireCharType, a receiver with another one gets a framing error */
+#define HOST_WIRE_UBRR_MASK    0x0FFF
+#define HOST_WIRE_U2X          0x1000
+#define HOST_WIRE_SIZE_SHIFT   13
+
+/*******************************************************************************
+ *                               Types Declaration                             *
+ *******************************************************************************/
+
+/* One UART character on the emulated line */
+typedef struct {
+	uint64_t end_ns;     /* emulated time its stop bit ended */
+	uint16_t config;     /* UBRR, U2X and character size of the sender */
+	uint8_t ninth_bit;   /* TXB8, set for address bytes in multi-processor mode */
+	uint8_t data;
+	uint32_t reserved;
+}HOST_WireCharType;
+
+/*******************************************************************************
+ *                      Functions Prototypes                                   *
+ *******************************************************************************/
+
+/*
+ * Description :
+ * Return the emulated time in nanoseconds since HOST_EPOCH_NS.
+ */
+uint64_t HOST_now(void);
+
+/*
+ * Description :
+ * Busy wait for the given emulated time, used by _delay_ms and _delay_us.
+ */
+void HOST_delayMicroseconds(double us);
+
+/*
+ * Description :
+ * The SLEEP instruction: with SE in MCUCR and the I-bit set, wait until an ISR
+ * was called. The process sleeps meanwhile instead of spinning.
+ */
+void HOST_sleep(void);
+
+/*
+ * Description :
+ * The avr-libc itoa used by the LCD driver, glibc has none.
+ */
+char * itoa(int value, char * buffer, int radix);
+
+#endif /* HOST_MCU_H_ */
@@ -0,0 +1,1025 @@
+ /******************************************************************************
+ *
+ * Module: Link Benchmark
+ *
+ * File Name: link_bench.c
+ *
+ * Description: Runs hmi_host and control_host on one emulated UART bus,
+ *              drives a scripted keypad session on the HMI and reports the
+ *              message rate and the latency of every request/reply pair,
+ *              measured on the line from the end of the request to the end
+ *              of its reply. A probe can play a second panel that keeps
+ *              asking CONTROL for its status during the session, reads
+ *              the hot path probes of the HMI while it waits for the door,
+ *              then the scheduler latencies, sleep time and probes of CONTROL.
+ *              It can also dump the event trace of both ECUs for trace_decode.
+ *
+ * Author: Malik Anas
+ *
+ *******************************************************************************/
+
+#include "host_mcu.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+/* Frame layout and commands, as in frame.h and the ECU main files */
+#define FRAME_START_BYTE       0x7E
+#define FRAME_MAX_PAYLOAD      16
+#define FRAME_NO_SEQUENCE      0
+#define CONTROL_ADDRESS        0x01
+#define HMI_ADDRESS            0x02
+#define REQUEST_PENDING        0xED
+#define GET_STATUS             0xE1
+#define GET_DIAG               0xE8
+#define GET_PROFILE            0xF5
+#define GET_TRACE              0xF6
+
+/* GET_DIAG pages of CONTROL read by the probe when the session ends */
+#define DIAG_SCHEDULER         0x01
+#define DIAG_POWER             0x02
+
+/* Hot path probes of profile.h, and the length of a GET_PROFILE reply */
+#define PROF_PROBES            5
+#define PROF_RECORD_BYTES      15
+
+/* Event trace of trace.h: record size, records per GET_TRACE page and the largest ring */
+#define TRACE_RECORD_BYTES     4
+#define TRACE_PAGE_RECORDS     4
+#define TRACE_MAX_RECORDS      128
+
+/* Address of the probe panel, the second panel CONTROL serves by default */
+#define PROBE_ADDRESS          0x03
+
+/* Line idle time before the probe sends, so it does not talk over a node */
+#define PROBE_IDLE_NS          20000000ULL
+
+/* A probe request without reply by then is given up */
+#define PROBE_TIMEOUT_NS       2000000000ULL
+
+#define MAX_NODES              2
+#define MAX_ADDRESSES          256
+
+/* Default session: create the password, then open the door a few times */
+#define SETUP_KEYS             "12345#12345#"
+#define CYCLE_KEYS             "+12345#"
+
+/*******************************************************************************
+ *                               Types Declaration                             *
+ *******************************************************************************/
+
+typedef enum
+{
+	WAIT_START,WAIT_SOURCE,WAIT_SEQUENCE,WAIT_COMMAND,WAIT_LENGTH,WAIT_PAYLOAD,WAIT_CRC
+}BENCH_RxStateType;
+
+/* Frame parser of what one node puts on the line */
+typedef struct {
+	BENCH_RxStateType state;
+	uint8_t destination;    /* from the address character before the frame */
+	uint8_t source;
+	uint8_t sequence;
+	uint8_t command;
+	uint8_t length;
+	uint8_t index;
+	uint8_t crc;
+	uint8_t payload[FRAME_MAX_PAYLOAD];
+	uint64_t frames;
+	uint64_t bytes;
+	uint64_t busy_ns;
+}BENCH_ParserType;
+
+typedef struct {
+	pid_t pid;
+	int fd;
+	const char * name;
+	BENCH_ParserType parser;
+}BENCH_NodeType;
+
+/* Request waiting for its reply */
+typedef struct {
+	uint8_t active;
+	uint8_t command;
+	uint64_t sent_ns;
+}BENCH_PendingType;
+
+typedef struct {
+	uint64_t count;
+	uint64_t total_ns;
+	uint64_t max_ns;
+}BENCH_LatencyType;
+
+/* Event trace of a node, read a GET_TRACE page at a time */
+typedef struct {
+	uint64_t dump_ns;       /* emulated time of the first page request */
+	unsigned length;        /* bytes of records received */
+	uint8_t records[TRACE_MAX_RECORDS * TRACE_RECORD_BYTES];
+	int complete;           /* the last page came */
+}BENCH_TraceType;
+
+/*******************************************************************************
+ *                           Global Variables                                  *
+ *******************************************************************************/
+
+static BENCH_NodeType g_nodes[MAX_NODES];
+static unsigned g_nodeCount;
+
+static BENCH_PendingType g_pending[MAX_ADDRESSES][256];
+static BENCH_LatencyType g_latency[256][256];    /* by request and reply command */
+static uint64_t g_retransmits;
+static uint64_t g_nacks;
+static uint64_t g_corrupted;
+static uint64_t g_firstNs, g_lastNs;
+
+/* The probe panel: its frames, the latency of its GET_STATUS and the last line configuration of CONTROL */
+static BENCH_ParserType g_probe;
+static BENCH_LatencyType g_probeLatency;
+static uint16_t g_controlConfig;
+
+/* Last reply to the probe */
+static uint8_t g_replySequence;
+static uint8_t g_replyLength;
+static uint8_t g_replyPayload[FRAME_MAX_PAYLOAD];
+
+/* The HMI waits for a final reply after REQUEST_PENDING, and answers the probe meanwhile */
+static int g_hmiWaiting;
+
+/* GET_PROFILE replies of each node, by probe id */
+static uint8_t g_hmiProfile[PROF_PROBES][PROF_RECORD_BYTES];
+static uint8_t g_controlProfile[PROF_PROBES][PROF_RECORD_BYTES];
+
+/* GET_DIAG DIAG_POWER reply of the HMI, read after its probe table */
+static uint8_t g_hmiPower[8];
+static int g_hmiPowerRead;
+
+/* Event trace of the HMI being read, and the last complete one */
+static BENCH_TraceType g_hmiTrace;
+static BENCH_TraceType g_hmiTraceDone;
+
+/*******************************************************************************
+ *                      Functions Definitions                                  *
+ *******************************************************************************/
+
+static const char * BENCH_commandName(uint8_t command)
+{
+	switch(command)
+	{
+	case 0xE0: return "MC2_READY";
+	case 0xE1: return "GET_STATUS";
+	case 0xE2: return "SET_NEW_PASS";
+	case 0xE4: return "CONFIRM_PASS";
+	case 0xE5: return "PASS_MATCH";
+	case 0xE6: return "PASS_NO_MATCH";
+	case 0xE7: return "CHECK_PASS";
+	case 0xE8: return "GET_DIAG";
+	case 0xE9: return "RECIEVED";
+	case 0xEA: return "BAUD_CHANGE";
+	case 0xEB: return "BAUD_CONFIRM";
+	case 0xEC: return "BAUD_REJECTED";
+	case 0xED: return "REQUEST_PENDING";
+	case 0xEE: return "REQUEST_REJECTED";
+	case 0xF0: return "ATTEMPTS_ENDED";
+	case 0xF1: return "UNLOCK_DOOR";
+	case 0xF2: return "LOCK_DOOR";
+	case 0xF3: return "GET_AUDIT";
+	case 0xF4: return "AUDIT_DATA";
+	case 0xF5: return "GET_PROFILE";
+	case 0x23: return "PASSWORD_SAVED";
+	case 0x15: return "FRAME_NACK";
+	}
+	return "?";
+}
+
+static uint8_t BENCH_updateCrc(uint8_t crc, uint8_t data)
+{
+	uint8_t bit;
+
+	crc ^= data;
+	for(bit = 0; bit < 8; bit++)
+	{
+		crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+	}
+	return crc;
+}
+
+/*
+ * Description :
+ * Line time of one character from the configuration of its sender.
+ */
+static uint64_t BENCH_charNs(uint16_t config)
+{
+	uint32_t ubrr = config & HOST_WIRE_UBRR_MASK;
+	uint32_t divider = (config & HOST_WIRE_U2X) ? 8 : 16;
+	uint32_t size = (config >> HOST_WIRE_SIZE_SHIFT) & 0x07;
+	uint32_t bits = 1 + ((size == 7) ? 9 : (size + 5)) + 1;
+
+	return (uint64_t)bits * divider * (ubrr + 1) * 1000000000ULL / 8000000UL;
+}
+
+/*
+ * Description :
+ * Sequence number of the next probe request, FRAME_NO_SEQUENCE is skipped.
+ */
+static uint8_t BENCH_nextSequence(uint8_t sequence)
+{
+	return (uint8_t)((sequence == 255) ? 1 : sequence + 1);
+}
+
+/*
+ * Description :
+ * Append a GET_TRACE page to a trace, a short page is the last one.
+ */
+static void BENCH_addTracePage(BENCH_TraceType * trace, const uint8_t * page, uint8_t length)
+{
+	if(trace->length + length <= sizeof(trace->records))
+	{
+		memcpy(&trace->records[trace->length], page, length);
+		trace->length += length;
+	}
+	if(length < TRACE_PAGE_RECORDS * TRACE_RECORD_BYTES)
+	{
+		trace->complete = 1;
+	}
+}
+
+/*
+ * Description :
+ * Write a trace for trace_decode: the emulated time of the dump in
+ * milliseconds, little-endian 32-bit, then the records oldest first.
+ */
+static void BENCH_writeTrace(const char * prefix, const char * node, const BENCH_TraceType * trace)
+{
+	char path[256];
+	uint32_t dump_ms = (uint32_t)(trace->dump_ns / 1000000ULL);
+	uint8_t header[4];
+	FILE * file;
+	unsigned i;
+
+	snprintf(path, sizeof(path), "%s-%s.trace", prefix, node);
+	file = fopen(path, "wb");
+	if(file == NULL)
+	{
+		perror(path);
+		return;
+	}
+	for(i = 0; i < 4; i++)
+	{
+		header[i] = (uint8_t)(dump_ms >> (8 * i));
+	}
+	fwrite(header, 1, sizeof(header), file);
+	fwrite(trace->records, 1, trace->length, file);
+	fclose(file);
+	printf("trace              %s, %u records\n", path, trace->length / TRACE_RECORD_BYTES);
+}
+
+/*
+ * Description :
+ * Match a complete frame against the outstanding requests.
+ */
+static void BENCH_frameDone(const BENCH_ParserType * frame, uint64_t end_ns)
+{
+	BENCH_PendingType * pending;
+
+	if(frame->command == 0x15)
+	{
+		g_nacks++;
+		return;
+	}
+	if(frame->sequence == FRAME_NO_SEQUENCE)
+	{
+		return;
+	}
+
+	if(frame->destination == PROBE_ADDRESS)
+	{
+		memcpy(g_replyPayload, frame->payload, frame->length);
+		g_replyLength = frame->length;
+		g_replySequence = frame->sequence;
+		if((frame->source == HMI_ADDRESS) && (frame->command == GET_PROFILE) &&
+				(frame->length == PROF_RECORD_BYTES) && (frame->payload[0] < PROF_PROBES))
+		{
+			memcpy(g_hmiProfile[frame->payload[0]], frame->payload, PROF_RECORD_BYTES);
+		}
+		if((frame->source == HMI_ADDRESS) && (frame->command == GET_DIAG) && (frame->length == 8))
+		{
+			memcpy(g_hmiPower, frame->payload, 8);
+			g_hmiPowerRead = 1;
+		}
+		if((frame->source == HMI_ADDRESS) && (frame->command == GET_TRACE))
+		{
+			BENCH_addTracePage(&g_hmiTrace, frame->payload, frame->length);
+			if(g_hmiTrace.complete)
+			{
+				g_hmiTraceDone = g_hmiTrace;
+			}
+		}
+	}
+	if((frame->source == CONTROL_ADDRESS) && (frame->destination == HMI_ADDRESS))
+	{
+		g_hmiWaiting = (frame->command == REQUEST_PENDING);
+	}
+
+	if(frame->source != CONTROL_ADDRESS)
+	{
+		if(frame->destination == PROBE_ADDRESS)
+		{
+			/* The HMI answering the probe */
+			return;
+		}
+
+		/* A request from a panel, a second copy is a retransmit */
+		pending = &g_pending[frame->source][frame->sequence];
+		if(pending->active && (pending->command == frame->command))
+		{
+			g_retransmits++;
+			return;
+		}
+		pending->active = 1;
+		pending->command = frame->command;
+		pending->sent_ns = end_ns;
+		return;
+	}
+
+	/* A reply from CONTROL, the panel is the node the frame was addressed to */
+	pending = &g_pending[frame->destination][frame->sequence];
+	if(pending->active && (frame->destination == PROBE_ADDRESS) && (pending->command != GET_STATUS))
+	{
+		/* The probe reading diagnostics, profiles or the trace is not part of its latency */
+		pending->active = 0;
+	}
+	if(pending->active)
+	{
+		BENCH_LatencyType * latency = (frame->destination == PROBE_ADDRESS) ?
+				&g_probeLatency : &g_latency[pending->command][frame->command];
+		uint64_t elapsed = end_ns - pending->sent_ns;
+
+		latency->count++;
+		latency->total_ns += elapsed;
+		if(elapsed > latency->max_ns)
+		{
+			latency->max_ns = elapsed;
+		}
+		/* REQUEST_PENDING only says the request was accepted, the final reply follows */
+		if(frame->command != REQUEST_PENDING)
+		{
+			pending->active = 0;
+		}
+	}
+}
+
+/*
+ * Description :
+ * Feed one character a node sent to its frame parser.
+ */
+static void BENCH_parse(BENCH_ParserType * parser, const HOST_WireCharType * wire)
+{
+	uint8_t data = wire->data;
+
+	parser->bytes++;
+	parser->busy_ns += BENCH_charNs(wire->config);
+	if(g_firstNs == 0)
+	{
+		g_firstNs = wire->end_ns;
+	}
+	g_lastNs = wire->end_ns;
+
+	/* Address characters in 9-bit mode sit between frames */
+	if(wire->ninth_bit)
+	{
+		parser->destination = data;
+		parser->state = WAIT_START;
+		return;
+	}
+
+	switch(parser->state)
+	{
+	case WAIT_START:
+		if(data == FRAME_START_BYTE)
+		{
+			parser->crc = 0;
+			parser->state = WAIT_SOURCE;
+		}
+		return;
+	case WAIT_SOURCE:
+		parser->source = data;
+		parser->state = WAIT_SEQUENCE;
+		break;
+	case WAIT_SEQUENCE:
+		parser->sequence = data;
+		parser->state = WAIT_COMMAND;
+		break;
+	case WAIT_COMMAND:
+		parser->command = data;
+		parser->state = WAIT_LENGTH;
+		break;
+	case WAIT_LENGTH:
+		if(data > FRAME_MAX_PAYLOAD)
+		{
+			g_corrupted++;
+			parser->state = WAIT_START;
+			return;
+		}
+		parser->length = data;
+		parser->index = 0;
+		parser->state = (data == 0) ? WAIT_CRC : WAIT_PAYLOAD;
+		break;
+	case WAIT_PAYLOAD:
+		parser->payload[parser->index++] = data;
+		if(parser->index == parser->length)
+		{
+			parser->state = WAIT_CRC;
+		}
+		break;
+	case WAIT_CRC:
+		parser->state = WAIT_START;
+		if(data != parser->crc)
+		{
+			g_corrupted++;
+			return;
+		}
+		parser->frames++;
+		BENCH_frameDone(parser, wire->end_ns);
+		return;
+	}
+	parser->crc = BENCH_updateCrc(parser->crc, data);
+}
+
+/*
+ * Description :
+ * Start a node on its end of a socket pair with the shared emulation settings.
+ */
+static void BENCH_startNode(const char * path, const char * keys, uint64_t epoch_ns, const char * scale,
+		const char * pir_ms, const char * eeprom, int trace)
+{
+	BENCH_NodeType * node = &g_nodes[g_nodeCount++];
+	int pair[2];
+	char number[32];
+
+	if(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, pair) < 0)
+	{
+		perror("socketpair");
+		exit(1);
+	}
+
+	node->name = path;
+	node->fd = pair[0];
+	node->pid = fork();
+	if(node->pid < 0)
+	{
+		perror("fork");
+		exit(1);
+	}
+	if(node->pid == 0)
+	{
+		/* Nodes busy wait, they must not outlive the benchmark */
+		prctl(PR_SET_PDEATHSIG, SIGKILL);
+		close(pair[0]);
+		snprintf(number, sizeof(number), "%d", pair[1]);
+		setenv(HOST_ENV_UART_FD, number, 1);
+		snprintf(number, sizeof(number), "%llu", (unsigned long long)epoch_ns);
+		setenv(HOST_ENV_EPOCH_NS, number, 1);
+		setenv(HOST_ENV_TIME_SCALE, scale, 1);
+		setenv(HOST_ENV_PIR_MS, pir_ms, 1);
+		if(keys != NULL)
+		{
+			setenv(HOST_ENV_KEYS, keys, 1);
+		}
+		if(eeprom != NULL)
+		{
+			setenv(HOST_ENV_EEPROM, eeprom, 1);
+		}
+		if(trace)
+		{
+			setenv(HOST_ENV_TRACE, "1", 1);
+		}
+		execl(path, path, (char *)NULL);
+		perror(path);
+		_exit(127);
+	}
+	close(pair[1]);
+}
+
+/*
+ * Description :
+ * Put a request from the probe panel on the line, its characters end one
+ * after the other from now on at the character rate CONTROL uses.
+ */
+static void BENCH_sendProbe(uint8_t destination, uint8_t sequence, uint8_t command, const uint8_t * payload, uint8_t payload_length,
+		uint64_t now_ns)
+{
+	uint8_t frame[FRAME_MAX_PAYLOAD + 7];
+	uint8_t length = 0;
+	uint8_t crc = 0;
+	unsigned i, node;
+
+	frame[length++] = destination;
+	frame[length++] = FRAME_START_BYTE;
+	frame[length++] = PROBE_ADDRESS;
+	frame[length++] = sequence;
+	frame[length++] = command;
+	frame[length++] = payload_length;
+	for(i = 0; i < payload_length; i++)
+	{
+		frame[length++] = payload[i];
+	}
+	for(i = 2; i < length; i++)
+	{
+		crc = BENCH_updateCrc(crc, frame[i]);
+	}
+	frame[length++] = crc;
+
+	for(i = 0; i < length; i++)
+	{
+		HOST_WireCharType wire;
+
+		memset(&wire, 0, sizeof(wire));
+		wire.end_ns = now_ns + (i + 1) * BENCH_charNs(g_controlConfig);
+		wire.config = g_controlConfig;
+		wire.ninth_bit = (i == 0);
+		wire.data = frame[i];
+		for(node = 0; node < g_nodeCount; node++)
+		{
+			if(send(g_nodes[node].fd, &wire, sizeof(wire), 0) < 0)
+			{
+				/* The node exited */
+			}
+		}
+		BENCH_parse(&g_probe, &wire);
+	}
+}
+
+/*
+ * Description :
+ * Emulated time of the nodes.
+ */
+static uint64_t BENCH_now(uint64_t epoch_ns, double time_scale)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)((double)((uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec - epoch_ns) * time_scale);
+}
+
+/*
+ * Description :
+ * Send CONTROL a request with a one byte payload as the probe panel once the
+ * HMI is gone, a GET_DIAG page or a GET_PROFILE probe id. Returns the payload
+ * length of the reply, left in g_replyPayload, or -1 if none came within a second.
+ */
+static int BENCH_askControl(uint8_t command, uint8_t argument, uint8_t sequence, uint64_t epoch_ns, double time_scale)
+{
+	time_t started = time(NULL);
+	HOST_WireCharType wire;
+	struct pollfd fds;
+
+	BENCH_sendProbe(CONTROL_ADDRESS, sequence, command, &argument, 1, BENCH_now(epoch_ns, time_scale));
+	while(g_replySequence != sequence)
+	{
+		if((unsigned)(time(NULL) - started) > 1)
+		{
+			return -1;
+		}
+		fds.fd = g_nodes[0].fd;
+		fds.events = POLLIN;
+		if(poll(&fds, 1, 10) > 0)
+		{
+			while(recv(g_nodes[0].fd, &wire, sizeof(wire), MSG_DONTWAIT) == (ssize_t)sizeof(wire))
+			{
+				BENCH_parse(&g_nodes[0].parser, &wire);
+			}
+		}
+	}
+	return g_replyLength;
+}
+
+/*
+ * Description :
+ * Print a GET_DIAG DIAG_POWER reply: the time awake and in IDLE, little-endian 32-bit each.
+ */
+static void BENCH_printPower(const char * node, const uint8_t * power)
+{
+	uint32_t active_ms = (uint32_t)power[0] | ((uint32_t)power[1] << 8) |
+			((uint32_t)power[2] << 16) | ((uint32_t)power[3] << 24);
+	uint32_t idle_ms = (uint32_t)power[4] | ((uint32_t)power[5] << 8) |
+			((uint32_t)power[6] << 16) | ((uint32_t)power[7] << 24);
+
+	printf("%-7s power      active %.3f s, IDLE %.3f s, %.2f %% asleep\n", node,
+			active_ms / 1e3, idle_ms / 1e3,
+			(active_ms + idle_ms) ? 100.0 * idle_ms / (double)(active_ms + idle_ms) : 0.0);
+}
+
+/*
+ * Description :
+ * Print the GET_PROFILE replies of a node that saw its probe run, in microseconds.
+ */
+static void BENCH_printProfile(const char * node, uint8_t profile[PROF_PROBES][PROF_RECORD_BYTES])
+{
+	/* Probe ids of profile.h */
+	static const char * const names[PROF_PROBES] = {"lcd character", "keypad row", "check pass",
+			"eeprom read", "request"};
+	unsigned id, field;
+
+	for(id = 0; id < PROF_PROBES; id++)
+	{
+		const uint8_t * record = profile[id];
+		uint32_t cycles[3] = {0, 0, 0};
+		unsigned count = (unsigned)record[1] | ((unsigned)record[2] << 8);
+
+		if(count == 0)
+		{
+			continue;
+		}
+		for(field = 0; field < 3; field++)
+		{
+			cycles[field] = (uint32_t)record[3 + 4 * field] | ((uint32_t)record[4 + 4 * field] << 8) |
+					((uint32_t)record[5 + 4 * field] << 16) | ((uint32_t)record[6 + 4 * field] << 24);
+		}
+		/* min, max and mean cycles at 8 MHz */
+		printf("%-8s %-14s %6u %10.1f %10.1f %10.1f\n", node, names[id], count,
+				cycles[0] / 8.0, cycles[2] / 8.0, cycles[1] / 8.0);
+	}
+}
+
+static void BENCH_usage(const char * program)
+{
+	fprintf(stderr,
+			"usage: %s [-s scale] [-n cycles] [-k keys] [-p pir_ms] [-e eeprom_image] [-w wall_s] [-t]\n"
+			"          [-P probe_ms] [-T trace_prefix] [-H hmi_host] [-C control_host]\n"
+			"  -s  emulated seconds per wall clock second (default 5)\n"
+			"  -n  door cycles after the password setup (default 5)\n"
+			"  -k  keypad script instead of the default session, '#' is ENTER, '.' waits 1 s\n"
+			"  -p  time people stay in the doorway (default 2000 ms)\n"
+			"  -e  keep the EEPROM in this file, a fresh one is used otherwise\n"
+			"  -w  give up after this many wall clock seconds (default 300)\n"
+			"  -t  print the LCD, keypad, motor and buzzer events of both nodes\n"
+			"  -P  play a second panel that sends GET_STATUS every probe_ms and report its latency,\n"
+			"      reads the HMI hot path probes while it waits for the door, then the task\n"
+			"      latencies, sleep time and hot path probes of CONTROL\n"
+			"  -T  read the event trace of the HMI while it waits for the door and of CONTROL at the\n"
+			"      end, into trace_prefix-hmi.trace and trace_prefix-control.trace for trace_decode\n",
+			program);
+}
+
+int main(int argc, char * argv[])
+{
+	const char * hmi_path = "./hmi_host";
+	const char * control_path = "./control_host";
+	const char * scale = "5";
+	const char * pir_ms = "2000";
+	const char * eeprom = NULL;
+	char fresh_eeprom[] = "/tmp/link_bench_eeprom_XXXXXX";
+	char * keys = NULL;
+	unsigned cycles = 5;
+	unsigned wall_limit = 300;
+	unsigned probe_ms = 0;
+	const char * trace_prefix = NULL;
+	BENCH_TraceType control_trace;
+	uint8_t probe_sequence = 0;
+	uint64_t probe_sent_ns = 0;
+	unsigned hmi_probe = PROF_PROBES + 1;    /* probe ids, then PROF_PROBES for the HMI power page */
+	int hmi_was_waiting = 0;
+	double time_scale;
+	int scheduler_length = -1;
+	int power_length = -1;
+	uint8_t scheduler[FRAME_MAX_PAYLOAD];
+	uint8_t power[FRAME_MAX_PAYLOAD];
+	int profiled = 0;
+	int trace = 0;
+	int option;
+	int hmi_status = 0;
+	struct timespec ts;
+	uint64_t epoch_ns;
+	time_t started = time(NULL);
+	unsigned i;
+
+	while((option = getopt(argc, argv, "s:n:k:p:e:w:tP:T:H:C:h")) != -1)
+	{
+		switch(option)
+		{
+		case 's': scale = optarg; break;
+		case 'n': cycles = (unsigned)atoi(optarg); break;
+		case 'k': keys = optarg; break;
+		case 'p': pir_ms = optarg; break;
+		case 'e': eeprom = optarg; break;
+		case 'w': wall_limit = (unsigned)atoi(optarg); break;
+		case 't': trace = 1; break;
+		case 'P': probe_ms = (unsigned)atoi(optarg); break;
+		case 'T': trace_prefix = optarg; break;
+		case 'H': hmi_path = optarg; break;
+		case 'C': control_path = optarg; break;
+		default:
+			BENCH_usage(argv[0]);
+			return 2;
+		}
+	}
+
+	if(keys == NULL)
+	{
+		keys = malloc(sizeof(SETUP_KEYS) + cycles * (sizeof(CYCLE_KEYS) - 1));
+		strcpy(keys, SETUP_KEYS);
+		for(i = 0; i < cycles; i++)
+		{
+			strcat(keys, CYCLE_KEYS);
+		}
+	}
+
+	/* A fresh, blank EEPROM unless the caller keeps one */
+	if(eeprom == NULL)
+	{
+		int fd = mkstemp(fresh_eeprom);
+		if(fd < 0)
+		{
+			perror("mkstemp");
+			return 1;
+		}
+		close(fd);
+		unlink(fresh_eeprom);
+		eeprom = fresh_eeprom;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+	time_scale = atof(scale);
+
+	/* Emulated time zero for both nodes */
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	epoch_ns = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+
+	BENCH_startNode(control_path, NULL, epoch_ns, scale, pir_ms, eeprom, trace);
+	BENCH_startNode(hmi_path, keys, epoch_ns, scale, pir_ms, NULL, trace);
+
+	/* Relay every character to the other nodes, like a shared bus, until the HMI is done */
+	for(;;)
+	{
+		struct pollfd fds[MAX_NODES];
+		pid_t done;
+		int status;
+
+		for(i = 0; i < g_nodeCount; i++)
+		{
+			fds[i].fd = g_nodes[i].fd;
+			fds[i].events = POLLIN;
+			fds[i].revents = 0;
+		}
+
+		if(poll(fds, g_nodeCount, 10) > 0)
+		{
+			for(i = 0; i < g_nodeCount; i++)
+			{
+				HOST_WireCharType wire;
+				unsigned other;
+
+				if(!(fds[i].revents & POLLIN))
+				{
+					continue;
+				}
+				while(recv(g_nodes[i].fd, &wire, sizeof(wire), MSG_DONTWAIT) == (ssize_t)sizeof(wire))
+				{
+					for(other = 0; other < g_nodeCount; other++)
+					{
+						if(other != i)
+						{
+							if(send(g_nodes[other].fd, &wire, sizeof(wire), 0) < 0)
+							{
+								/* The node exited */
+							}
+						}
+					}
+					BENCH_parse(&g_nodes[i].parser, &wire);
+					if(i == 0)
+					{
+						g_controlConfig = wire.config;
+					}
+				}
+			}
+		}
+
+		/*
+		 * The probe asks once the line is quiet and its last request was answered
+		 * or given up. Every time the HMI starts waiting for the door it reads the
+		 * HMI probe table, power counters and event trace first, then goes on
+		 * with GET_STATUS.
+		 */
+		if(g_hmiWaiting && !hmi_was_waiting)
+		{
+			hmi_probe = (probe_ms > 0) ? 0 : PROF_PROBES + 1;
+			memset(&g_hmiTrace, 0, sizeof(g_hmiTrace));
+			g_hmiTrace.complete = (trace_prefix == NULL);
+		}
+		hmi_was_waiting = g_hmiWaiting;
+
+		if(((probe_ms > 0) || (trace_prefix != NULL)) && (g_controlConfig != 0))
+		{
+			uint64_t now_ns = BENCH_now(epoch_ns, time_scale);
+
+			if((now_ns >= g_lastNs + PROBE_IDLE_NS) &&
+					((probe_sequence == 0) || (g_replySequence == probe_sequence) ||
+					 (now_ns >= probe_sent_ns + PROBE_TIMEOUT_NS)))
+			{
+				uint8_t id = (uint8_t)hmi_probe;
+
+				if(g_hmiWaiting && (hmi_probe < PROF_PROBES))
+				{
+					g_pending[PROBE_ADDRESS][probe_sequence].active = 0;
+					probe_sequence = BENCH_nextSequence(probe_sequence);
+					BENCH_sendProbe(HMI_ADDRESS, probe_sequence, GET_PROFILE, &id, 1, now_ns);
+					probe_sent_ns = now_ns;
+					hmi_probe++;
+				}
+				else if(g_hmiWaiting && (hmi_probe == PROF_PROBES))
+				{
+					uint8_t page = DIAG_POWER;
+
+					g_pending[PROBE_ADDRESS][probe_sequence].active = 0;
+					probe_sequence = BENCH_nextSequence(probe_sequence);
+					BENCH_sendProbe(HMI_ADDRESS, probe_sequence, GET_DIAG, &page, 1, now_ns);
+					probe_sent_ns = now_ns;
+					hmi_probe++;
+				}
+				else if(g_hmiWaiting && !g_hmiTrace.complete)
+				{
+					/* A page that got no answer is asked again */
+					uint8_t offset = (uint8_t)(g_hmiTrace.length / TRACE_RECORD_BYTES);
+
+					if(offset == 0)
+					{
+						g_hmiTrace.dump_ns = now_ns;
+					}
+					g_pending[PROBE_ADDRESS][probe_sequence].active = 0;
+					probe_sequence = BENCH_nextSequence(probe_sequence);
+					BENCH_sendProbe(HMI_ADDRESS, probe_sequence, GET_TRACE, &offset, 1, now_ns);
+					probe_sent_ns = now_ns;
+				}
+				else if((probe_ms > 0) && (now_ns >= probe_sent_ns + probe_ms * 1000000ULL))
+				{
+					g_pending[PROBE_ADDRESS][probe_sequence].active = 0;
+					probe_sequence = BENCH_nextSequence(probe_sequence);
+					BENCH_sendProbe(CONTROL_ADDRESS, probe_sequence, GET_STATUS, NULL, 0, now_ns);
+					probe_sent_ns = now_ns;
+				}
+			}
+		}
+
+		done = waitpid(g_nodes[1].pid, &status, WNOHANG);
+		if(done == g_nodes[1].pid)
+		{
+			hmi_status = status;
+			break;
+		}
+		if((unsigned)(time(NULL) - started) > wall_limit)
+		{
+			fprintf(stderr, "link_bench: no end after %u s, stopping\n", wall_limit);
+			kill(g_nodes[1].pid, SIGTERM);
+			waitpid(g_nodes[1].pid, &hmi_status, 0);
+			break;
+		}
+	}
+
+	/* The probe reads what CONTROL measured before it goes */
+	if((probe_ms > 0) && (g_controlConfig != 0))
+	{
+		probe_sequence = BENCH_nextSequence(probe_sequence);
+		scheduler_length = BENCH_askControl(GET_DIAG, DIAG_SCHEDULER, probe_sequence, epoch_ns, time_scale);
+		memcpy(scheduler, g_replyPayload, sizeof(scheduler));
+		probe_sequence = BENCH_nextSequence(probe_sequence);
+		power_length = BENCH_askControl(GET_DIAG, DIAG_POWER, probe_sequence, epoch_ns, time_scale);
+		memcpy(power, g_replyPayload, sizeof(power));
+		for(i = 0; i < PROF_PROBES; i++)
+		{
+			probe_sequence = BENCH_nextSequence(probe_sequence);
+			if(BENCH_askControl(GET_PROFILE, (uint8_t)i, probe_sequence, epoch_ns, time_scale) == PROF_RECORD_BYTES)
+			{
+				memcpy(g_controlProfile[i], g_replyPayload, PROF_RECORD_BYTES);
+			}
+		}
+		profiled = 1;
+	}
+
+	/* The trace of CONTROL is read last, so the reads above are in it */
+	if((trace_prefix != NULL) && (g_controlConfig != 0))
+	{
+		int length;
+
+		memset(&control_trace, 0, sizeof(control_trace));
+		control_trace.dump_ns = BENCH_now(epoch_ns, time_scale);
+		do
+		{
+			probe_sequence = BENCH_nextSequence(probe_sequence);
+			length = BENCH_askControl(GET_TRACE, (uint8_t)(control_trace.length / TRACE_RECORD_BYTES),
+					probe_sequence, epoch_ns, time_scale);
+			if(length >= 0)
+			{
+				BENCH_addTracePage(&control_trace, g_replyPayload, (uint8_t)length);
+			}
+		}
+		while((length >= 0) && !control_trace.complete);
+	}
+
+	kill(g_nodes[0].pid, SIGTERM);
+	waitpid(g_nodes[0].pid, NULL, 0);
+	if(eeprom == fresh_eeprom)
+	{
+		unlink(fresh_eeprom);
+	}
+
+	/* Report */
+	{
+		double seconds = (g_lastNs > g_firstNs) ? (double)(g_lastNs - g_firstNs) / 1e9 : 0.0;
+		uint64_t frames = g_nodes[0].parser.frames + g_nodes[1].parser.frames + g_probe.frames;
+		unsigned request, reply;
+
+		printf("link_bench: %s, time scale %s, keys \"%s\"\n",
+				(WIFEXITED(hmi_status) && WEXITSTATUS(hmi_status) == 0) ? "session completed" : "session FAILED",
+				scale, keys);
+		printf("emulated time      %10.3f s\n", seconds);
+		printf("frames             %10llu  (HMI %llu, CONTROL %llu)\n", (unsigned long long)frames,
+				(unsigned long long)g_nodes[1].parser.frames, (unsigned long long)g_nodes[0].parser.frames);
+		if(probe_ms > 0)
+		{
+			printf("probe frames       %10llu\n", (unsigned long long)g_probe.frames);
+		}
+		printf("messages/s         %10.2f\n", (seconds > 0.0) ? (double)frames / seconds : 0.0);
+		printf("line busy          %10.2f %%\n", (seconds > 0.0) ?
+				100.0 * (double)(g_nodes[0].parser.busy_ns + g_nodes[1].parser.busy_ns + g_probe.busy_ns) / 1e9 / seconds : 0.0);
+		printf("retransmits        %10llu\n", (unsigned long long)g_retransmits);
+		printf("NACKs              %10llu\n", (unsigned long long)g_nacks);
+		printf("corrupted frames   %10llu\n", (unsigned long long)g_corrupted);
+		printf("\n%-16s %-18s %6s %10s %10s\n", "request", "reply", "count", "mean ms", "max ms");
+		for(request = 0; request < 256; request++)
+		{
+			for(reply = 0; reply < 256; reply++)
+			{
+				BENCH_LatencyType * latency = &g_latency[request][reply];
+				if(latency->count == 0)
+				{
+					continue;
+				}
+				printf("%-16s %-18s %6llu %10.2f %10.2f\n", BENCH_commandName((uint8_t)request),
+						BENCH_commandName((uint8_t)reply), (unsigned long long)latency->count,
+						(double)latency->total_ns / (double)latency->count / 1e6, (double)latency->max_ns / 1e6);
+			}
+		}
+		if(g_probeLatency.count > 0)
+		{
+			printf("\nprobe GET_STATUS   %6llu answered, mean %.2f ms, max %.2f ms\n",
+					(unsigned long long)g_probeLatency.count,
+					(double)g_probeLatency.total_ns / (double)g_probeLatency.count / 1e6,
+					(double)g_probeLatency.max_ns / 1e6);
+		}
+		if(scheduler_length > 0)
+		{
+			/* Tasks in the order CONTROL adds them */
+			static const char * const names[] = {"link", "door", "lockout", "storage", "export", "task 6"};
+
+			printf("\n%-16s %10s %10s\n", "CONTROL task", "wait ms", "run ms");
+			for(i = 0; (int)(2 * i + 1) < scheduler_length; i++)
+			{
+				printf("%-16s %10u %10u\n", names[i], scheduler[2 * i], scheduler[2 * i + 1]);
+			}
+		}
+		if(power_length == 8)
+		{
+			printf("\n");
+			BENCH_printPower("CONTROL", power);
+		}
+		if(g_hmiPowerRead)
+		{
+			if(power_length != 8)
+			{
+				printf("\n");
+			}
+			BENCH_printPower("HMI", g_hmiPower);
+		}
+		if(trace_prefix != NULL)
+		{
+			printf("\n");
+			if(g_hmiTraceDone.complete)
+			{
+				BENCH_writeTrace(trace_prefix, "hmi", &g_hmiTraceDone);
+			}
+			if(control_trace.complete)
+			{
+				BENCH_writeTrace(trace_prefix, "control", &control_trace);
+			}
+		}
+		if(profiled)
+		{
+			printf("\n%-8s %-14s %6s %10s %10s %10s\n", "node", "hot path", "count", "min us", "mean us", "max us");
+			BENCH_printProfile("HMI", g_hmiProfile);
+			BENCH_printProfile("CONTROL", g_controlProfile);
+		}
+		return (WIFEXITED(hmi_status) && WEXITSTATUS(hmi_status) == 0) ? 0 : 1;
+	}
+}
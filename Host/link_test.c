@@ -0,0 +1,923 @@
+ /******************************************************************************
+ *
+ * Module: Link Test
+ *
+ * File Name: link_test.c
+ *
+ * Description: Checks how control_host answers requests a panel normally
+ *              never sends. Every case starts its own control_host with a
+ *              blank EEPROM, or with an image of its own, joins the
+ *              emulated UART bus as a panel and checks the replies.
+ *              Prints one line per case, the exit status is the number of
+ *              failed cases.
+ *
+ * Author: Malik Anas
+ *
+ *******************************************************************************/
+
+#include "host_mcu.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+/* Frame layout and commands, as in frame.h, trace.h and the CONTROL main file */
+#define FRAME_START_BYTE       0x7E
+#define FRAME_MAX_PAYLOAD      16
+#define FRAME_NACK             0x15
+#define CONTROL_ADDRESS        0x01
+#define BROADCAST_ADDRESS      0xFF
+#define FIRST_PANEL_ADDRESS    0x02
+#define MC2_READY              0xE0
+#define GET_STATUS             0xE1
+#define SET_NEW_PASS           0xE2
+#define CONFIRM_PASS           0xE4
+#define PASS_MATCH             0xE5
+#define PASS_NO_MATCH          0xE6
+#define CHECK_PASS             0xE7
+#define RECIEVED               0xE9
+#define BAUD_CHANGE            0xEA
+#define BAUD_REJECTED          0xEC
+#define REQUEST_PENDING        0xED
+#define REQUEST_REJECTED       0xEE
+#define UNLOCK_DOOR            0xF1
+#define GET_AUDIT              0xF3
+#define AUDIT_DATA             0xF4
+#define GET_TRACE              0xF6
+
+#define PASSWORD_DIGITS        5
+#define PASSWORD_PACKED_BYTES  ((PASSWORD_DIGITS + 1) / 2)
+#define PASSWORD_SAVED         0x23
+
+/* Record store ring at the start of the EEPROM, as in record_store.h, and how long an append settles */
+#define RECORD_SLOT_SIZE       16
+#define RECORD_SLOTS           64
+#define RECORD_WRITE_DELAY_MS  20
+
+#define TRACE_RECORD_BYTES     4
+#define TRACE_PAGE_RECORDS     4
+#define TRACE_DUMP             0x01
+#define TRACE_DUMP_ABANDONED   0x02
+#define TRACE_FRAME_RECEIVED   0x11
+#define TRACE_DUMP_TIMEOUT_MS  1000
+#define TRACE_MAX_RECORDS      128
+
+/* UART settings of CONTROL: 9-bit characters, double speed, at 2400 baud */
+#define TEST_BAUD              2400UL
+#define TEST_CHAR_SIZE         7
+#define TEST_CHAR_BITS         11
+
+/* Wall clock time a request is given before it is sent again, and how often */
+#define TEST_REPLY_TIMEOUT_MS  1000
+#define TEST_ATTEMPTS          3
+
+/*******************************************************************************
+ *                               Types Declaration                             *
+ *******************************************************************************/
+
+typedef enum
+{
+	WAIT_START,WAIT_SOURCE,WAIT_SEQUENCE,WAIT_COMMAND,WAIT_LENGTH,WAIT_PAYLOAD,WAIT_CRC
+}TEST_RxStateType;
+
+typedef struct {
+	uint8_t source;
+	uint8_t sequence;
+	uint8_t command;
+	uint8_t length;
+	uint8_t payload[FRAME_MAX_PAYLOAD];
+}TEST_FrameType;
+
+typedef struct {
+	const char * name;
+	int (*run)(void);
+}TEST_CaseType;
+
+/*******************************************************************************
+ *                           Global Variables                                  *
+ *******************************************************************************/
+
+static const char * g_controlPath = "./control_host";
+static pid_t g_control;
+static int g_fd;
+static uint64_t g_epochNs;
+static double g_scale = 1.0;
+static uint8_t g_address = FIRST_PANEL_ADDRESS;
+static uint8_t g_sequence = 0;
+
+/* Line settings, both ends must agree or the characters arrive as framing errors */
+static uint16_t g_config;
+static uint64_t g_charNs;
+static uint64_t g_lineFreeNs;
+
+/* Receiver */
+static TEST_RxStateType g_rxState = WAIT_START;
+static uint8_t g_rxSelected = 0;
+static uint8_t g_rxIndex;
+static uint8_t g_rxCrc;
+static TEST_FrameType g_rxFrame;
+
+/* Why the running case failed */
+static char g_reason[128];
+
+/*******************************************************************************
+ *                      Functions Definitions                                  *
+ *******************************************************************************/
+
+static int TEST_fail(const char * format, ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	vsnprintf(g_reason, sizeof(g_reason), format, args);
+	va_end(args);
+	return 0;
+}
+
+static uint8_t TEST_updateCrc(uint8_t crc, uint8_t data)
+{
+	uint8_t bit;
+
+	crc ^= data;
+	for(bit = 0; bit < 8; bit++)
+	{
+		crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+	}
+	return crc;
+}
+
+static uint64_t TEST_wallNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Description :
+ * Emulated time of the nodes, the same clock host_mcu.c derives from HOST_EPOCH_NS.
+ */
+static uint64_t TEST_now(void)
+{
+	return (uint64_t)((double)(TEST_wallNs() - g_epochNs) * g_scale);
+}
+
+/*
+ * Description :
+ * Use the line settings CONTROL has for a baud rate, the UBRR value of uart.h in double speed mode.
+ */
+static void TEST_setBaudRate(uint32_t baud_rate)
+{
+	uint32_t ubrr = (8000000UL + 4UL * baud_rate) / (8UL * baud_rate) - 1UL;
+
+	g_config = (uint16_t)((ubrr & HOST_WIRE_UBRR_MASK) | HOST_WIRE_U2X | (TEST_CHAR_SIZE << HOST_WIRE_SIZE_SHIFT));
+	g_charNs = (uint64_t)TEST_CHAR_BITS * 8 * (ubrr + 1) * 1000000000ULL / 8000000UL;
+}
+
+static void TEST_sendChar(uint8_t data, uint8_t ninth_bit)
+{
+	HOST_WireCharType wire;
+	uint64_t now = TEST_now();
+
+	memset(&wire, 0, sizeof(wire));
+	g_lineFreeNs = ((g_lineFreeNs > now) ? g_lineFreeNs : now) + g_charNs;
+	wire.end_ns = g_lineFreeNs;
+	wire.config = g_config;
+	wire.ninth_bit = ninth_bit;
+	wire.data = data;
+	if(send(g_fd, &wire, sizeof(wire), 0) < 0)
+	{
+		perror("link_test: send");
+		exit(1);
+	}
+}
+
+static void TEST_sendFrame(uint8_t sequence, uint8_t command, const uint8_t * payload, uint8_t length)
+{
+	uint8_t crc = 0;
+	uint8_t header[4] = {g_address, sequence, command, length};
+	unsigned i;
+
+	TEST_sendChar(CONTROL_ADDRESS, 1);
+	TEST_sendChar(FRAME_START_BYTE, 0);
+	for(i = 0; i < sizeof(header); i++)
+	{
+		TEST_sendChar(header[i], 0);
+		crc = TEST_updateCrc(crc, header[i]);
+	}
+	for(i = 0; i < length; i++)
+	{
+		TEST_sendChar(payload[i], 0);
+		crc = TEST_updateCrc(crc, payload[i]);
+	}
+	TEST_sendChar(crc, 0);
+}
+
+/*
+ * Description :
+ * Feed one character from the line to the frame parser, returns 1 once a frame
+ * for this panel passed its CRC.
+ */
+static int TEST_parse(const HOST_WireCharType * wire)
+{
+	uint8_t data = wire->data;
+
+	if(wire->config != g_config)
+	{
+		g_rxState = WAIT_START;
+		return 0;
+	}
+	if(wire->ninth_bit)
+	{
+		g_rxSelected = (data == g_address) || (data == BROADCAST_ADDRESS);
+		g_rxState = WAIT_START;
+		return 0;
+	}
+	if(!g_rxSelected)
+	{
+		return 0;
+	}
+
+	switch(g_rxState)
+	{
+	case WAIT_START:
+		if(data == FRAME_START_BYTE)
+		{
+			g_rxCrc = 0;
+			g_rxState = WAIT_SOURCE;
+		}
+		return 0;
+	case WAIT_SOURCE:
+		g_rxFrame.source = data;
+		g_rxState = WAIT_SEQUENCE;
+		break;
+	case WAIT_SEQUENCE:
+		g_rxFrame.sequence = data;
+		g_rxState = WAIT_COMMAND;
+		break;
+	case WAIT_COMMAND:
+		g_rxFrame.command = data;
+		g_rxState = WAIT_LENGTH;
+		break;
+	case WAIT_LENGTH:
+		if(data > FRAME_MAX_PAYLOAD)
+		{
+			g_rxState = WAIT_START;
+			return 0;
+		}
+		g_rxFrame.length = data;
+		g_rxIndex = 0;
+		g_rxState = (data == 0) ? WAIT_CRC : WAIT_PAYLOAD;
+		break;
+	case WAIT_PAYLOAD:
+		g_rxFrame.payload[g_rxIndex++] = data;
+		if(g_rxIndex == g_rxFrame.length)
+		{
+			g_rxState = WAIT_CRC;
+		}
+		break;
+	case WAIT_CRC:
+		g_rxState = WAIT_START;
+		return (data == g_rxCrc) && (g_rxFrame.source == CONTROL_ADDRESS);
+	}
+	g_rxCrc = TEST_updateCrc(g_rxCrc, data);
+	return 0;
+}
+
+/*
+ * Description :
+ * Wait at most timeout_ms of wall clock time for a frame from CONTROL, returns 1 if one came.
+ */
+static int TEST_receive(TEST_FrameType * frame, unsigned timeout_ms)
+{
+	uint64_t deadline = TEST_wallNs() + (uint64_t)timeout_ms * 1000000ULL;
+	HOST_WireCharType wire;
+	struct pollfd fds;
+	uint64_t now;
+
+	for(;;)
+	{
+		while(recv(g_fd, &wire, sizeof(wire), MSG_DONTWAIT) == (ssize_t)sizeof(wire))
+		{
+			if(TEST_parse(&wire))
+			{
+				*frame = g_rxFrame;
+				return 1;
+			}
+		}
+
+		now = TEST_wallNs();
+		if(now >= deadline)
+		{
+			return 0;
+		}
+		fds.fd = g_fd;
+		fds.events = POLLIN;
+		fds.revents = 0;
+		poll(&fds, 1, (int)((deadline - now) / 1000000ULL) + 1);
+		if(waitpid(g_control, NULL, WNOHANG) == g_control)
+		{
+			fprintf(stderr, "link_test: control_host exited\n");
+			exit(1);
+		}
+	}
+}
+
+/*
+ * Description :
+ * Send a request until its final reply comes, a retransmission keeps the
+ * sequence number so CONTROL answers it from its reply cache. The AUDIT_DATA
+ * frames before a GET_AUDIT reply are skipped. Returns 0 if CONTROL never answered.
+ */
+static int TEST_exchange(uint8_t command, const uint8_t * payload, uint8_t length, TEST_FrameType * reply)
+{
+	unsigned attempt;
+
+	if(++g_sequence == 0)
+	{
+		g_sequence = 1;
+	}
+
+	for(attempt = 0; attempt < TEST_ATTEMPTS; attempt++)
+	{
+		TEST_sendFrame(g_sequence, command, payload, length);
+		while(TEST_receive(reply, TEST_REPLY_TIMEOUT_MS))
+		{
+			if(reply->command == FRAME_NACK)
+			{
+				break;
+			}
+			if((reply->sequence == g_sequence) && (reply->command != REQUEST_PENDING) &&
+					(reply->command != AUDIT_DATA))
+			{
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+/*
+ * Description :
+ * Let emulated time pass without talking to CONTROL.
+ */
+static void TEST_wait(unsigned ms)
+{
+	usleep((useconds_t)((double)ms * 1000.0 / g_scale));
+}
+
+/*
+ * Description :
+ * Start control_host on a new bus with a blank EEPROM, and optionally the
+ * given HOST_ environment variable, and wait for its MC2_READY.
+ */
+static void TEST_startControl(const char * variable, const char * value)
+{
+	int pair[2];
+	char number[32];
+	TEST_FrameType frame;
+
+	if(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, pair) < 0)
+	{
+		perror("socketpair");
+		exit(1);
+	}
+
+	g_epochNs = TEST_wallNs();
+	g_lineFreeNs = 0;
+	g_rxState = WAIT_START;
+	g_rxSelected = 0;
+	g_sequence = 0;
+	g_address = FIRST_PANEL_ADDRESS;
+	TEST_setBaudRate(TEST_BAUD);
+
+	g_fd = pair[0];
+	g_control = fork();
+	if(g_control < 0)
+	{
+		perror("fork");
+		exit(1);
+	}
+	if(g_control == 0)
+	{
+		prctl(PR_SET_PDEATHSIG, SIGKILL);
+		close(pair[0]);
+		snprintf(number, sizeof(number), "%d", pair[1]);
+		setenv(HOST_ENV_UART_FD, number, 1);
+		snprintf(number, sizeof(number), "%llu", (unsigned long long)g_epochNs);
+		setenv(HOST_ENV_EPOCH_NS, number, 1);
+		snprintf(number, sizeof(number), "%g", g_scale);
+		setenv(HOST_ENV_TIME_SCALE, number, 1);
+		unsetenv(HOST_ENV_EEPROM);
+		if(variable != NULL)
+		{
+			setenv(variable, value, 1);
+		}
+		execl(g_controlPath, g_controlPath, (char *)NULL);
+		perror(g_controlPath);
+		_exit(127);
+	}
+	close(pair[1]);
+
+	while(!TEST_receive(&frame, 10000) || (frame.command != MC2_READY)) {}
+}
+
+static void TEST_stopControl(void)
+{
+	kill(g_control, SIGTERM);
+	waitpid(g_control, NULL, 0);
+	close(g_fd);
+}
+
+/*
+ * Description :
+ * Read the whole trace of CONTROL page by page into records, returns the
+ * number of records or -1 if a page did not come.
+ */
+static int TEST_readTrace(uint8_t records[][TRACE_RECORD_BYTES])
+{
+	TEST_FrameType reply;
+	uint8_t offset = 0;
+	unsigned count;
+
+	do
+	{
+		if(!TEST_exchange(GET_TRACE, &offset, 1, &reply) || (reply.command != GET_TRACE))
+		{
+			return -1;
+		}
+		count = reply.length / TRACE_RECORD_BYTES;
+		memcpy(records[offset], reply.payload, count * TRACE_RECORD_BYTES);
+		offset = (uint8_t)(offset + count);
+	} while((count == TRACE_PAGE_RECORDS) && (offset < TRACE_MAX_RECORDS));
+
+	return offset;
+}
+
+/*
+ * Description :
+ * The position of the first record with the given event, -1 if there is none.
+ */
+static int TEST_findRecord(uint8_t records[][TRACE_RECORD_BYTES], int count, uint8_t event)
+{
+	int i;
+
+	for(i = 0; i < count; i++)
+	{
+		if(records[i][2] == event)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Description :
+ * A reader that takes the first GET_TRACE page and never comes back must not
+ * leave the trace paused: the next event after TRACE_DUMP_TIMEOUT_MS resumes
+ * recording behind a TRACE_DUMP_ABANDONED record, and a complete dump adds none.
+ */
+static int TEST_traceAbandonedDump(void)
+{
+	uint8_t records[TRACE_MAX_RECORDS][TRACE_RECORD_BYTES];
+	uint8_t offset = 0;
+	TEST_FrameType reply;
+	int count;
+	int abandoned;
+	int i;
+
+	if(!TEST_exchange(GET_STATUS, NULL, 0, &reply))
+	{
+		return TEST_fail("no answer to GET_STATUS");
+	}
+	if(!TEST_exchange(GET_TRACE, &offset, 1, &reply) || (reply.command != GET_TRACE))
+	{
+		return TEST_fail("GET_TRACE not answered (reply 0x%02X)", (unsigned)reply.command);
+	}
+
+	/* The reader goes away, then a frame is received as the next event */
+	TEST_wait(2 * TRACE_DUMP_TIMEOUT_MS);
+	if(!TEST_exchange(GET_STATUS, NULL, 0, &reply))
+	{
+		return TEST_fail("no answer to GET_STATUS after the abandoned dump");
+	}
+
+	count = TEST_readTrace(records);
+	if(count < 0)
+	{
+		return TEST_fail("second dump failed");
+	}
+	abandoned = TEST_findRecord(records, count, TRACE_DUMP_ABANDONED);
+	if(abandoned < 0)
+	{
+		return TEST_fail("no TRACE_DUMP_ABANDONED record, recording stayed paused");
+	}
+	if(TEST_findRecord(&records[abandoned], count - abandoned, TRACE_FRAME_RECEIVED) < 0)
+	{
+		return TEST_fail("the GET_STATUS after the abandoned dump was not recorded");
+	}
+
+	/* The second dump was read to its last page, nothing after it is taken as abandoned */
+	TEST_wait(2 * TRACE_DUMP_TIMEOUT_MS);
+	if(!TEST_exchange(GET_STATUS, NULL, 0, &reply))
+	{
+		return TEST_fail("no answer to GET_STATUS after the complete dump");
+	}
+	count = TEST_readTrace(records);
+	if(count < 2)
+	{
+		return TEST_fail("third dump failed");
+	}
+
+	/* The newest record is the TRACE_DUMP of this dump, look back to the one before */
+	for(i = count - 2; (i >= 0) && (records[i][2] != TRACE_DUMP); i--) {}
+	if(i < 0)
+	{
+		return TEST_fail("the TRACE_DUMP of the second dump is missing");
+	}
+	if(TEST_findRecord(&records[i], count - i, TRACE_DUMP_ABANDONED) >= 0)
+	{
+		return TEST_fail("a complete dump was taken as abandoned");
+	}
+	return 1;
+}
+
+/*
+ * Description :
+ * Send a request and check the command of its reply.
+ */
+static int TEST_expect(uint8_t command, const uint8_t * payload, uint8_t length, uint8_t expected)
+{
+	TEST_FrameType reply;
+
+	if(!TEST_exchange(command, payload, length, &reply))
+	{
+		return TEST_fail("0x%02X with %u bytes not answered", (unsigned)command, (unsigned)length);
+	}
+	if(reply.command != expected)
+	{
+		return TEST_fail("0x%02X with %u bytes answered 0x%02X instead of 0x%02X", (unsigned)command,
+				(unsigned)length, (unsigned)reply.command, (unsigned)expected);
+	}
+	return 1;
+}
+
+/*
+ * Description :
+ * Start a session and save the password, packed as HMI sends it, as the door password.
+ */
+static int TEST_setPassword(const uint8_t * packed)
+{
+	return TEST_expect(GET_STATUS, NULL, 0, GET_STATUS) &&
+			TEST_expect(SET_NEW_PASS, packed, PASSWORD_PACKED_BYTES, RECIEVED) &&
+			TEST_expect(CONFIRM_PASS, packed, PASSWORD_PACKED_BYTES, PASS_MATCH);
+}
+
+/*
+ * Description :
+ * CHECK_PASS, SET_NEW_PASS and CONFIRM_PASS are rejected unless they carry
+ * the packed password. A CHECK_PASS without payload right after a matching
+ * one must not match on the digits left from it, and no rejected CHECK_PASS
+ * counts as a wrong attempt.
+ */
+static int TEST_passwordLength(void)
+{
+	static const uint8_t packed[PASSWORD_PACKED_BYTES + 1] = {0x21, 0x43, 0x05, 0x00};
+	unsigned i;
+
+	if(!TEST_setPassword(packed) || !TEST_expect(CHECK_PASS, packed, PASSWORD_PACKED_BYTES, PASS_MATCH))
+	{
+		return 0;
+	}
+	for(i = 0; i < 4; i++)
+	{
+		if(!TEST_expect(CHECK_PASS, packed, (uint8_t)((i < 3) ? i : PASSWORD_PACKED_BYTES + 1), REQUEST_REJECTED))
+		{
+			return 0;
+		}
+	}
+	return TEST_expect(SET_NEW_PASS, packed, 0, REQUEST_REJECTED) &&
+			TEST_expect(SET_NEW_PASS, packed, PASSWORD_PACKED_BYTES - 1, REQUEST_REJECTED) &&
+			TEST_expect(CONFIRM_PASS, packed, 0, REQUEST_REJECTED) &&
+			TEST_expect(CONFIRM_PASS, packed, PASSWORD_PACKED_BYTES + 1, REQUEST_REJECTED) &&
+			TEST_expect(CHECK_PASS, packed, PASSWORD_PACKED_BYTES, PASS_MATCH);
+}
+
+/*
+ * Description :
+ * CHECK_PASS is rejected while no password is saved, the zeros of the empty
+ * password must not authorize an unlock. Once there is a password, a new one
+ * is only taken right after a matching CHECK_PASS, and that match covers the
+ * CONFIRM_PASS as well.
+ */
+static int TEST_passwordChange(void)
+{
+	static const uint8_t zeros[PASSWORD_PACKED_BYTES] = {0x00, 0x00, 0x00};
+	static const uint8_t packed[PASSWORD_PACKED_BYTES] = {0x21, 0x43, 0x05};
+	static const uint8_t other[PASSWORD_PACKED_BYTES] = {0x87, 0x09, 0x06};
+
+	return TEST_expect(GET_STATUS, NULL, 0, GET_STATUS) &&
+			TEST_expect(CHECK_PASS, zeros, PASSWORD_PACKED_BYTES, REQUEST_REJECTED) &&
+			TEST_expect(UNLOCK_DOOR, NULL, 0, REQUEST_REJECTED) &&
+			TEST_setPassword(packed) &&
+			TEST_expect(SET_NEW_PASS, other, PASSWORD_PACKED_BYTES, REQUEST_REJECTED) &&
+			TEST_expect(CONFIRM_PASS, other, PASSWORD_PACKED_BYTES, REQUEST_REJECTED) &&
+			TEST_expect(CHECK_PASS, other, PASSWORD_PACKED_BYTES, PASS_NO_MATCH) &&
+			TEST_expect(CHECK_PASS, packed, PASSWORD_PACKED_BYTES, PASS_MATCH) &&
+			TEST_expect(SET_NEW_PASS, other, PASSWORD_PACKED_BYTES, RECIEVED) &&
+			TEST_expect(CONFIRM_PASS, other, PASSWORD_PACKED_BYTES, PASS_MATCH) &&
+			TEST_expect(SET_NEW_PASS, packed, PASSWORD_PACKED_BYTES, REQUEST_REJECTED) &&
+			TEST_expect(CHECK_PASS, other, PASSWORD_PACKED_BYTES, PASS_MATCH);
+}
+
+/*
+ * Description :
+ * The match of one panel does not let another panel on the bus change the
+ * password, and the other panel's rejected requests leave it to the first.
+ */
+static int TEST_passwordChangeOtherPanel(void)
+{
+	static const uint8_t zeros[PASSWORD_PACKED_BYTES] = {0x00, 0x00, 0x00};
+	static const uint8_t packed[PASSWORD_PACKED_BYTES] = {0x21, 0x43, 0x05};
+	static const uint8_t other[PASSWORD_PACKED_BYTES] = {0x87, 0x09, 0x06};
+
+	if(!TEST_setPassword(packed) || !TEST_expect(CHECK_PASS, packed, PASSWORD_PACKED_BYTES, PASS_MATCH))
+	{
+		return 0;
+	}
+
+	g_address = FIRST_PANEL_ADDRESS + 1;
+	if(!TEST_expect(GET_STATUS, NULL, 0, GET_STATUS) ||
+			!TEST_expect(SET_NEW_PASS, other, PASSWORD_PACKED_BYTES, REQUEST_REJECTED) ||
+			!TEST_expect(CONFIRM_PASS, other, PASSWORD_PACKED_BYTES, REQUEST_REJECTED))
+	{
+		return 0;
+	}
+
+	/* The old password is still in force, and the first panel still holds its match */
+	if(!TEST_expect(CHECK_PASS, other, PASSWORD_PACKED_BYTES, PASS_NO_MATCH) ||
+			!TEST_expect(CHECK_PASS, zeros, PASSWORD_PACKED_BYTES, PASS_NO_MATCH))
+	{
+		return 0;
+	}
+	g_address = FIRST_PANEL_ADDRESS;
+	return TEST_expect(SET_NEW_PASS, other, PASSWORD_PACKED_BYTES, RECIEVED) &&
+			TEST_expect(CONFIRM_PASS, other, PASSWORD_PACKED_BYTES, PASS_MATCH) &&
+			TEST_expect(CHECK_PASS, other, PASSWORD_PACKED_BYTES, PASS_MATCH);
+}
+
+/*
+ * Description :
+ * Overwrite the first bytes of an EEPROM image with the erased value 0xFF.
+ */
+static int TEST_eraseImage(const char * image, unsigned length)
+{
+	uint8_t erased[RECORD_SLOT_SIZE];
+	int fd = open(image, O_WRONLY);
+	int done;
+
+	memset(erased, 0xFF, sizeof(erased));
+	done = (fd >= 0) && (length <= sizeof(erased)) && (pwrite(fd, erased, length, 0) == (ssize_t)length);
+	if(fd >= 0)
+	{
+		close(fd);
+	}
+	return done;
+}
+
+/*
+ * Description :
+ * Slot 0 of the record store is written again on every lap around the ring.
+ * With it erased after a wrap the store must not read as empty: the password
+ * of the newest record, a few slots further on, is still the door password.
+ * The case runs on its own control_host that keeps the EEPROM in an image.
+ */
+static int TEST_recordSlotZeroErased(void)
+{
+	static const uint8_t passwords[2][PASSWORD_PACKED_BYTES] = {{0x21, 0x43, 0x05}, {0x87, 0x09, 0x06}};
+	char image[] = "/tmp/link_test-XXXXXX";
+	TEST_FrameType reply;
+	unsigned change;
+	int fd;
+	int passed;
+
+	fd = mkstemp(image);
+	if(fd < 0)
+	{
+		return TEST_fail("no EEPROM image file");
+	}
+	close(fd);
+	TEST_stopControl();
+	TEST_startControl(HOST_ENV_EEPROM, image);
+
+	/* One record per password change, each one left alone long enough to be appended */
+	passed = TEST_setPassword(passwords[0]);
+	for(change = 1; passed && (change < RECORD_SLOTS + 6); change++)
+	{
+		passed = TEST_expect(CHECK_PASS, passwords[(change - 1) % 2], PASSWORD_PACKED_BYTES, PASS_MATCH) &&
+				TEST_expect(SET_NEW_PASS, passwords[change % 2], PASSWORD_PACKED_BYTES, RECIEVED) &&
+				TEST_expect(CONFIRM_PASS, passwords[change % 2], PASSWORD_PACKED_BYTES, PASS_MATCH);
+		TEST_wait(2 * RECORD_WRITE_DELAY_MS);
+	}
+	TEST_wait(10 * RECORD_WRITE_DELAY_MS);
+	TEST_stopControl();
+
+	/* Slot 0 holds the first record of the second lap, the newest one is in slot 5 */
+	if(passed && !TEST_eraseImage(image, RECORD_SLOT_SIZE))
+	{
+		passed = TEST_fail("could not erase slot 0 of the image");
+	}
+
+	TEST_startControl(HOST_ENV_EEPROM, image);
+	if(passed && (!TEST_exchange(GET_STATUS, NULL, 0, &reply) || (reply.command != GET_STATUS)))
+	{
+		passed = TEST_fail("no answer to GET_STATUS after the restart");
+	}
+	else if(passed && (reply.payload[0] != PASSWORD_SAVED))
+	{
+		passed = TEST_fail("the store reads as empty, status 0x%02X", (unsigned)reply.payload[0]);
+	}
+	passed = passed &&
+			TEST_expect(CHECK_PASS, passwords[change % 2], PASSWORD_PACKED_BYTES, PASS_NO_MATCH) &&
+			TEST_expect(CHECK_PASS, passwords[(change - 1) % 2], PASSWORD_PACKED_BYTES, PASS_MATCH);
+
+	unlink(image);
+	return passed;
+}
+
+/*
+ * Description :
+ * GET_AUDIT is rejected without its 2-byte cursor, even right after a matching CHECK_PASS.
+ */
+static int TEST_auditLength(void)
+{
+	static const uint8_t packed[PASSWORD_PACKED_BYTES] = {0x21, 0x43, 0x05};
+	static const uint8_t cursor[2] = {0, 0};
+
+	return TEST_setPassword(packed) &&
+			TEST_expect(CHECK_PASS, packed, PASSWORD_PACKED_BYTES, PASS_MATCH) &&
+			TEST_expect(GET_AUDIT, cursor, 0, REQUEST_REJECTED) &&
+			TEST_expect(CHECK_PASS, packed, PASSWORD_PACKED_BYTES, PASS_MATCH) &&
+			TEST_expect(GET_AUDIT, cursor, 1, REQUEST_REJECTED) &&
+			TEST_expect(CHECK_PASS, packed, PASSWORD_PACKED_BYTES, PASS_MATCH) &&
+			TEST_expect(GET_AUDIT, cursor, 2, GET_AUDIT);
+}
+
+/*
+ * Description :
+ * BAUD_CHANGE is rejected unless it carries a 4-byte baud rate.
+ */
+static int TEST_baudLength(void)
+{
+	static const uint8_t baud_rate[5] = {0x00, 0x2C, 0x01, 0x00, 0x00};
+
+	return TEST_expect(GET_STATUS, NULL, 0, GET_STATUS) &&
+			TEST_expect(BAUD_CHANGE, baud_rate, 0, BAUD_REJECTED) &&
+			TEST_expect(BAUD_CHANGE, baud_rate, 3, BAUD_REJECTED) &&
+			TEST_expect(BAUD_CHANGE, baud_rate, 5, BAUD_REJECTED);
+}
+
+/*
+ * Description :
+ * The pipelined unlock of a panel whose CHECK_PASS was lost reaches CONTROL
+ * first and is rejected. Once the resent CHECK_PASS matched, the unlock the
+ * panel sends again is accepted, and one more unlock is not.
+ */
+static int TEST_unlockAfterLostCheck(void)
+{
+	static const uint8_t packed[PASSWORD_PACKED_BYTES] = {0x21, 0x43, 0x05};
+	TEST_FrameType reply;
+	uint8_t check_sequence;
+
+	if(!TEST_setPassword(packed))
+	{
+		return 0;
+	}
+
+	/* CHECK_PASS takes a sequence number that never reaches CONTROL */
+	check_sequence = ++g_sequence;
+	if(!TEST_expect(UNLOCK_DOOR, NULL, 0, REQUEST_REJECTED))
+	{
+		return 0;
+	}
+	TEST_sendFrame(check_sequence, CHECK_PASS, packed, PASSWORD_PACKED_BYTES);
+	if(!TEST_receive(&reply, TEST_REPLY_TIMEOUT_MS) || (reply.sequence != check_sequence) ||
+			(reply.command != PASS_MATCH))
+	{
+		return TEST_fail("resent CHECK_PASS not answered PASS_MATCH");
+	}
+
+	/* The unlock sent again is accepted, its final LOCK_DOOR comes with the door cycle */
+	if(++g_sequence == 0)
+	{
+		g_sequence = 1;
+	}
+	TEST_sendFrame(g_sequence, UNLOCK_DOOR, NULL, 0);
+	if(!TEST_receive(&reply, TEST_REPLY_TIMEOUT_MS) || (reply.sequence != g_sequence) ||
+			(reply.command != REQUEST_PENDING))
+	{
+		return TEST_fail("unlock after the resent CHECK_PASS not accepted");
+	}
+	return TEST_expect(UNLOCK_DOOR, NULL, 0, REQUEST_REJECTED);
+}
+
+/*
+ * Description :
+ * GET_STATUS carries whether the audit log was found, and with a working EEPROM it was.
+ */
+static int TEST_auditStatus(void)
+{
+	TEST_FrameType reply;
+
+	if(!TEST_exchange(GET_STATUS, NULL, 0, &reply) || (reply.command != GET_STATUS))
+	{
+		return TEST_fail("no answer to GET_STATUS");
+	}
+	if((reply.length < 3) || (reply.payload[2] != 1))
+	{
+		return TEST_fail("audit log not reported as found (%u status bytes)", (unsigned)reply.length);
+	}
+	return 1;
+}
+
+static const TEST_CaseType g_cases[] = {
+	{"trace abandoned dump resumes recording", TEST_traceAbandonedDump},
+	{"password commands need the packed password", TEST_passwordLength},
+	{"GET_AUDIT needs its cursor", TEST_auditLength},
+	{"BAUD_CHANGE needs a 4-byte rate", TEST_baudLength},
+	{"GET_STATUS reports the audit log", TEST_auditStatus},
+	{"unlock is accepted again after a lost CHECK_PASS", TEST_unlockAfterLostCheck},
+	{"a password change needs the old password", TEST_passwordChange},
+	{"another panel can not change the password", TEST_passwordChangeOtherPanel},
+	{"the password survives an erased record slot 0", TEST_recordSlotZeroErased},
+};
+
+static void TEST_usage(const char * program)
+{
+	fprintf(stderr,
+			"usage: %s [-s scale] [-C control_host]\n"
+			"  -s  emulated seconds per wall clock second (default 1)\n"
+			"  -C  control_host to test (default ./control_host, built with DIAG_COMMANDS=1)\n",
+			program);
+}
+
+int main(int argc, char * argv[])
+{
+	unsigned failed = 0;
+	unsigned i;
+	int option;
+
+	while((option = getopt(argc, argv, "s:C:h")) != -1)
+	{
+		switch(option)
+		{
+		case 's': g_scale = atof(optarg); break;
+		case 'C': g_controlPath = optarg; break;
+		default:
+			TEST_usage(argv[0]);
+			return 2;
+		}
+	}
+	if(g_scale <= 0.0)
+	{
+		TEST_usage(argv[0]);
+		return 2;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	for(i = 0; i < sizeof(g_cases) / sizeof(g_cases[0]); i++)
+	{
+		TEST_startControl(NULL, NULL);
+		g_reason[0] = '\0';
+		if(g_cases[i].run())
+		{
+			printf("PASS  %s\n", g_cases[i].name);
+		}
+		else
+		{
+			printf("FAIL  %s: %s\n", g_cases[i].name, g_reason);
+			failed++;
+		}
+		TEST_stopControl();
+	}
+
+	printf("%u of %u cases passed\n", (unsigned)(sizeof(g_cases) / sizeof(g_cases[0])) - failed,
+			(unsigned)(sizeof(g_cases) / sizeof(g_cases[0])));
+	return (int)failed;
+}
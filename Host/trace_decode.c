@@ -0,0 +1,306 @@
+ /******************************************************************************
+ *
+ * Module: Trace Decode
+ *
+ * File Name: trace_decode.c
+ *
+ * Description: Turns the event trace dumps that link_bench -T writes into
+ *              one timeline. A dump holds the node time of the dump in
+ *              milliseconds, little-endian 32-bit, then the GET_TRACE
+ *              records oldest first: the low 16 bits of the node time,
+ *              the event and its data byte. The records are placed in full
+ *              time backwards from the TRACE_DUMP record that ends the
+ *              dump, and the records of every file are merged by time.
+ *
+ * Author: Malik Anas
+ *
+ *******************************************************************************/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*******************************************************************************
+ *                                Definitions                                  *
+ *******************************************************************************/
+
+/* Record layout and events, as in trace.h */
+#define TRACE_RECORD_BYTES     4
+#define TRACE_DUMP             0x01
+#define TRACE_DUMP_ABANDONED   0x02
+#define TRACE_FRAME_SENT       0x10
+#define TRACE_FRAME_RECEIVED   0x11
+#define TRACE_FRAME_CORRUPTED  0x12
+#define TRACE_UART_ERROR       0x20
+#define TRACE_UART_BAUD        0x21
+#define TRACE_TWI_START        0x30
+#define TRACE_TWI_FAILED       0x31
+#define TRACE_TWI_RECOVER      0x32
+#define TRACE_KEY              0x40
+#define TRACE_MOTOR            0x50
+#define TRACE_PIR              0x51
+#define TRACE_KEY_DIGIT        0xFF
+
+/* UCSRA error bits of TRACE_UART_ERROR */
+#define UART_FE                4
+#define UART_DOR               3
+#define UART_PE                2
+
+#define MAX_FILES              8
+#define MAX_RECORDS            128
+
+/*******************************************************************************
+ *                               Types Declaration                             *
+ *******************************************************************************/
+
+typedef struct {
+	uint64_t time_ms;       /* node time, unwrapped */
+	unsigned node;
+	unsigned index;         /* position in its dump */
+	uint8_t event;
+	uint8_t data;
+}DECODE_EventType;
+
+/*******************************************************************************
+ *                           Global Variables                                  *
+ *******************************************************************************/
+
+static char g_names[MAX_FILES][64];
+static DECODE_EventType g_events[MAX_FILES * MAX_RECORDS];
+static unsigned g_eventCount;
+
+/*******************************************************************************
+ *                      Functions Definitions                                  *
+ *******************************************************************************/
+
+static const char * DECODE_commandName(uint8_t command)
+{
+	switch(command)
+	{
+	case 0xE0: return "MC2_READY";
+	case 0xE1: return "GET_STATUS";
+	case 0xE2: return "SET_NEW_PASS";
+	case 0xE4: return "CONFIRM_PASS";
+	case 0xE5: return "PASS_MATCH";
+	case 0xE6: return "PASS_NO_MATCH";
+	case 0xE7: return "CHECK_PASS";
+	case 0xE8: return "GET_DIAG";
+	case 0xE9: return "RECIEVED";
+	case 0xEA: return "BAUD_CHANGE";
+	case 0xEB: return "BAUD_CONFIRM";
+	case 0xEC: return "BAUD_REJECTED";
+	case 0xED: return "REQUEST_PENDING";
+	case 0xEE: return "REQUEST_REJECTED";
+	case 0xF0: return "ATTEMPTS_ENDED";
+	case 0xF1: return "UNLOCK_DOOR";
+	case 0xF2: return "LOCK_DOOR";
+	case 0xF3: return "GET_AUDIT";
+	case 0xF4: return "AUDIT_DATA";
+	case 0xF5: return "GET_PROFILE";
+	case 0xF6: return "GET_TRACE";
+	case 0x23: return "PASSWORD_SAVED";
+	case 0x15: return "FRAME_NACK";
+	}
+	return "?";
+}
+
+/*
+ * Description :
+ * Print one event with its data byte decoded.
+ */
+static void DECODE_print(const DECODE_EventType * event)
+{
+	static const char * const motor[] = {"clockwise", "anticlockwise", "stop"};
+	const char * node = g_names[event->node];
+	double seconds = (double)event->time_ms / 1e3;
+
+	switch(event->event)
+	{
+	case TRACE_DUMP:
+		printf("%10.3f s  %-12s dump\n", seconds, node);
+		break;
+	case TRACE_DUMP_ABANDONED:
+		printf("%10.3f s  %-12s dump abandoned, recording resumed\n", seconds, node);
+		break;
+	case TRACE_FRAME_SENT:
+	case TRACE_FRAME_RECEIVED:
+		printf("%10.3f s  %-12s frame %-8s %s\n", seconds, node,
+				(event->event == TRACE_FRAME_SENT) ? "sent" : "received", DECODE_commandName(event->data));
+		break;
+	case TRACE_FRAME_CORRUPTED:
+		printf("%10.3f s  %-12s frame corrupted\n", seconds, node);
+		break;
+	case TRACE_UART_ERROR:
+		printf("%10.3f s  %-12s uart error%s%s%s\n", seconds, node,
+				(event->data & (1 << UART_FE)) ? " framing" : "",
+				(event->data & (1 << UART_DOR)) ? " overrun" : "",
+				(event->data & (1 << UART_PE)) ? " parity" : "");
+		break;
+	case TRACE_UART_BAUD:
+		printf("%10.3f s  %-12s uart baud %s%u\n", seconds, node,
+				(event->data == 255) ? ">= " : "", event->data * 1200U);
+		break;
+	case TRACE_TWI_START:
+		/* 24C16: the page bits of the memory address are in the device address */
+		printf("%10.3f s  %-12s twi %-5s block %u\n", seconds, node,
+				(event->data & 1) ? "read" : "write", (unsigned)((event->data >> 1) & 0x07));
+		break;
+	case TRACE_TWI_FAILED:
+		printf("%10.3f s  %-12s twi failed, status 0x%02X\n", seconds, node, event->data);
+		break;
+	case TRACE_TWI_RECOVER:
+		printf("%10.3f s  %-12s twi bus recovery\n", seconds, node);
+		break;
+	case TRACE_KEY:
+		if(event->data == TRACE_KEY_DIGIT)
+		{
+			printf("%10.3f s  %-12s key digit\n", seconds, node);
+		}
+		else if((event->data >= 0x20) && (event->data < 0x7F))
+		{
+			printf("%10.3f s  %-12s key '%c'\n", seconds, node, event->data);
+		}
+		else
+		{
+			printf("%10.3f s  %-12s key %u\n", seconds, node, event->data);
+		}
+		break;
+	case TRACE_MOTOR:
+		printf("%10.3f s  %-12s motor %s\n", seconds, node, (event->data < 3) ? motor[event->data] : "?");
+		break;
+	case TRACE_PIR:
+		printf("%10.3f s  %-12s pir %s\n", seconds, node, event->data ? "motion" : "no motion");
+		break;
+	default:
+		printf("%10.3f s  %-12s event 0x%02X data 0x%02X\n", seconds, node, event->event, event->data);
+		break;
+	}
+}
+
+/*
+ * Description :
+ * Read one dump and add its records to the timeline. The last record is
+ * the TRACE_DUMP of the dump request, taken as the node time closest to
+ * the one in the header, and every record before it is at most 65.5 s
+ * older than the next one. Returns the records read, -1 on a bad file.
+ */
+static int DECODE_load(const char * path, unsigned node)
+{
+	uint8_t header[4];
+	uint8_t records[MAX_RECORDS][TRACE_RECORD_BYTES];
+	size_t count;
+	uint64_t dump_ms;
+	uint64_t time_ms;
+	uint16_t next;
+	FILE * file = fopen(path, "rb");
+	int i;
+
+	if(file == NULL)
+	{
+		perror(path);
+		return -1;
+	}
+	if(fread(header, 1, sizeof(header), file) != sizeof(header))
+	{
+		fprintf(stderr, "%s: no header\n", path);
+		fclose(file);
+		return -1;
+	}
+	count = fread(records, TRACE_RECORD_BYTES, MAX_RECORDS, file);
+	fclose(file);
+	if(count == 0)
+	{
+		return 0;
+	}
+
+	dump_ms = (uint64_t)header[0] | ((uint64_t)header[1] << 8) | ((uint64_t)header[2] << 16) |
+			((uint64_t)header[3] << 24);
+
+	/* The closest time to the dump with the low 16 bits of the last record */
+	next = (uint16_t)(records[count - 1][0] | (records[count - 1][1] << 8));
+	time_ms = (dump_ms & ~0xFFFFULL) | next;
+	if((time_ms > dump_ms) && (time_ms - dump_ms > 0x8000) && (time_ms >= 0x10000))
+	{
+		time_ms -= 0x10000;
+	}
+	else if((time_ms < dump_ms) && (dump_ms - time_ms > 0x8000))
+	{
+		time_ms += 0x10000;
+	}
+
+	for(i = (int)count - 1; i >= 0; i--)
+	{
+		uint16_t low = (uint16_t)(records[i][0] | (records[i][1] << 8));
+		uint16_t back = (uint16_t)(next - low);
+
+		time_ms = (time_ms >= back) ? time_ms - back : 0;
+		next = low;
+
+		g_events[g_eventCount + (unsigned)i].time_ms = time_ms;
+		g_events[g_eventCount + (unsigned)i].node = node;
+		g_events[g_eventCount + (unsigned)i].event = records[i][2];
+		g_events[g_eventCount + (unsigned)i].data = records[i][3];
+		g_events[g_eventCount + (unsigned)i].index = (unsigned)i;
+	}
+	g_eventCount += (unsigned)count;
+	return (int)count;
+}
+
+/*
+ * Description :
+ * Order by time, then by node, keeping the order of the records of one node.
+ */
+static int DECODE_compare(const void * a, const void * b)
+{
+	const DECODE_EventType * first = a;
+	const DECODE_EventType * second = b;
+
+	if(first->time_ms != second->time_ms)
+	{
+		return (first->time_ms < second->time_ms) ? -1 : 1;
+	}
+	if(first->node != second->node)
+	{
+		return (first->node < second->node) ? -1 : 1;
+	}
+	return (first->index < second->index) ? -1 : (first->index > second->index);
+}
+
+int main(int argc, char * argv[])
+{
+	int i;
+
+	if((argc < 2) || (argc - 1 > MAX_FILES))
+	{
+		fprintf(stderr, "usage: %s dump... (up to %d)\n"
+				"  dumps are written by link_bench -T prefix as prefix-hmi.trace and prefix-control.trace\n",
+				argv[0], MAX_FILES);
+		return 2;
+	}
+
+	for(i = 1; i < argc; i++)
+	{
+		/* The node name is the file name without its directory and .trace */
+		const char * name = strrchr(argv[i], '/');
+		char * dot;
+
+		snprintf(g_names[i - 1], sizeof(g_names[i - 1]), "%s", (name != NULL) ? name + 1 : argv[i]);
+		dot = strstr(g_names[i - 1], ".trace");
+		if(dot != NULL)
+		{
+			*dot = '\0';
+		}
+		if(DECODE_load(argv[i], (unsigned)(i - 1)) < 0)
+		{
+			return 1;
+		}
+	}
+
+	qsort(g_events, g_eventCount, sizeof(g_events[0]), DECODE_compare);
+	for(i = 0; i < (int)g_eventCount; i++)
+	{
+		DECODE_print(&g_events[i]);
+	}
+	return 0;
+}
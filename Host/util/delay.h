@@ -0,0 +1,22 @@
+ /******************************************************************************
+ *
+ * Module: Host MCU Emulation
+ *
+ * File Name: util/delay.h
+ *
+ * Description: Host replacement for <util/delay.h>. Busy delays sleep for
+ *              the same amount of emulated time.
+ *
+ * Author: Malik Anas
+ *
+ *******************************************************************************/
+
+#ifndef HOST_UTIL_DELAY_H_
+#define HOST_UTIL_DELAY_H_
+
+void HOST_delayMicroseconds(double us);
+
+#define _delay_ms(ms)      HOST_delayMicroseconds((double)(ms) * 1000.0)
+#define _delay_us(us)      HOST_delayMicroseconds((double)(us))
+
+#endif /* HOST_UTIL_DELAY_H_ */